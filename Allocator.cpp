@@ -0,0 +1,269 @@
+#include "Allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <cstdio>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+void Allocator::init(VkDevice device, VkPhysicalDevice physicalDevice)
+{
+	this->device = device;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	pools.resize(memoryProperties.memoryTypeCount * 2);
+}
+
+void Allocator::destroy()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t leaked = 0;
+
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.blocks)
+		{
+			leaked += block->allocationCount;
+			releaseBlock(*block);
+		}
+	}
+
+	if (leaked)
+		fprintf(stderr, "Allocator destroyed with %u live allocations\n", leaked);
+
+	pools.clear();
+}
+
+uint32_t Allocator::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+		if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+
+	return ~0u;
+}
+
+bool Allocator::allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it)
+	{
+		VkDeviceSize rangeBegin = it->first;
+		VkDeviceSize rangeEnd = it->first + it->second;
+
+		VkDeviceSize aligned = alignUp(rangeBegin, alignment);
+
+		if (aligned + size > rangeEnd)
+			continue;
+
+		block.freeRanges.erase(it);
+
+		// the alignment padding and the tail stay free
+		if (aligned > rangeBegin)
+			block.freeRanges[rangeBegin] = aligned - rangeBegin;
+
+		if (aligned + size < rangeEnd)
+			block.freeRanges[aligned + size] = rangeEnd - (aligned + size);
+
+		offset = aligned;
+		return true;
+	}
+
+	return false;
+}
+
+uint32_t Allocator::createBlock(Pool& pool, uint32_t memoryTypeIndex, VkDeviceSize size)
+{
+	VkMemoryAllocateInfo allocInfo { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate device memory block!");
+
+	void* data = nullptr;
+
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		VK_CHECK(vkMapMemory(device, memory, 0, size, 0, &data));
+
+	// reuse a released slot, so outstanding allocations keep their block index
+	uint32_t index = 0;
+
+	while (index < pool.blocks.size() && pool.blocks[index]->memory != VK_NULL_HANDLE)
+		index++;
+
+	if (index == pool.blocks.size())
+		pool.blocks.push_back(std::make_unique<Block>());
+
+	Block& block = *pool.blocks[index];
+	block.memory = memory;
+	block.size = size;
+	block.data = data;
+	block.freeRanges = { { 0, size } };
+	block.allocationCount = 0;
+
+	return index;
+}
+
+void Allocator::releaseBlock(Block& block)
+{
+	if (block.memory == VK_NULL_HANDLE)
+		return;
+
+	// freeing mapped memory unmaps it implicitly
+	vkFreeMemory(device, block.memory, nullptr);
+
+	block = Block {};
+}
+
+Allocation Allocator::allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool linear, bool dedicated)
+{
+	assert(memoryTypeIndex < memoryProperties.memoryTypeCount);
+	assert(requirements.memoryTypeBits & (1u << memoryTypeIndex));
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t poolIndex = memoryTypeIndex * 2 + (linear ? 0 : 1);
+	Pool& pool = pools[poolIndex];
+
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+	uint32_t blockIndex = ~0u;
+	VkDeviceSize offset = 0;
+
+	if (!dedicated && requirements.size <= kBlockSize / 2)
+	{
+		for (uint32_t i = 0; i < pool.blocks.size(); ++i)
+		{
+			Block& block = *pool.blocks[i];
+
+			if (block.memory != VK_NULL_HANDLE && block.size == kBlockSize && allocateFromBlock(block, requirements.size, alignment, offset))
+			{
+				blockIndex = i;
+				break;
+			}
+		}
+
+		if (blockIndex == ~0u)
+		{
+			blockIndex = createBlock(pool, memoryTypeIndex, kBlockSize);
+			allocateFromBlock(*pool.blocks[blockIndex], requirements.size, alignment, offset);
+		}
+	}
+	else
+	{
+		blockIndex = createBlock(pool, memoryTypeIndex, requirements.size);
+		allocateFromBlock(*pool.blocks[blockIndex], requirements.size, alignment, offset);
+	}
+
+	Block& block = *pool.blocks[blockIndex];
+	block.allocationCount++;
+
+	Allocation result;
+	result.memory = block.memory;
+	result.offset = offset;
+	result.size = requirements.size;
+	result.data = block.data ? static_cast<uint8_t*>(block.data) + offset : nullptr;
+	result.pool = poolIndex;
+	result.block = blockIndex;
+
+	return result;
+}
+
+void Allocator::free(Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Pool& pool = pools[allocation.pool];
+	Block& block = *pool.blocks[allocation.block];
+
+	assert(block.memory == allocation.memory && block.allocationCount > 0);
+
+	VkDeviceSize begin = allocation.offset;
+	VkDeviceSize end = allocation.offset + allocation.size;
+
+	// merge with the free neighbours on both sides
+	auto next = block.freeRanges.lower_bound(begin);
+
+	if (next != block.freeRanges.end() && next->first == end)
+	{
+		end = next->first + next->second;
+		next = block.freeRanges.erase(next);
+	}
+
+	if (next != block.freeRanges.begin())
+	{
+		auto prev = std::prev(next);
+
+		if (prev->first + prev->second == begin)
+		{
+			begin = prev->first;
+			block.freeRanges.erase(prev);
+		}
+	}
+
+	block.freeRanges[begin] = end - begin;
+	block.allocationCount--;
+
+	// keep one empty shared block per pool around for the next allocation, give the rest back
+	if (block.allocationCount == 0)
+	{
+		bool keep = block.size == kBlockSize;
+
+		if (keep)
+			for (auto& other : pool.blocks)
+				if (other.get() != &block && other->memory != VK_NULL_HANDLE && other->size == kBlockSize && other->allocationCount == 0)
+					keep = false;
+
+		if (!keep)
+			releaseBlock(block);
+	}
+
+	allocation = Allocation {};
+}
+
+AllocatorStats Allocator::stats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	AllocatorStats result {};
+
+	VkDeviceSize freeBytes = 0;
+
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.blocks)
+		{
+			if (block->memory == VK_NULL_HANDLE)
+				continue;
+
+			result.blockCount++;
+			result.allocationCount += block->allocationCount;
+			result.reservedBytes += block->size;
+
+			for (auto& range : block->freeRanges)
+			{
+				result.freeRangeCount++;
+				result.largestFreeRange = std::max(result.largestFreeRange, range.second);
+
+				freeBytes += range.second;
+			}
+		}
+	}
+
+	result.usedBytes = result.reservedBytes - freeBytes;
+	result.fragmentation = freeBytes ? 1.0 - double(result.largestFreeRange) / double(freeBytes) : 0.0;
+
+	return result;
+}
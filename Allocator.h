@@ -0,0 +1,87 @@
+#pragma once
+
+#include "onez.h"
+#include <volk.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A sub-range of one device memory block. Host visible blocks stay mapped, data points at offset.
+struct Allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+
+	void* data = nullptr;
+
+	uint32_t pool = ~0u;
+	uint32_t block = ~0u;
+};
+
+struct AllocatorStats
+{
+	uint32_t blockCount;      // live vkAllocateMemory allocations
+	uint32_t allocationCount;
+
+	VkDeviceSize reservedBytes;
+	VkDeviceSize usedBytes;
+
+	uint32_t freeRangeCount;
+	VkDeviceSize largestFreeRange;
+
+	// 1 - largest free range / total free bytes
+	double fragmentation;
+};
+
+// Carves buffers and images out of large per memory type blocks with a first-fit free list.
+// Linear (buffers) and optimal tiling resources use separate blocks, so bufferImageGranularity never applies
+// within a block; requests above half a block get a dedicated one.
+class Allocator final
+{
+public:
+	static constexpr VkDeviceSize kBlockSize = 64ull << 20;
+
+	void init(VkDevice device, VkPhysicalDevice physicalDevice);
+	void destroy();
+
+	// first memory type in typeBits with all of the properties, ~0u if there is none
+	uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const;
+
+	// dedicated gives the allocation a block sized to it, for memory types too scarce to reserve a whole block in
+	Allocation allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool linear, bool dedicated = false);
+	void free(Allocation& allocation);
+
+	AllocatorStats stats();
+
+	const VkPhysicalDeviceMemoryProperties& properties() const { return memoryProperties; }
+
+private:
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		void* data = nullptr;
+
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges; // offset -> size, never adjacent
+		uint32_t allocationCount = 0;
+	};
+
+	struct Pool
+	{
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	bool allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	uint32_t createBlock(Pool& pool, uint32_t memoryTypeIndex, VkDeviceSize size);
+	void releaseBlock(Block& block);
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties {};
+
+	std::vector<Pool> pools; // memoryTypeCount * 2, linear and optimal tiling
+
+	std::mutex mutex;
+};
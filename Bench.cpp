@@ -0,0 +1,326 @@
+#include "Bench.h"
+#include "ObjLoader.h"
+#include "VertexFormat.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <system_error>
+
+static bool writeSyntheticObj(const std::filesystem::path& path, size_t triangles)
+{
+	// a square grid of quads, each split into two triangles, with every attribute present
+	size_t quads = (triangles + 1) / 2;
+	size_t side = size_t(std::ceil(std::sqrt(double(quads)))) + 1;
+
+	auto tempPath = path;
+	tempPath += ".tmp";
+
+	FILE* f = fopen(tempPath.string().c_str(), "wb");
+
+	if (!f)
+		return false;
+
+	std::string buffer;
+	buffer.reserve(1 << 20);
+
+	char line[256];
+
+	auto flush = [&]() {
+		fwrite(buffer.data(), 1, buffer.size(), f);
+		buffer.clear();
+	};
+
+	auto append = [&](int length) {
+		buffer.append(line, size_t(length));
+
+		if (buffer.size() > (1 << 20) - sizeof(line))
+			flush();
+	};
+
+	for (size_t y = 0; y < side; ++y)
+		for (size_t x = 0; x < side; ++x)
+		{
+			float u = float(x) / float(side - 1);
+			float v = float(y) / float(side - 1);
+
+			append(snprintf(line, sizeof(line), "v %f %f %f\nvt %f %f\nvn 0 1 0\n", u * 2 - 1, 0.1f * std::sin(u * 40) * std::cos(v * 40), v * 2 - 1, u, v));
+		}
+
+	size_t written = 0;
+
+	for (size_t y = 0; y + 1 < side && written < triangles; ++y)
+		for (size_t x = 0; x + 1 < side && written < triangles; ++x)
+		{
+			size_t a = y * side + x + 1, b = a + 1, c = a + side, d = c + 1;
+
+			append(snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n", a, a, a, c, c, c, b, b, b));
+			append(snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n", b, b, b, c, c, c, d, d, d));
+			written += 2;
+		}
+
+	flush();
+
+	bool ok = fclose(f) == 0;
+
+	std::error_code ec;
+
+	if (ok)
+		std::filesystem::rename(tempPath, path, ec);
+
+	if (!ok || ec)
+	{
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+
+	return true;
+}
+
+static void benchFile(const std::filesystem::path& path, ThreadPool& pool)
+{
+	std::error_code ec;
+	auto fileSize = std::filesystem::file_size(path, ec);
+
+	if (ec)
+	{
+		fprintf(stderr, "bench: cannot open '%s'\n", path.string().c_str());
+		return;
+	}
+
+	printf("%s (%.1f MB)\n", path.string().c_str(), double(fileSize) / 1e6);
+
+	auto run = [&](const char* name, auto load) {
+		Mesh mesh;
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		bool ok = load(mesh);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+		if (!ok)
+		{
+			printf("  %-24s failed\n", name);
+			return;
+		}
+
+		printf("  %-24s %9.1f ms %8.1f MB/s %10zu triangles %10zu vertices\n", name, ms, double(fileSize) / 1e3 / ms, mesh.indices.size() / 3, mesh.vertices.size());
+	};
+
+	const std::string file = path.string();
+
+	run("tinyobjloader", [&](Mesh& mesh) { return loadObjTinyObj(file.c_str(), mesh); });
+	run("fast_obj", [&](Mesh& mesh) { return loadObj(file.c_str(), mesh); });
+
+	char name[32];
+	snprintf(name, sizeof(name), "fast_obj x%u threads", pool.size());
+
+	run(name, [&](Mesh& mesh) { return loadObj(file.c_str(), mesh, &pool); });
+}
+
+static std::filesystem::path syntheticObj(size_t triangles)
+{
+	std::error_code ec;
+	auto path = std::filesystem::temp_directory_path(ec) / ("onez_bench_" + std::to_string(triangles) + ".obj");
+
+	if (!std::filesystem::exists(path, ec))
+	{
+		printf("writing synthetic %zu triangle OBJ to %s\n", triangles, path.string().c_str());
+
+		if (!writeSyntheticObj(path, triangles))
+		{
+			fprintf(stderr, "bench: cannot write '%s'\n", path.string().c_str());
+			return {};
+		}
+	}
+
+	return path;
+}
+
+void benchObjLoad(const std::filesystem::path& modelPath, size_t syntheticTriangles, ThreadPool& pool)
+{
+	benchFile(modelPath, pool);
+
+	auto syntheticPath = syntheticObj(syntheticTriangles);
+
+	if (!syntheticPath.empty())
+		benchFile(syntheticPath, pool);
+}
+
+static void benchMeshletFile(const std::filesystem::path& path, ThreadPool& pool)
+{
+	Mesh mesh;
+
+	if (!loadObj(path.string().c_str(), mesh, &pool))
+	{
+		fprintf(stderr, "bench: cannot open '%s'\n", path.string().c_str());
+		return;
+	}
+
+	optimizeMesh(mesh);
+
+	printf("%s (%zu triangles)\n", path.string().c_str(), mesh.indices.size() / 3);
+
+	const MeshletSettings configs[] =
+	{
+		{64, 124, 0.0f},
+		{64, 124, 0.25f},
+		{64, 124, 0.5f},
+		{64, 84, 0.25f},
+		{32, 64, 0.25f},
+	};
+
+	for (const MeshletSettings& settings : configs)
+	{
+		buildMeshlets(mesh, settings);
+
+		// best of a few runs, the first one also pays for page faults in the scratch arrays
+		double ms = 0;
+
+		for (int run = 0; run < 3; ++run)
+		{
+			auto begin = std::chrono::high_resolution_clock::now();
+			buildMeshlets(mesh, settings);
+			double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+			ms = run ? std::min(ms, elapsed) : elapsed;
+		}
+
+		size_t vertices = 0, triangles = 0, cones = 0;
+
+		for (const Meshlet& meshlet : mesh.meshlets)
+		{
+			vertices += meshlet.vertexCount;
+			triangles += meshlet.triangleCount;
+			cones += meshlet.coneCutoff < 127;
+		}
+
+		double count = double(std::max(mesh.meshlets.size(), size_t(1)));
+		double meshTriangles = double(std::max(mesh.indices.size() / 3, size_t(1)));
+
+		size_t packedBytes = 0, fixedBytes = 0;
+		meshletFootprint(mesh, packedBytes, fixedBytes);
+
+		printf("  v%-3zu t%-3zu cone %.2f %9.2f ms %8zu meshlets  avg %5.1f vertices (%3.0f%%) %5.1f triangles (%3.0f%%)  %3.0f%% with cone  %5.2f B/tri (fixed %5.2f)\n",
+			settings.maxVertices, settings.maxTriangles, settings.coneWeight, ms, mesh.meshlets.size(),
+			vertices / count, 100 * vertices / count / double(settings.maxVertices),
+			triangles / count, 100 * triangles / count / double(settings.maxTriangles),
+			100 * cones / count, packedBytes / meshTriangles, fixedBytes / meshTriangles);
+	}
+}
+
+void benchMeshlets(const std::filesystem::path& modelPath, size_t syntheticTriangles, ThreadPool& pool)
+{
+	benchMeshletFile(modelPath, pool);
+
+	auto syntheticPath = syntheticObj(syntheticTriangles);
+
+	if (!syntheticPath.empty())
+		benchMeshletFile(syntheticPath, pool);
+}
+
+// Best of a few runs of a pass over the mesh in index order, like the vertex stage fetches it. Returns the
+// checksum so the decode can't be optimized away.
+template <typename Fetch>
+static double timeFetch(const Mesh& mesh, Fetch fetch, float& checksum)
+{
+	double ms = 0;
+
+	for (int run = 0; run < 3; ++run)
+	{
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		glm::vec3 sum(0.0f);
+
+		for (uint32_t index : mesh.indices)
+			sum += fetch(index);
+
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+		ms = run ? std::min(ms, elapsed) : elapsed;
+		checksum += sum.x + sum.y + sum.z;
+	}
+
+	return ms;
+}
+
+template <typename V>
+static void benchVertexFormat(const Mesh& mesh, double baselineBytes, float& checksum)
+{
+	VertexQuantization quantization = vertexQuantization(mesh);
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	std::vector<V> vertices = encodeVertices<V>(mesh, quantization);
+	double encodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+	float diagonal = std::max(glm::length(mesh.bounding[1] - mesh.bounding[0]), FLT_MIN);
+	float positionError = 0.0f, normalError = 0.0f;
+
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		positionError = std::max(positionError, glm::length(vertices[i].decodePosition(quantization) - mesh.vertices[i].position));
+
+		const Vertex& vertex = mesh.vertices[i];
+		glm::vec3 normal(glm::unpackHalf1x16(vertex.normal.x), glm::unpackHalf1x16(vertex.normal.y), glm::unpackHalf1x16(vertex.normal.z));
+
+		if (glm::length(normal) > 0.0f)
+		{
+			float cosine = glm::dot(glm::normalize(normal), vertices[i].decodeNormal());
+			normalError = std::max(normalError, std::acos(std::min(std::max(cosine, -1.0f), 1.0f)));
+		}
+	}
+
+	double fetchMs = timeFetch(mesh, [&](uint32_t index) { return vertices[index].decodePosition(quantization) + vertices[index].decodeNormal(); }, checksum);
+
+	double bytes = double(vertices.size() * sizeof(V));
+
+	printf("  %-18s %-14s %2zu B/vertex %9.1f KB (%3.0f%%)  encode %7.2f ms  CPU fetch %7.2f ms  max error %.2e of diagonal, %.3f deg\n",
+		V::Position::name, V::Normal::name, sizeof(V), bytes / 1e3, 100 * bytes / baselineBytes, encodeMs, fetchMs,
+		positionError / diagonal, glm::degrees(normalError));
+}
+
+static void benchVertexFile(const std::filesystem::path& path, ThreadPool& pool)
+{
+	Mesh mesh;
+
+	if (!loadObj(path.string().c_str(), mesh, &pool))
+	{
+		fprintf(stderr, "bench: cannot open '%s'\n", path.string().c_str());
+		return;
+	}
+
+	optimizeMesh(mesh);
+
+	printf("%s (%zu vertices, %zu triangles)\n", path.string().c_str(), mesh.vertices.size(), mesh.indices.size() / 3);
+
+	float checksum = 0.0f;
+	double baselineBytes = double(std::max(mesh.vertices.size() * sizeof(Vertex), size_t(1)));
+
+	double fetchMs = timeFetch(mesh, [&](uint32_t index) {
+		const Vertex& vertex = mesh.vertices[index];
+		return vertex.position + glm::vec3(glm::unpackHalf1x16(vertex.normal.x), glm::unpackHalf1x16(vertex.normal.y), glm::unpackHalf1x16(vertex.normal.z));
+	}, checksum);
+
+	printf("  %-33s %2zu B/vertex %9.1f KB (100%%)  encode %7.2f ms  CPU fetch %7.2f ms\n", "Vertex (unpacked)", sizeof(Vertex), baselineBytes / 1e3, 0.0, fetchMs);
+
+	benchVertexFormat<PackedVertex<PositionEncoding::Float32, NormalEncoding::Oct16>>(mesh, baselineBytes, checksum);
+	benchVertexFormat<PackedVertex<PositionEncoding::Float32, NormalEncoding::Oct8>>(mesh, baselineBytes, checksum);
+	benchVertexFormat<PackedVertex<PositionEncoding::Unorm16, NormalEncoding::Oct16>>(mesh, baselineBytes, checksum);
+	benchVertexFormat<PackedVertex<PositionEncoding::Unorm16, NormalEncoding::Oct8>>(mesh, baselineBytes, checksum);
+
+	// keeps the fetch loops alive
+	if (checksum == 1.0f)
+		printf("\n");
+}
+
+void benchVertexFormats(const std::filesystem::path& modelPath, size_t syntheticTriangles, ThreadPool& pool)
+{
+	benchVertexFile(modelPath, pool);
+
+	auto syntheticPath = syntheticObj(syntheticTriangles);
+
+	if (!syntheticPath.empty())
+		benchVertexFile(syntheticPath, pool);
+}
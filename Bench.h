@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+class ThreadPool;
+
+// Times the OBJ backends (tinyobjloader, fast_obj single pass, fast_obj chunked on the pool) on the given
+// model and on a generated grid with at least syntheticTriangles triangles, which is kept in the temp directory.
+void benchObjLoad(const std::filesystem::path& modelPath, size_t syntheticTriangles, ThreadPool& pool);
+
+// Loads and optimizes the same two meshes, then times buildMeshlets over a few settings and reports
+// the average vertex/triangle fill per meshlet, how many meshlets got a usable normal cone and the
+// packed GPU footprint per triangle next to the old fixed-capacity layout.
+void benchMeshlets(const std::filesystem::path& modelPath, size_t syntheticTriangles, ThreadPool& pool);
+
+// Encodes the same two meshes into every PackedVertex layout and reports the vertex buffer size next to the
+// unpacked Vertex, the worst position and normal error, and the time of a decoding pass in index order on the
+// CPU. --bench-vertices then times the fetch of every layout on the GPU as well, see HeVK::benchVertexFetch.
+void benchVertexFormats(const std::filesystem::path& modelPath, size_t syntheticTriangles, ThreadPool& pool);
@@ -1,4 +1,5 @@
 #include "BuilderSPIRV.h"
+#include "ThreadPool.h"
 
 #include <cstring>
 #include <cassert>
@@ -8,10 +9,25 @@
 
 #include <stdio.h>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <string>
 #include <algorithm>
+#include <system_error>
+
+#include <glslang/build_info.h>
 
 // #include "spirv_reflect.c"
 
+// only written between compiles, never while one runs, so the compile threads share it without a lock
+static std::map<std::string, std::string> generatedIncludes;
+
+void setShaderInclude(const char* name, const std::string& source)
+{
+	generatedIncludes[name] = source;
+}
+
 std::string readFileGLSL(const char* filePath)
 {
 	FILE* file = fopen(filePath, "r");
@@ -75,6 +91,12 @@ std::string readFileGLSL(const char* filePath)
 
 		const std::string name = macro_line.substr(p1 + 1, p2 - p1 - 1);
 
+		if (auto generated = generatedIncludes.find(name); generated != generatedIncludes.end())
+		{
+			result += generated->second;
+			continue;
+		}
+
 		auto work_path = _filePath;
 		work_path.append(name);
 
@@ -149,17 +171,36 @@ void printShaderSource(const char* text)
 	printf("\n");
 }
 
+static const glslang_target_client_version_t kTargetClientVersion = GLSLANG_TARGET_VULKAN_1_2;
+static const glslang_target_language_version_t kTargetLanguageVersion = GLSLANG_TARGET_SPV_1_4; // GL_EXT_mesh_shader needs SPIR-V 1.4
+
+static std::once_flag glslangInitialized;
+static bool glslangProcessActive = false;
+
+void finalizeShaderCompiler()
+{
+	if (glslangProcessActive)
+		glslang_finalize_process();
+
+	glslangProcessActive = false;
+}
+
 size_t compileShaderData(glslang_stage_t stage, const char* shaderSource, _Shader& _shader)
 {
+	// deferred to the first compile, so fully cached runs never start glslang
+	std::call_once(glslangInitialized, []() {
+		glslangProcessActive = glslang_initialize_process() != 0;
+	});
+
 #if defined(_MSC_VER)
 	const glslang_input_t input =
 	{
 		GLSLANG_SOURCE_GLSL,
 		stage,
 		GLSLANG_CLIENT_VULKAN,
-		GLSLANG_TARGET_VULKAN_1_2,
+		kTargetClientVersion,
 		GLSLANG_TARGET_SPV,
-		GLSLANG_TARGET_SPV_1_3,
+		kTargetLanguageVersion,
 		shaderSource,
 		100,
 		GLSLANG_NO_PROFILE,
@@ -174,9 +215,9 @@ size_t compileShaderData(glslang_stage_t stage, const char* shaderSource, _Shade
 		.language = GLSLANG_SOURCE_GLSL,
 		.stage = stage,
 		.client = GLSLANG_CLIENT_VULKAN,
-		.client_version = GLSLANG_TARGET_VULKAN_1_2,
+		.client_version = kTargetClientVersion,
 		.target_language = GLSLANG_TARGET_SPV,
-		.target_language_version = GLSLANG_TARGET_SPV_1_3,
+		.target_language_version = kTargetLanguageVersion,
 		.code = shaderSource,
 		.default_version = 100,
 		.default_profile = GLSLANG_NO_PROFILE,
@@ -237,6 +278,153 @@ size_t compileShaderData(glslang_stage_t stage, const char* shaderSource, _Shade
 	return _shader.SPIRV.size();
 }
 
+static const uint32_t kShaderCacheMagic = 0x535a4e4f; // 'ONZS'
+static const uint32_t kShaderCacheVersion = 2; // 2: uniform blocks reflect as UNIFORM_BUFFER
+
+struct ShaderCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+
+	uint32_t stage;
+	uint32_t resourceMask;
+	uint32_t resourceTypes[32];
+	uint32_t localSize[3];
+	uint32_t usesPushConstants;
+
+	uint32_t codeSize;
+	uint32_t reserved;
+};
+
+static std::filesystem::path shaderCacheDirectory;
+
+static std::atomic<uint32_t> shaderCacheHits {0};
+static std::atomic<uint32_t> shaderCacheMisses {0};
+
+void setShaderCacheDirectory(const std::filesystem::path& directory)
+{
+	shaderCacheDirectory = directory;
+
+	if (!directory.empty())
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(directory, ec);
+	}
+}
+
+void getShaderCacheStats(uint32_t& hits, uint32_t& misses)
+{
+	hits = shaderCacheHits;
+	misses = shaderCacheMisses;
+}
+
+// injected defines are already part of the source text at this point; the glslang release is part of the
+// key, another compiler may emit other SPIR-V for the same source
+static uint64_t shaderCacheKey(glslang_stage_t stage, const std::string& source)
+{
+	const uint32_t environment[] = { kShaderCacheVersion, uint32_t(stage), uint32_t(GLSLANG_CLIENT_VULKAN), uint32_t(kTargetClientVersion), uint32_t(GLSLANG_TARGET_SPV), uint32_t(kTargetLanguageVersion),
+		uint32_t(GLSLANG_VERSION_MAJOR), uint32_t(GLSLANG_VERSION_MINOR), uint32_t(GLSLANG_VERSION_PATCH) };
+
+	const char flavor[] = GLSLANG_VERSION_FLAVOR;
+
+	return hash64(source.data(), source.size(), hash64(flavor, sizeof(flavor) - 1, hash64(environment, sizeof(environment))));
+}
+
+static bool loadCachedShader(const std::filesystem::path& path, uint64_t key, _Shader& _shader)
+{
+	FILE* file = fopen(path.string().c_str(), "rb");
+
+	if (!file)
+		return false;
+
+	fseek(file, 0L, SEEK_END);
+	const auto bytesinfile = ftell(file);
+	fseek(file, 0L, SEEK_SET);
+
+	ShaderCacheHeader header {};
+
+	bool ok = bytesinfile >= long(sizeof(header)) && fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == kShaderCacheMagic && header.version == kShaderCacheVersion && header.key == key
+		&& header.codeSize > 5 && uint64_t(header.codeSize) * sizeof(uint32_t) == uint64_t(bytesinfile) - sizeof(header);
+
+	if (ok)
+	{
+		_shader.SPIRV.resize(header.codeSize);
+		ok = fread(_shader.SPIRV.data(), sizeof(uint32_t), header.codeSize, file) == header.codeSize && _shader.SPIRV[0] == SpvMagicNumber;
+	}
+
+	fclose(file);
+
+	if (!ok)
+	{
+		_shader.SPIRV.clear();
+		return false;
+	}
+
+	_shader.stage = VkShaderStageFlagBits(header.stage);
+	_shader.resourceMask = header.resourceMask;
+
+	for (uint32_t i = 0; i < 32; ++i)
+		_shader.resourceTypes[i] = VkDescriptorType(header.resourceTypes[i]);
+
+	_shader.localSizeX = header.localSize[0];
+	_shader.localSizeY = header.localSize[1];
+	_shader.localSizeZ = header.localSize[2];
+
+	_shader.usesPushConstants = header.usesPushConstants != 0;
+
+	return true;
+}
+
+static bool saveCachedShader(const std::filesystem::path& path, uint64_t key, const _Shader& _shader)
+{
+	ShaderCacheHeader header {};
+	header.magic = kShaderCacheMagic;
+	header.version = kShaderCacheVersion;
+	header.key = key;
+
+	header.stage = _shader.stage;
+	header.resourceMask = _shader.resourceMask;
+
+	for (uint32_t i = 0; i < 32; ++i)
+		header.resourceTypes[i] = _shader.resourceTypes[i];
+
+	header.localSize[0] = _shader.localSizeX;
+	header.localSize[1] = _shader.localSizeY;
+	header.localSize[2] = _shader.localSizeZ;
+
+	header.usesPushConstants = _shader.usesPushConstants;
+	header.codeSize = uint32_t(_shader.SPIRV.size());
+
+	// write next to the destination and rename, so a concurrent reader never sees a partial file
+	auto tempPath = path;
+	tempPath += ".tmp";
+
+	FILE* file = fopen(tempPath.string().c_str(), "wb");
+
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(_shader.SPIRV.data(), sizeof(uint32_t), _shader.SPIRV.size(), file) == _shader.SPIRV.size();
+
+	ok = (fclose(file) == 0) && ok;
+
+	std::error_code ec;
+
+	if (ok)
+		std::filesystem::rename(tempPath, path, ec);
+
+	if (!ok || ec)
+	{
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+
+	return true;
+}
+
 size_t compileShaderFile(const char* file, _Shader& _shader)
 {
 	if (auto shaderSource = readFileGLSL(file); !shaderSource.empty()) {
@@ -259,7 +447,34 @@ size_t compileShaderFile(const char* file, _Shader& _shader)
 			}
 		}
 
-		return compileShaderData(stage, shaderSource.c_str(), _shader);
+		uint64_t key = 0;
+		std::filesystem::path cachePath;
+
+		if (!shaderCacheDirectory.empty()) {
+			key = shaderCacheKey(stage, shaderSource);
+
+			char name[32];
+			snprintf(name, sizeof(name), ".%016llx.spv", (unsigned long long)key);
+
+			cachePath = shaderCacheDirectory / (std::filesystem::path(file).filename().string() + name);
+
+			if (loadCachedShader(cachePath, key, _shader)) {
+				shaderCacheHits++;
+				return _shader.SPIRV.size();
+			}
+
+			shaderCacheMisses++;
+		}
+
+		if (compileShaderData(stage, shaderSource.c_str(), _shader) < 1)
+			return 0;
+
+		parseShader(_shader, _shader.SPIRV.data(), uint32_t(_shader.SPIRV.size()));
+
+		if (!cachePath.empty() && !saveCachedShader(cachePath, key, _shader))
+			fprintf(stderr, "Failed to write shader cache '%s'\n", cachePath.string().c_str());
+
+		return _shader.SPIRV.size();
 	}
 
 	return 0;
@@ -310,8 +525,6 @@ void testShaderCompilation(const char* sourceFilename, const char* destFilename)
 	if (compileShaderFile(sourceFilename, _shader) < 1)
 		return;
 
-	parseShader(_shader, _shader.SPIRV.data(), _shader.SPIRV.size());
-
 	saveFileSPIRV(destFilename, _shader.SPIRV.data(), _shader.SPIRV.size());
 }
 
@@ -378,12 +591,13 @@ static VkShaderStageFlagBits getShaderStage(SpvExecutionModel executionModel)
 	}
 }
 
-static VkDescriptorType getDescriptorType(SpvOp op)
+static VkDescriptorType getDescriptorType(SpvOp op, SpvStorageClass storageClass)
 {
 	switch (op)
 	{
 	case SpvOpTypeStruct:
-		return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		// SPIR-V 1.3+ keeps storage buffers in their own storage class, blocks left in Uniform are UBOs
+		return storageClass == SpvStorageClassUniform ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	case SpvOpTypeImage:
 		return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 	case SpvOpTypeSampler:
@@ -535,7 +749,7 @@ void parseShader(_Shader& shader, const uint32_t* code, uint32_t codeSize)
 			assert(ids[id.typeId].opcode == SpvOpTypePointer);
 
 			uint32_t typeKind = ids[ids[id.typeId].typeId].opcode;
-			VkDescriptorType resourceType = getDescriptorType(SpvOp(typeKind));
+			VkDescriptorType resourceType = getDescriptorType(SpvOp(typeKind), SpvStorageClass(id.storageClass));
 
 			assert((shader.resourceMask & (1 << id.binding)) == 0 || shader.resourceTypes[id.binding] == resourceType);
 
@@ -579,7 +793,6 @@ bool loadinShader(_Shader& shader, VkDevice device, const char* path) {
 	if (size < 1 ) return false;
 
 	shader.vkModule = createVkShaderModule(shader.SPIRV, device);
-	parseShader(shader, shader.SPIRV.data(), shader.SPIRV.size());
 
 	return true;
 }
@@ -589,6 +802,33 @@ bool loadinShader(_Shader& shader, VkDevice device, const std::filesystem::path
 	return loadinShader(shader, device, file_path.string().c_str());
 }
 
+bool loadinShaders(ThreadPool& pool, VkDevice device, const std::filesystem::path& root_path, std::initializer_list<_ShaderSource> shaders)
+{
+	const std::vector<_ShaderSource> jobs(shaders);
+	std::vector<size_t> sizes(jobs.size(), 0);
+
+	pool.parallelFor(jobs.size(), [&](size_t i) {
+		auto file_path = root_path / jobs[i].path;
+		sizes[i] = compileShaderFile(file_path.string().c_str(), *jobs[i].shader);
+	});
+
+	bool result = true;
+
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (sizes[i] < 1)
+		{
+			fprintf(stderr, "Failed to load shader '%s'\n", jobs[i].path);
+			result = false;
+			continue;
+		}
+
+		jobs[i].shader->vkModule = createVkShaderModule(jobs[i].shader->SPIRV, device);
+	}
+
+	return result;
+}
+
 static VkSpecializationInfo fillSpecializationInfo(std::vector<VkSpecializationMapEntry>& entries, const _Constants& constants)
 {
 	for (size_t i = 0; i < constants.size(); ++i)
@@ -603,6 +843,87 @@ static VkSpecializationInfo fillSpecializationInfo(std::vector<VkSpecializationM
 	return result;
 }
 
+VkPipeline createGraphicsPipelineVK13(VkDevice device, VkPipelineCache pipelineCache, const VkPipelineRenderingCreateInfo& renderingInfo, _Shaders shaders, VkPipelineLayout layout,
+	_Constants constants, VkSampleCountFlagBits samples, const VkPipelineVertexInputStateCreateInfo* vertexInput)
+{
+	std::vector<VkSpecializationMapEntry> specializationEntries;
+	VkSpecializationInfo specializationInfo = fillSpecializationInfo(specializationEntries, constants);
+
+	std::vector<VkPipelineShaderStageCreateInfo> stages;
+
+	for (const _Shader* shader : shaders)
+	{
+		VkPipelineShaderStageCreateInfo stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+		stage.stage = shader->stage;
+		stage.module = shader->vkModule;
+		stage.pName = "main";
+		stage.pSpecializationInfo = &specializationInfo;
+
+		stages.push_back(stage);
+	}
+
+	VkPipelineVertexInputStateCreateInfo emptyVertexInput = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	VkPipelineViewportStateCreateInfo viewportState = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkPipelineRasterizationStateCreateInfo rasterizationState = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+	rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizationState.cullMode = VK_CULL_MODE_NONE;
+	rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizationState.lineWidth = 1.f;
+
+	VkPipelineMultisampleStateCreateInfo multisampleState = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+	multisampleState.rasterizationSamples = samples;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilState = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	depthStencilState.depthTestEnable = renderingInfo.depthAttachmentFormat != VK_FORMAT_UNDEFINED;
+	depthStencilState.depthWriteEnable = renderingInfo.depthAttachmentFormat != VK_FORMAT_UNDEFINED;
+	depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencilState.maxDepthBounds = 1.f;
+
+	// one opaque attachment state per color attachment the pipeline renders to
+	VkPipelineColorBlendAttachmentState colorAttachmentState = {};
+	colorAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+	std::vector<VkPipelineColorBlendAttachmentState> colorAttachmentStates(renderingInfo.colorAttachmentCount, colorAttachmentState);
+
+	VkPipelineColorBlendStateCreateInfo colorBlendState = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+	colorBlendState.attachmentCount = uint32_t(colorAttachmentStates.size());
+	colorBlendState.pAttachments = colorAttachmentStates.data();
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	dynamicState.dynamicStateCount = uint32_t(sizeof(dynamicStates) / sizeof(dynamicStates[0]));
+	dynamicState.pDynamicStates = dynamicStates;
+
+	// no render pass, the attachment formats come in renderingInfo
+	VkGraphicsPipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	createInfo.pNext = &renderingInfo;
+	createInfo.stageCount = uint32_t(stages.size());
+	createInfo.pStages = stages.data();
+	createInfo.pVertexInputState = vertexInput ? vertexInput : &emptyVertexInput;
+	createInfo.pInputAssemblyState = &inputAssembly;
+	createInfo.pViewportState = &viewportState;
+	createInfo.pRasterizationState = &rasterizationState;
+	createInfo.pMultisampleState = &multisampleState;
+	createInfo.pDepthStencilState = &depthStencilState;
+	createInfo.pColorBlendState = &colorBlendState;
+	createInfo.pDynamicState = &dynamicState;
+	createInfo.layout = layout;
+	createInfo.renderPass = VK_NULL_HANDLE;
+
+	VkPipeline pipeline = 0;
+	VK_CHECK(vkCreateGraphicsPipelines(device, pipelineCache, 1, &createInfo, 0, &pipeline));
+
+	return pipeline;
+}
+
 VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const _Shader &shader, VkPipelineLayout layout, _Constants constants) 
 {
 	assert(shader.stage == VK_SHADER_STAGE_COMPUTE_BIT);
@@ -713,3 +1034,67 @@ VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout set
 
 	return layout;
 }
+
+static VkDescriptorUpdateTemplate createProgramUpdateTemplate(VkDevice device, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, VkDescriptorSetLayout setLayout, _Shaders shaders, bool pushDescriptorsSupported)
+{
+	std::vector<VkDescriptorUpdateTemplateEntry> entries;
+
+	VkDescriptorType resourceTypes[32] {};
+	uint32_t resourceMask = gatherResources(shaders, resourceTypes);
+
+	// the DescriptorInfo array passed at update time is indexed by binding
+	for (uint32_t i = 0; i < 32; ++i)
+		if (resourceMask & (1 << i))
+		{
+			VkDescriptorUpdateTemplateEntry entry = {};
+			entry.dstBinding = i;
+			entry.dstArrayElement = 0;
+			entry.descriptorCount = 1;
+			entry.descriptorType = resourceTypes[i];
+			entry.offset = sizeof(DescriptorInfo) * i;
+			entry.stride = sizeof(DescriptorInfo);
+
+			entries.push_back(entry);
+		}
+
+	VkDescriptorUpdateTemplateCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+
+	createInfo.descriptorUpdateEntryCount = uint32_t(entries.size());
+	createInfo.pDescriptorUpdateEntries = entries.data();
+
+	createInfo.templateType = pushDescriptorsSupported ? VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR : VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+	createInfo.descriptorSetLayout = setLayout;
+	createInfo.pipelineBindPoint = bindPoint;
+	createInfo.pipelineLayout = layout;
+
+	VkDescriptorUpdateTemplate updateTemplate = 0;
+	VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &createInfo, 0, &updateTemplate));
+
+	return updateTemplate;
+}
+
+_Program createProgram(VkDevice device, VkPipelineBindPoint bindPoint, _Shaders shaders, size_t pushConstantSize, bool pushDescriptorsSupported)
+{
+	VkShaderStageFlags pushConstantStages = 0;
+
+	for (const auto* shader : shaders)
+		if (shader->usesPushConstants)
+			pushConstantStages |= shader->stage;
+
+	_Program program = {};
+
+	program.bindPoint = bindPoint;
+	program.setLayout = createSetLayout(device, shaders, pushDescriptorsSupported);
+	program.layout = createPipelineLayout(device, program.setLayout, pushConstantStages, pushConstantSize);
+	program.updateTemplate = createProgramUpdateTemplate(device, bindPoint, program.layout, program.setLayout, shaders, pushDescriptorsSupported);
+	program.pushConstantStages = pushConstantStages;
+
+	return program;
+}
+
+void destroyProgram(VkDevice device, const _Program& program)
+{
+	vkDestroyDescriptorUpdateTemplate(device, program.updateTemplate, 0);
+	vkDestroyPipelineLayout(device, program.layout, 0);
+	vkDestroyDescriptorSetLayout(device, program.setLayout, 0);
+}
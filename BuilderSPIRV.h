@@ -99,14 +99,41 @@ int SpirvReflectExample(const void* spirv_code, size_t spirv_nbytes);
 bool loadinShader(_Shader& shader, VkDevice device, const char* path);
 bool loadinShader(_Shader& shader, VkDevice device, const std::filesystem::path root_path, const char* path);
 
+class ThreadPool;
+
+struct _ShaderSource
+{
+	_Shader* shader;
+	const char* path;
+};
+
+// Compiles (or fetches from the shader cache) every source concurrently on the pool, then creates the
+// shader modules on the calling thread. Returns false if any of them failed.
+bool loadinShaders(ThreadPool& pool, VkDevice device, const std::filesystem::path& root_path, std::initializer_list<_ShaderSource> shaders);
+
 void parseShader(_Shader& shader, const uint32_t* code, uint32_t codeSize);
 
 using _Shaders = std::initializer_list<const _Shader*>;
 using _Constants = std::initializer_list<int>;
 
-VkPipeline createGraphicsPipelineVK13(VkDevice device, VkPipelineCache pipelineCache, const VkPipelineRenderingCreateInfo& renderingInfo, _Shaders shaders, VkPipelineLayout layout, _Constants constants = {});
+// A pipeline for dynamic rendering into the attachment formats of renderingInfo. The constants specialize every
+// stage, ids a stage doesn't declare are ignored; without vertexInput the vertices are pulled from buffers.
+VkPipeline createGraphicsPipelineVK13(VkDevice device, VkPipelineCache pipelineCache, const VkPipelineRenderingCreateInfo& renderingInfo, _Shaders shaders, VkPipelineLayout layout,
+	_Constants constants = {}, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, const VkPipelineVertexInputStateCreateInfo* vertexInput = nullptr);
 VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const _Shader& shader, VkPipelineLayout layout, _Constants constants = {});
 
+VkDescriptorSetLayout createSetLayout(VkDevice device, _Shaders shaders, bool pushDescriptorsSupported);
+VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout, VkShaderStageFlags pushConstantStages, size_t pushConstantSize);
+
+// Set layout, pipeline layout and update template derived from the shaders' reflected bindings. The template
+// pushes descriptors when supported, otherwise it updates a descriptor set allocated with program.setLayout.
+_Program createProgram(VkDevice device, VkPipelineBindPoint bindPoint, _Shaders shaders, size_t pushConstantSize = 0, bool pushDescriptorsSupported = true);
+void destroyProgram(VkDevice device, const _Program& program);
+
+
+// Source served for #include "name" instead of the file next to the shader, for GLSL generated from C++
+// definitions. Set them all before the first compile.
+void setShaderInclude(const char* name, const std::string& source);
 
 std::string readFileGLSL(const char* fileName);
 bool saveFileSPIRV(const char* filename, unsigned int* code, size_t size);
@@ -136,9 +163,18 @@ static std::vector<char> readFileSPIRV(const std::string& filename) {
 
 // glslang_stage_t glslangShaderStageFromFileName(const char* fileName);
 
+// glslang is initialized once, on the first compile from any thread; finalize after the last one.
 size_t compileShaderData(glslang_stage_t stage, const char* shaderSource, _Shader& _shader);
+void finalizeShaderCompiler();
+
+// Compiles and reflects the shader, or loads both from the shader cache when it is enabled.
 size_t compileShaderFile(const char* file, _Shader& _shader);
 
+// Cache entries are keyed by the include-expanded source after define injection, the stage and the
+// target environment, and hold the SPIR-V together with the parseShader results. Empty disables the cache.
+void setShaderCacheDirectory(const std::filesystem::path& directory);
+void getShaderCacheStats(uint32_t& hits, uint32_t& misses);
+
 VkShaderModule createVkShaderModule(const std::vector<uint32_t>& code, VkDevice device);
 
 void testShaderCompilation(const char* sourceFilename, const char* destFilename);
\ No newline at end of file
@@ -0,0 +1,528 @@
+#include "FrameGraph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+
+static const VkAccessFlags2 kWriteAccess = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+void FrameGraph::init(VkDevice device, Allocator& allocator)
+{
+	this->device = device;
+	this->allocator = &allocator;
+}
+
+void FrameGraph::reset(FrameTimeline* timeline)
+{
+	std::vector<VkImage> images;
+
+	importedStates.clear();
+
+	for (Resource& resource : resources)
+	{
+		if (resource.transient && resource.image != VK_NULL_HANDLE)
+			images.push_back(resource.image);
+
+		uint64_t handle = resource.kind == Kind::Buffer ? (uint64_t)resource.buffer : (uint64_t)resource.image;
+
+		if (!resource.transient && handle != 0)
+			importedStates[handle] = { resource.writeStages, resource.writeAccess, resource.readStages };
+	}
+
+	auto destroy = [device = device, allocator = allocator, images, memory = transientMemory]() mutable {
+		for (VkImage image : images)
+			vkDestroyImage(device, image, nullptr);
+
+		if (memory.memory != VK_NULL_HANDLE)
+			allocator->free(memory);
+	};
+
+	if (timeline)
+		timeline->defer(destroy);
+	else
+		destroy();
+
+	transientMemory = Allocation();
+	transientBytes = 0;
+	unaliasedBytes = 0;
+
+	resources.clear();
+	passes.clear();
+}
+
+FrameResource FrameGraph::addResource(const char* name, Kind kind)
+{
+	Resource resource;
+	resource.name = name;
+	resource.kind = kind;
+
+	resources.push_back(resource);
+	return FrameResource(resources.size() - 1);
+}
+
+void FrameGraph::restoreImported(Resource& resource, uint64_t handle)
+{
+	auto it = importedStates.find(handle);
+
+	if (handle == 0 || it == importedStates.end())
+		return;
+
+	resource.writeStages = it->second.writeStages;
+	resource.writeAccess = it->second.writeAccess;
+	resource.readStages = it->second.readStages;
+}
+
+FrameResource FrameGraph::importBuffer(const char* name, VkBuffer buffer)
+{
+	FrameResource result = addResource(name, Kind::Buffer);
+	resources[result].buffer = buffer;
+
+	restoreImported(resources[result], (uint64_t)buffer);
+
+	return result;
+}
+
+FrameResource FrameGraph::importImage(const char* name, VkImage image, VkImageAspectFlags aspectMask, VkImageLayout layout)
+{
+	FrameResource result = addResource(name, Kind::Image);
+	resources[result].image = image;
+	resources[result].aspectMask = aspectMask;
+	resources[result].layout = layout;
+
+	// the layout is the caller's to state, only the stages to wait for carry over
+	restoreImported(resources[result], (uint64_t)image);
+
+	return result;
+}
+
+void FrameGraph::rebindImage(FrameResource resource, VkImage image, VkPipelineStageFlags2 readyStages)
+{
+	Resource& target = resources[resource];
+
+	target.image = image;
+	target.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	target.writeStages = readyStages;
+	target.writeAccess = 0;
+	target.readStages = 0;
+}
+
+FrameResource FrameGraph::createImage(const char* name, const VkImageCreateInfo& info, VkImageAspectFlags aspectMask)
+{
+	FrameResource result = addResource(name, Kind::Image);
+	resources[result].aspectMask = aspectMask;
+	resources[result].transient = true;
+	resources[result].info = info;
+	resources[result].info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	return result;
+}
+
+void FrameGraph::markOutput(FrameResource resource, VkImageLayout finalLayout)
+{
+	resources[resource].output = true;
+	resources[resource].finalLayout = finalLayout;
+}
+
+void FrameGraph::addPass(const char* name, std::vector<FrameAccess> accesses, Execute execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = std::move(execute);
+
+	// several uses of one resource are waited for together
+	for (const FrameAccess& access : accesses)
+	{
+		auto it = std::find_if(pass.accesses.begin(), pass.accesses.end(), [&](const FrameAccess& other) { return other.resource == access.resource; });
+
+		if (it == pass.accesses.end())
+		{
+			pass.accesses.push_back(access);
+			continue;
+		}
+
+		if (resources[access.resource].kind == Kind::Image && it->layout != access.layout)
+			throw std::runtime_error("a pass uses an image in two layouts!");
+
+		it->stages |= access.stages;
+		it->access |= access.access;
+		it->write = it->write || access.write;
+	}
+
+	passes.push_back(std::move(pass));
+}
+
+void FrameGraph::compile(VkMemoryPropertyFlags transientProperties)
+{
+	// walking back from the outputs, a pass is live if it writes something a live pass (or the frame) needs
+	std::vector<bool> needed(resources.size());
+
+	for (size_t i = 0; i < resources.size(); ++i)
+		needed[i] = resources[i].output;
+
+	for (size_t i = passes.size(); i-- > 0; )
+	{
+		Pass& pass = passes[i];
+
+		pass.live = std::any_of(pass.accesses.begin(), pass.accesses.end(), [&](const FrameAccess& access) { return access.write && needed[access.resource]; });
+
+		if (!pass.live)
+			continue;
+
+		for (const FrameAccess& access : pass.accesses)
+			if (!access.write || (access.access & ~kWriteAccess))
+				needed[access.resource] = true;
+	}
+
+	std::vector<FrameResource> transients;
+
+	for (uint32_t i = 0; i < passes.size(); ++i)
+	{
+		if (!passes[i].live)
+			continue;
+
+		for (const FrameAccess& access : passes[i].accesses)
+		{
+			Resource& resource = resources[access.resource];
+
+			if (!resource.transient)
+				continue;
+
+			if (resource.firstPass == ~0u)
+			{
+				resource.firstPass = i;
+				transients.push_back(access.resource);
+			}
+
+			resource.lastPass = i;
+		}
+	}
+
+	if (transients.empty())
+		return;
+
+	uint32_t memoryTypeBits = ~0u;
+	VkDeviceSize alignment = 1;
+
+	for (FrameResource index : transients)
+	{
+		Resource& resource = resources[index];
+
+		VK_CHECK(vkCreateImage(device, &resource.info, nullptr, &resource.image));
+		vkGetImageMemoryRequirements(device, resource.image, &resource.requirements);
+
+		memoryTypeBits &= resource.requirements.memoryTypeBits;
+		alignment = std::max(alignment, resource.requirements.alignment);
+		unaliasedBytes += resource.requirements.size;
+	}
+
+	placeTransients(transients);
+
+	uint32_t memoryType = allocator->findMemoryType(memoryTypeBits, transientProperties);
+
+	if (memoryType == ~0u)
+		memoryType = allocator->findMemoryType(memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (memoryType == ~0u)
+		throw std::runtime_error("failed to find a memory type for the transient images!");
+
+	VkMemoryRequirements heapRequirements = { transientBytes, alignment, memoryTypeBits };
+	transientMemory = allocator->allocate(heapRequirements, memoryType, false);
+
+	for (FrameResource index : transients)
+	{
+		Resource& resource = resources[index];
+		VK_CHECK(vkBindImageMemory(device, resource.image, transientMemory.memory, transientMemory.offset + resource.offset));
+	}
+}
+
+// Largest first, each at the lowest offset that doesn't overlap an already placed image that is alive at the
+// same time; images alive at different times may share memory.
+void FrameGraph::placeTransients(const std::vector<FrameResource>& transients)
+{
+	std::vector<FrameResource> order = transients;
+
+	std::stable_sort(order.begin(), order.end(), [&](FrameResource a, FrameResource b) {
+		return resources[a].requirements.size > resources[b].requirements.size;
+	});
+
+	auto overlapsInTime = [&](const Resource& a, const Resource& b) {
+		return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass;
+	};
+
+	auto overlapsInMemory = [&](const Resource& a, VkDeviceSize offset, const Resource& b) {
+		return offset < b.offset + b.requirements.size && b.offset < offset + a.requirements.size;
+	};
+
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		Resource& resource = resources[order[i]];
+		VkDeviceSize align = resource.requirements.alignment;
+
+		// either at the start or right behind a placed image
+		std::vector<VkDeviceSize> candidates { 0 };
+
+		for (size_t j = 0; j < i; ++j)
+		{
+			const Resource& placed = resources[order[j]];
+			candidates.push_back((placed.offset + placed.requirements.size + align - 1) / align * align);
+		}
+
+		std::sort(candidates.begin(), candidates.end());
+
+		for (VkDeviceSize offset : candidates)
+		{
+			bool fits = true;
+
+			for (size_t j = 0; j < i && fits; ++j)
+			{
+				const Resource& placed = resources[order[j]];
+				fits = !overlapsInTime(resource, placed) || !overlapsInMemory(resource, offset, placed);
+			}
+
+			if (fits)
+			{
+				resource.offset = offset;
+				break;
+			}
+		}
+
+		transientBytes = std::max(transientBytes, resource.offset + resource.requirements.size);
+
+		for (size_t j = 0; j < i; ++j)
+		{
+			Resource& placed = resources[order[j]];
+
+			if (overlapsInMemory(resource, resource.offset, placed))
+			{
+				resource.aliases.push_back(order[j]);
+				placed.aliases.push_back(order[i]);
+			}
+		}
+	}
+}
+
+static VkImageMemoryBarrier2 imageBarrier(VkImage image, VkImageAspectFlags aspectMask, VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess,
+	VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+	VkImageMemoryBarrier2 barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	barrier.srcStageMask = srcStages;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstStageMask = dstStages;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspectMask;
+	barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+	return barrier;
+}
+
+static void pipelineBarrier(VkCommandBuffer commandBuffer, const std::vector<VkBufferMemoryBarrier2>& bufferBarriers, const std::vector<VkImageMemoryBarrier2>& imageBarriers)
+{
+	VkDependencyInfo dependencyInfo = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	dependencyInfo.bufferMemoryBarrierCount = uint32_t(bufferBarriers.size());
+	dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+	dependencyInfo.imageMemoryBarrierCount = uint32_t(imageBarriers.size());
+	dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+
+	vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void FrameGraph::execute(VkCommandBuffer commandBuffer)
+{
+	std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+	std::vector<VkImageMemoryBarrier2> imageBarriers;
+
+	for (uint32_t i = 0; i < passes.size(); ++i)
+	{
+		Pass& pass = passes[i];
+
+		if (!pass.live)
+			continue;
+
+		bufferBarriers.clear();
+		imageBarriers.clear();
+
+		for (const FrameAccess& access : pass.accesses)
+		{
+			Resource& resource = resources[access.resource];
+
+			VkPipelineStageFlags2 waitStages = 0;
+			VkAccessFlags2 waitAccess = 0;
+			VkImageLayout oldLayout = resource.layout;
+
+			// the contents of a transient are gone by its first pass, but whatever used its memory last has to finish
+			bool discard = resource.transient && resource.firstPass == i;
+
+			if (discard)
+			{
+				oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				waitStages = resource.writeStages | resource.readStages;
+
+				for (FrameResource alias : resource.aliases)
+					waitStages |= resources[alias].writeStages | resources[alias].readStages;
+			}
+
+			bool transition = resource.kind == Kind::Image && access.layout != oldLayout;
+
+			if (access.write || transition)
+			{
+				// write after read only has to wait, write after write and any transition need the writes
+				waitStages |= resource.writeStages | resource.readStages;
+				waitAccess = discard ? 0 : resource.writeAccess;
+			}
+			else if (resource.writeStages && (access.stages & ~resource.readStages))
+			{
+				waitStages |= resource.writeStages;
+				waitAccess = resource.writeAccess;
+			}
+
+			// a barrier without access masks is just an execution dependency
+			if (resource.kind == Kind::Image && (waitStages || transition))
+			{
+				imageBarriers.push_back(imageBarrier(resource.image, resource.aspectMask, waitStages, waitAccess, access.stages, access.access, oldLayout, access.layout));
+			}
+			else if (resource.kind == Kind::Buffer && waitStages)
+			{
+				VkBufferMemoryBarrier2 barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+				barrier.srcStageMask = waitStages;
+				barrier.srcAccessMask = waitAccess;
+				barrier.dstStageMask = access.stages;
+				barrier.dstAccessMask = waitAccess ? access.access : 0;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.buffer = resource.buffer;
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+
+				bufferBarriers.push_back(barrier);
+			}
+
+			if (access.write || transition)
+			{
+				// a transition counts as a write the later accesses have to wait for, even one that only reads
+				resource.writeStages = access.stages;
+				resource.writeAccess = access.write ? access.access & kWriteAccess : 0;
+				resource.readStages = access.write ? 0 : access.stages;
+			}
+			else
+			{
+				resource.readStages |= access.stages;
+			}
+
+			if (resource.kind == Kind::Image)
+				resource.layout = access.layout;
+		}
+
+		if (!bufferBarriers.empty() || !imageBarriers.empty())
+			pipelineBarrier(commandBuffer, bufferBarriers, imageBarriers);
+
+		pass.execute(commandBuffer);
+	}
+
+	// the semaphore signaled after the submission, or its fence, is what makes the outputs available from here on
+	bufferBarriers.clear();
+	imageBarriers.clear();
+
+	for (Resource& resource : resources)
+	{
+		if (!resource.output || resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.layout == resource.finalLayout)
+			continue;
+
+		imageBarriers.push_back(imageBarrier(resource.image, resource.aspectMask, resource.writeStages | resource.readStages, resource.writeAccess,
+			VK_PIPELINE_STAGE_2_NONE, 0, resource.layout, resource.finalLayout));
+
+		resource.layout = resource.finalLayout;
+		resource.writeStages = 0;
+		resource.writeAccess = 0;
+		resource.readStages = 0;
+	}
+
+	if (!imageBarriers.empty())
+		pipelineBarrier(commandBuffer, bufferBarriers, imageBarriers);
+}
+
+void FrameGraph::printStats() const
+{
+	size_t livePasses = std::count_if(passes.begin(), passes.end(), [](const Pass& pass) { return pass.live; });
+	size_t transientCount = std::count_if(resources.begin(), resources.end(), [](const Resource& resource) { return resource.transient && resource.image != VK_NULL_HANDLE; });
+
+	printf("Frame graph: %zu of %zu passes live, %zu transient images in %.1f MB (%.1f MB without aliasing)\n",
+		livePasses, passes.size(), transientCount, double(transientBytes) / 1e6, double(unaliasedBytes) / 1e6);
+
+	for (const Pass& pass : passes)
+		if (!pass.live)
+			printf("Frame graph: culled %s\n", pass.name.c_str());
+}
+
+void FrameGraph::selfCheck(VkDevice device, Allocator& allocator)
+{
+	FrameGraph graph;
+	graph.init(device, allocator);
+
+	VkImageCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	info.imageType = VK_IMAGE_TYPE_2D;
+	info.format = VK_FORMAT_R8G8B8A8_UNORM;
+	info.extent = { 256, 256, 1 };
+	info.mipLevels = 1;
+	info.arrayLayers = 1;
+	info.samples = VK_SAMPLE_COUNT_1_BIT;
+	info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	// first and second live in passes 0-1 and 2-3, whole across all of them; the buffers are never touched
+	FrameResource first = graph.createImage("first", info, VK_IMAGE_ASPECT_COLOR_BIT);
+	FrameResource second = graph.createImage("second", info, VK_IMAGE_ASPECT_COLOR_BIT);
+	FrameResource whole = graph.createImage("whole", info, VK_IMAGE_ASPECT_COLOR_BIT);
+	FrameResource between = graph.importBuffer("between", VK_NULL_HANDLE);
+	FrameResource output = graph.importBuffer("output", VK_NULL_HANDLE);
+
+	const VkPipelineStageFlags2 color = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	const VkPipelineStageFlags2 compute = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+
+	auto none = [](VkCommandBuffer) {};
+
+	graph.addPass("write first", {
+		frameWrite(first, color, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+		frameWrite(whole, color, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+	}, none);
+	graph.addPass("read first", {
+		frameRead(first, compute, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+		frameWrite(between, compute, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT),
+	}, none);
+	graph.addPass("write second", {
+		frameRead(between, color, VK_ACCESS_2_SHADER_STORAGE_READ_BIT),
+		frameWrite(second, color, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+	}, none);
+	graph.addPass("read second", {
+		frameRead(second, compute, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+		frameRead(whole, compute, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+		frameWrite(output, compute, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT),
+	}, none);
+
+	graph.markOutput(output);
+	graph.compile();
+
+	const Resource& a = graph.resources[first];
+	const Resource& b = graph.resources[second];
+	const Resource& c = graph.resources[whole];
+
+	auto aliases = [](const Resource& resource, FrameResource other) {
+		return std::find(resource.aliases.begin(), resource.aliases.end(), other) != resource.aliases.end();
+	};
+
+	assert(std::all_of(graph.passes.begin(), graph.passes.end(), [](const Pass& pass) { return pass.live; }));
+	assert(a.offset == b.offset && aliases(a, second) && aliases(b, first));
+	assert(!aliases(c, first) && !aliases(c, second));
+	assert(graph.transientBytes < graph.unaliasedBytes);
+
+	(void)a, (void)b, (void)c, (void)aliases;
+
+	graph.reset();
+}
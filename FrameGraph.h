@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Allocator.h"
+#include "FrameTimeline.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using FrameResource = uint32_t;
+
+// How a pass uses a resource. layout only matters for images, the one the pass expects them in.
+struct FrameAccess
+{
+	FrameResource resource;
+	VkPipelineStageFlags2 stages;
+	VkAccessFlags2 access;
+	VkImageLayout layout;
+	bool write;
+};
+
+inline FrameAccess frameRead(FrameResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED)
+{
+	return { resource, stages, access, layout, false };
+}
+
+inline FrameAccess frameWrite(FrameResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED)
+{
+	return { resource, stages, access, layout, true };
+}
+
+// The passes of a frame and the resources they read and write, in submission order.
+//
+// compile() drops the passes nothing marked as an output depends on, and places the transient images of the
+// remaining ones in one memory heap, overlapping those whose lifetimes (first to last pass using them) don't.
+// execute() records the live passes with the pipeline barriers and layout transitions between them, derived
+// from what each resource was last used for, one vkCmdPipelineBarrier2 per pass with the stages of every barrier
+// kept apart. That state carries over from frame to frame, so the first pass
+// of a frame also waits for whatever the previous one left in flight on the same queue.
+//
+// Barriers within a pass, such as between the levels of a mip chain it writes, are still up to the pass.
+class FrameGraph final
+{
+public:
+	using Execute = std::function<void(VkCommandBuffer commandBuffer)>;
+
+	void init(VkDevice device, Allocator& allocator);
+
+	// Frees the transient images and forgets all passes and resources. Nothing recorded may be in flight, unless
+	// the images are handed to the timeline to be freed once the frames in flight are done with them. What the
+	// imported resources were last used for is kept: importing the same buffer or image again after a reset
+	// picks it up, so the first pass of the rebuilt graph waits for the frames recorded before.
+	void reset(FrameTimeline* timeline = nullptr);
+
+	FrameResource importBuffer(const char* name, VkBuffer buffer);
+	FrameResource importImage(const char* name, VkImage image, VkImageAspectFlags aspectMask, VkImageLayout layout);
+
+	// Points an imported image at another VkImage for the following execute(), like the swapchain image acquired
+	// for the frame. Its contents are discarded, and the first pass using it waits for readyStages, the stages a
+	// semaphore wait made it available to.
+	void rebindImage(FrameResource resource, VkImage image, VkPipelineStageFlags2 readyStages);
+
+	// Created by compile() if a live pass uses it, its contents don't survive from one frame to the next.
+	FrameResource createImage(const char* name, const VkImageCreateInfo& info, VkImageAspectFlags aspectMask);
+
+	// An image output is left in finalLayout at the end of execute(), unless that is VK_IMAGE_LAYOUT_UNDEFINED, for
+	// whatever takes it from there (a present, a copy in a later submission) behind a semaphore or fence.
+	void markOutput(FrameResource resource, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+	void addPass(const char* name, std::vector<FrameAccess> accesses, Execute execute);
+
+	void compile(VkMemoryPropertyFlags transientProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	void execute(VkCommandBuffer commandBuffer);
+
+	// VK_NULL_HANDLE for a transient image of culled passes
+	VkImage image(FrameResource resource) const { return resources[resource].image; }
+
+	void printStats() const;
+
+	// Compiles a small graph of its own whose transients are known to alias and asserts that placeTransients
+	// overlaps exactly those, for debug builds to run once at startup.
+	static void selfCheck(VkDevice device, Allocator& allocator);
+
+private:
+	enum class Kind { Buffer, Image };
+
+	struct Resource
+	{
+		std::string name;
+		Kind kind = Kind::Buffer;
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageAspectFlags aspectMask = 0;
+
+		bool output = false;
+		VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		// transient images only
+		bool transient = false;
+		VkImageCreateInfo info {};
+		VkMemoryRequirements requirements {};
+		VkDeviceSize offset = 0;
+		uint32_t firstPass = ~0u;
+		uint32_t lastPass = 0;
+		std::vector<FrameResource> aliases; // transients sharing some of its memory
+
+		// what the resource was last used for; readStages only holds reads that already waited for the last write
+		VkPipelineStageFlags2 writeStages = 0;
+		VkAccessFlags2 writeAccess = 0;
+		VkPipelineStageFlags2 readStages = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		std::vector<FrameAccess> accesses; // one per resource
+		Execute execute;
+		bool live = false;
+	};
+
+	// the last use of an imported resource, carried over a reset
+	struct ImportedState
+	{
+		VkPipelineStageFlags2 writeStages;
+		VkAccessFlags2 writeAccess;
+		VkPipelineStageFlags2 readStages;
+	};
+
+	FrameResource addResource(const char* name, Kind kind);
+	void restoreImported(Resource& resource, uint64_t handle);
+	void placeTransients(const std::vector<FrameResource>& transients);
+
+	VkDevice device = VK_NULL_HANDLE;
+	Allocator* allocator = nullptr;
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+
+	std::unordered_map<uint64_t, ImportedState> importedStates; // by handle
+
+	Allocation transientMemory;
+	VkDeviceSize transientBytes = 0;
+	VkDeviceSize unaliasedBytes = 0;
+};
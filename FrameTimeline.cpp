@@ -0,0 +1,78 @@
+#include "FrameTimeline.h"
+
+#include <stdexcept>
+
+void FrameTimeline::init(VkDevice device, uint32_t framesInFlight)
+{
+	if (framesInFlight == 0)
+		throw std::runtime_error("at least one frame has to be in flight!");
+
+	this->device = device;
+	this->frameCount = framesInFlight;
+
+	VkSemaphoreTypeCreateInfo typeInfo { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphoreInfo.pNext = &typeInfo;
+
+	VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline));
+}
+
+void FrameTimeline::destroy()
+{
+	wait(submitted);
+	collect(UINT64_MAX);
+
+	vkDestroySemaphore(device, timeline, nullptr);
+	timeline = VK_NULL_HANDLE;
+}
+
+uint32_t FrameTimeline::beginFrame()
+{
+	// frame N reuses the slot of frame N - frameCount, which signaled N - frameCount + 1
+	if (submitted >= frameCount)
+		wait(submitted - frameCount + 1);
+
+	if (!deletions.empty())
+		collect(completedValue());
+
+	return uint32_t(submitted % frameCount);
+}
+
+void FrameTimeline::defer(std::function<void()> destroy)
+{
+	deletions.push_back({ frameValue(), std::move(destroy) });
+}
+
+void FrameTimeline::collect(uint64_t completed)
+{
+	size_t count = 0;
+
+	while (count < deletions.size() && deletions[count].value <= completed)
+		deletions[count++].destroy();
+
+	deletions.erase(deletions.begin(), deletions.begin() + count);
+}
+
+uint64_t FrameTimeline::completedValue() const
+{
+	uint64_t value = 0;
+	VK_CHECK(vkGetSemaphoreCounterValue(device, timeline, &value));
+
+	return value;
+}
+
+void FrameTimeline::wait(uint64_t value) const
+{
+	if (value == 0)
+		return;
+
+	VkSemaphoreWaitInfo waitInfo { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline;
+	waitInfo.pValues = &value;
+
+	VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "onez.h"
+#include <volk.h>
+
+#include <functional>
+#include <vector>
+
+// Paces the frames in flight on a single timeline semaphore of the graphics queue. The submission of frame N
+// (counting from 0) signals value N + 1, so "frame N has completed" and "the semaphore reached N + 1" are the
+// same thing, and anything tied to a frame can wait for or check exactly that value instead of a fence.
+//
+// beginFrame blocks until the frame framesInFlight before the next one has completed, which frees its slot of
+// the per-frame resources (command buffer, uniform slice, descriptor sets...) for reuse. Fewer frames in flight
+// lower the latency, more of them keep the GPU busy through CPU hiccups. It also drains the deletion queue up
+// to the value that has completed, so resources replaced mid-run go away without idling the device.
+class FrameTimeline final
+{
+public:
+	void init(VkDevice device, uint32_t framesInFlight);
+	void destroy();
+
+	uint32_t framesInFlight() const { return frameCount; }
+
+	// Returns the slot of the frame about to be recorded, once the GPU is done with its previous use.
+	uint32_t beginFrame();
+
+	// What the submission of the frame being recorded signals; call endFrame once it has been submitted.
+	uint64_t frameValue() const { return submitted + 1; }
+	void endFrame() { submitted++; }
+
+	uint64_t submittedFrames() const { return submitted; }
+
+	uint64_t completedValue() const;
+	void wait(uint64_t value) const;
+
+	// Runs destroy once every frame submitted so far and the one being recorded have completed, from a later
+	// beginFrame, or from destroy() at the latest.
+	void defer(std::function<void()> destroy);
+
+	VkSemaphore semaphore() const { return timeline; }
+
+private:
+	struct Deletion
+	{
+		uint64_t value;
+		std::function<void()> destroy;
+	};
+
+	void collect(uint64_t completed);
+
+	std::vector<Deletion> deletions; // in the order of their values
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkSemaphore timeline = VK_NULL_HANDLE;
+
+	uint32_t frameCount = 0;
+	uint64_t submitted = 0;
+};
@@ -0,0 +1,457 @@
+#include "Mesh.h"
+#include "MeshCache.h"
+
+#include <meshoptimizer.h>
+
+#include <algorithm>
+#include <cstring>
+
+void optimizeMesh(Mesh& mesh)
+{
+    meshopt_optimizeVertexCache(mesh.indices.data(), mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+    meshopt_optimizeVertexFetch(mesh.vertices.data(), mesh.indices.data(), mesh.indices.size(), mesh.vertices.data(), mesh.vertices.size(), sizeof(Vertex));
+}
+
+void buildLods(Mesh& mesh, const LodSettings& settings)
+{
+    mesh.lods.clear();
+
+    MeshLod full {};
+    full.indexCount = uint32_t(mesh.indices.size());
+    mesh.lods.push_back(full);
+
+    if (mesh.indices.empty())
+        return;
+
+    const float* positions = &mesh.vertices[0].position.x;
+
+    // result_error is relative to the mesh extents
+    float scale = meshopt_simplifyScale(positions, mesh.vertices.size(), sizeof(Vertex));
+
+    std::vector<uint32_t> lod(mesh.indices.begin(), mesh.indices.end());
+
+    while (mesh.lods.size() < settings.maxLods)
+    {
+        size_t previousCount = lod.size();
+        size_t targetCount = size_t(double(previousCount) * settings.reduction) / 3 * 3;
+
+        float error = 0.0f;
+        size_t count = meshopt_simplify(lod.data(), lod.data(), previousCount, positions, mesh.vertices.size(), sizeof(Vertex),
+            targetCount, settings.maxError, 0, &error);
+
+        // stuck on the error bound or on topology, further levels would barely differ
+        if (count == 0 || double(count) > double(previousCount) * settings.minReduction)
+            break;
+
+        lod.resize(count);
+        meshopt_optimizeVertexCache(lod.data(), lod.data(), lod.size(), mesh.vertices.size());
+
+        MeshLod level {};
+        level.indexOffset = uint32_t(mesh.indices.size());
+        level.indexCount = uint32_t(count);
+        // each level is simplified from the previous one, so the deviations add up
+        level.error = mesh.lods.back().error + error * scale;
+
+        mesh.indices.insert(mesh.indices.end(), lod.begin(), lod.end());
+        mesh.lods.push_back(level);
+    }
+}
+
+static void appendMeshlets(Mesh& mesh, const uint32_t* indices, size_t indexCount, size_t maxVertices, size_t maxTriangles, float coneWeight)
+{
+    size_t maxMeshlets = meshopt_buildMeshletsBound(indexCount, maxVertices, maxTriangles);
+
+    std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+    std::vector<unsigned int> meshletVertices(maxMeshlets * maxVertices);
+    std::vector<unsigned char> meshletTriangles(maxMeshlets * maxTriangles * 3);
+
+    size_t meshletCount = meshopt_buildMeshlets(meshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+        indices, indexCount, &mesh.vertices[0].position.x, mesh.vertices.size(), sizeof(Vertex),
+        maxVertices, maxTriangles, coneWeight);
+
+    if (meshletCount == 0)
+        return;
+
+    const meshopt_Meshlet& last = meshlets[meshletCount - 1];
+
+    size_t firstMeshlet = mesh.meshlets.size();
+
+    mesh.meshlets.resize(firstMeshlet + meshletCount);
+    mesh.meshletLods.resize(firstMeshlet + meshletCount);
+    mesh.meshletData.reserve(mesh.meshletData.size() + (last.vertex_offset + last.vertex_count) / (mesh.shortVertexIndices ? 2 : 1) + (last.triangle_offset + last.triangle_count * 3) / 4 + meshletCount * 2);
+
+    for (size_t i = 0; i < meshletCount; ++i)
+    {
+        const meshopt_Meshlet& m = meshlets[i];
+        Meshlet& meshlet = mesh.meshlets[firstMeshlet + i];
+
+        const unsigned int* vertices = &meshletVertices[m.vertex_offset];
+        const unsigned char* triangles = &meshletTriangles[m.triangle_offset];
+
+        meshlet.vertexOffset = uint32_t(mesh.meshletData.size());
+
+        if (mesh.shortVertexIndices)
+        {
+            for (size_t j = 0; j < m.vertex_count; j += 2)
+                mesh.meshletData.push_back(vertices[j] | (j + 1 < m.vertex_count ? vertices[j + 1] << 16 : 0));
+        }
+        else
+        {
+            mesh.meshletData.insert(mesh.meshletData.end(), vertices, vertices + m.vertex_count);
+        }
+
+        meshlet.triangleOffset = uint32_t(mesh.meshletData.size());
+
+        size_t triangleWords = (m.triangle_count * 3 + 3) / 4;
+        mesh.meshletData.resize(mesh.meshletData.size() + triangleWords, 0);
+        memcpy(&mesh.meshletData[meshlet.triangleOffset], triangles, m.triangle_count * 3);
+
+        meshlet.vertexCount = uint8_t(m.vertex_count);
+        meshlet.triangleCount = uint8_t(m.triangle_count);
+
+        meshopt_Bounds bounds = meshopt_computeMeshletBounds(vertices, triangles, m.triangle_count,
+            &mesh.vertices[0].position.x, mesh.vertices.size(), sizeof(Vertex));
+
+        meshlet.center = glm::vec3(bounds.center[0], bounds.center[1], bounds.center[2]);
+        meshlet.radius = bounds.radius;
+
+        meshlet.coneAxis[0] = bounds.cone_axis_s8[0];
+        meshlet.coneAxis[1] = bounds.cone_axis_s8[1];
+        meshlet.coneAxis[2] = bounds.cone_axis_s8[2];
+        meshlet.coneCutoff = bounds.cone_cutoff_s8;
+
+        // outside a hierarchy every meshlet is always selected
+        mesh.meshletLods[firstMeshlet + i].bounds = glm::vec4(meshlet.center, meshlet.radius);
+    }
+}
+
+static void meshletLimits(const MeshletSettings& settings, size_t& maxVertices, size_t& maxTriangles)
+{
+    maxVertices = std::min(std::max(settings.maxVertices, size_t(3)), kMeshletMaxVertices);
+    maxTriangles = std::min(std::max(settings.maxTriangles, size_t(4)), kMeshletMaxTriangles) & ~size_t(3);
+}
+
+size_t Mesh::vertexCount() const
+{
+    return cooked ? cooked->vertexCount : vertices.size();
+}
+
+ArrayView<Meshlet> Mesh::meshletArray() const
+{
+    return cooked ? cooked->meshlets : ArrayView<Meshlet>(meshlets);
+}
+
+ArrayView<MeshletLod> Mesh::meshletLodArray() const
+{
+    return cooked ? cooked->meshletLods : ArrayView<MeshletLod>(meshletLods);
+}
+
+ArrayView<uint32_t> Mesh::meshletDataArray() const
+{
+    return cooked ? cooked->meshletData : ArrayView<uint32_t>(meshletData);
+}
+
+uint32_t meshletVertex(const Mesh& mesh, const Meshlet& meshlet, uint32_t local)
+{
+    const uint32_t* data = mesh.cooked ? mesh.cooked->meshletData.data() : mesh.meshletData.data();
+
+    return mesh.shortVertexIndices
+        ? (data[meshlet.vertexOffset + local / 2] >> ((local & 1) * 16)) & 0xffff
+        : data[meshlet.vertexOffset + local];
+}
+
+// Appends the meshlet's triangles as indices into the vertex buffer.
+static void appendMeshletIndices(const Mesh& mesh, const Meshlet& meshlet, std::vector<uint32_t>& indices)
+{
+    const uint8_t* triangles = reinterpret_cast<const uint8_t*>(mesh.meshletDataArray().data()) + meshlet.triangleOffset * sizeof(uint32_t);
+
+    for (size_t j = 0; j < size_t(meshlet.triangleCount) * 3; ++j)
+        indices.push_back(meshletVertex(mesh, meshlet, triangles[j]));
+}
+
+void buildMeshlets(Mesh& mesh, const MeshletSettings& settings)
+{
+    mesh.meshlets.clear();
+    mesh.meshletLods.clear();
+    mesh.meshletData.clear();
+    mesh.clusterDag = {};
+    mesh.clusterDagLevels.clear();
+    mesh.shortVertexIndices = settings.allowShortVertexIndices && mesh.vertices.size() <= 0xffff;
+
+    if (mesh.indices.empty())
+        return;
+
+    size_t maxVertices = 0, maxTriangles = 0;
+    meshletLimits(settings, maxVertices, maxTriangles);
+
+    if (mesh.lods.empty())
+    {
+        appendMeshlets(mesh, mesh.indices.data(), mesh.indices.size(), maxVertices, maxTriangles, settings.coneWeight);
+        return;
+    }
+
+    // every level gets its own meshlets, so picking a level is picking a contiguous meshlet range
+    for (MeshLod& lod : mesh.lods)
+    {
+        lod.meshletOffset = uint32_t(mesh.meshlets.size());
+        appendMeshlets(mesh, mesh.indices.data() + lod.indexOffset, lod.indexCount, maxVertices, maxTriangles, settings.coneWeight);
+        lod.meshletCount = uint32_t(mesh.meshlets.size()) - lod.meshletOffset;
+    }
+}
+
+void meshletFootprint(const Mesh& mesh, size_t& packedBytes, size_t& fixedBytes)
+{
+    const size_t meshletCount = mesh.meshletArray().size();
+
+    packedBytes = meshletCount * sizeof(Meshlet) + mesh.meshletDataArray().size() * sizeof(uint32_t);
+
+    // vertices[64] + indices[126*3] + counts, plus the same bounds
+    const size_t fixedMeshlet = 64 * sizeof(uint32_t) + 126 * 3 + 2 + offsetof(Meshlet, vertexOffset);
+    fixedBytes = meshletCount * fixedMeshlet;
+}
+
+void buildClusters(const Mesh& mesh, std::vector<uint32_t>& indices, std::vector<Cluster>& clusters)
+{
+    indices.clear();
+    indices.reserve(mesh.indices.size());
+
+    const ArrayView<Meshlet> meshlets = mesh.meshletArray();
+
+    clusters.resize(meshlets.size());
+
+    for (size_t i = 0; i < meshlets.size(); ++i)
+    {
+        const Meshlet& meshlet = meshlets[i];
+        Cluster& cluster = clusters[i];
+
+        cluster.center = meshlet.center;
+        cluster.radius = meshlet.radius;
+        memcpy(cluster.coneAxis, meshlet.coneAxis, sizeof(cluster.coneAxis));
+        cluster.coneCutoff = meshlet.coneCutoff;
+
+        cluster.firstIndex = uint32_t(indices.size());
+        cluster.indexCount = meshlet.triangleCount * 3;
+
+        appendMeshletIndices(mesh, meshlet, indices);
+    }
+}
+
+// Sphere around the spheres: centered in their bounding box, reaching the far side of each.
+static glm::vec4 mergeSpheres(const std::vector<glm::vec4>& spheres)
+{
+    glm::vec3 lo(FLT_MAX);
+    glm::vec3 hi(-FLT_MAX);
+
+    for (const glm::vec4& sphere : spheres)
+    {
+        lo = glm::min(lo, glm::vec3(sphere) - sphere.w);
+        hi = glm::max(hi, glm::vec3(sphere) + sphere.w);
+    }
+
+    glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+
+    for (const glm::vec4& sphere : spheres)
+        radius = std::max(radius, glm::length(glm::vec3(sphere) - center) + sphere.w);
+
+    return glm::vec4(center, radius);
+}
+
+// Greedy partition of the meshlets into groups of up to groupSize, growing each group by the ungrouped meshlet
+// that shares the most vertices with it. A cheap stand-in for a graph partitioner, the seeds follow the
+// meshlet order, which meshopt_buildMeshlets already keeps spatially coherent.
+static std::vector<std::vector<uint32_t>> groupMeshlets(const Mesh& mesh, const std::vector<uint32_t>& meshlets, size_t groupSize)
+{
+    // vertex -> position in meshlets of every meshlet referencing it
+    std::vector<uint32_t> offsets(mesh.vertices.size() + 1, 0);
+
+    for (uint32_t mi : meshlets)
+        for (uint32_t j = 0; j < mesh.meshlets[mi].vertexCount; ++j)
+            offsets[meshletVertex(mesh, mesh.meshlets[mi], j) + 1]++;
+
+    for (size_t v = 1; v < offsets.size(); ++v)
+        offsets[v] += offsets[v - 1];
+
+    std::vector<uint32_t> references(offsets.back());
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+
+    for (uint32_t i = 0; i < meshlets.size(); ++i)
+        for (uint32_t j = 0; j < mesh.meshlets[meshlets[i]].vertexCount; ++j)
+            references[cursor[meshletVertex(mesh, mesh.meshlets[meshlets[i]], j)]++] = i;
+
+    std::vector<bool> grouped(meshlets.size(), false);
+    std::vector<std::vector<uint32_t>> groups;
+    std::vector<uint32_t> shared(meshlets.size(), 0);
+    std::vector<uint32_t> touched;
+
+    for (uint32_t seed = 0; seed < meshlets.size(); ++seed)
+    {
+        if (grouped[seed])
+            continue;
+
+        std::vector<uint32_t> group { seed };
+        grouped[seed] = true;
+
+        while (group.size() < groupSize)
+        {
+            for (uint32_t member : group)
+            {
+                const Meshlet& meshlet = mesh.meshlets[meshlets[member]];
+
+                for (uint32_t j = 0; j < meshlet.vertexCount; ++j)
+                {
+                    uint32_t v = meshletVertex(mesh, meshlet, j);
+
+                    for (uint32_t r = offsets[v]; r < offsets[v + 1]; ++r)
+                    {
+                        uint32_t other = references[r];
+
+                        if (grouped[other])
+                            continue;
+
+                        if (shared[other]++ == 0)
+                            touched.push_back(other);
+                    }
+                }
+            }
+
+            uint32_t best = ~0u;
+
+            for (uint32_t other : touched)
+            {
+                if (best == ~0u || shared[other] > shared[best])
+                    best = other;
+
+                shared[other] = 0;
+            }
+
+            touched.clear();
+
+            if (best == ~0u)
+                break;
+
+            group.push_back(best);
+            grouped[best] = true;
+        }
+
+        for (uint32_t& member : group)
+            member = meshlets[member];
+
+        groups.push_back(std::move(group));
+    }
+
+    return groups;
+}
+
+void buildClusterDag(Mesh& mesh, const ClusterDagSettings& settings, const MeshletSettings& meshletSettings)
+{
+    mesh.clusterDag = {};
+    mesh.clusterDagLevels.clear();
+
+    if (mesh.lods.empty() || mesh.lods[0].indexCount == 0)
+        return;
+
+    size_t maxVertices = 0, maxTriangles = 0;
+    meshletLimits(meshletSettings, maxVertices, maxTriangles);
+
+    const float* positions = &mesh.vertices[0].position.x;
+    float scale = meshopt_simplifyScale(positions, mesh.vertices.size(), sizeof(Vertex));
+
+    // level 0 is a copy of the full mesh's meshlets, so the hierarchy is one contiguous range
+    mesh.clusterDag.meshletOffset = uint32_t(mesh.meshlets.size());
+    appendMeshlets(mesh, mesh.indices.data() + mesh.lods[0].indexOffset, mesh.lods[0].indexCount, maxVertices, maxTriangles, meshletSettings.coneWeight);
+
+    mesh.clusterDagLevels.push_back({ mesh.clusterDag.meshletOffset, uint32_t(mesh.meshlets.size()) - mesh.clusterDag.meshletOffset });
+
+    // meshlets that have no parent yet
+    std::vector<uint32_t> pending;
+    for (uint32_t mi = mesh.clusterDag.meshletOffset; mi < mesh.meshlets.size(); ++mi)
+        pending.push_back(mi);
+
+    std::vector<uint32_t> groupIndices;
+    std::vector<uint32_t> simplified;
+    std::vector<glm::vec4> spheres;
+
+    for (size_t level = 0; level < settings.maxLevels && pending.size() > 1; ++level)
+    {
+        std::vector<uint32_t> next;
+        uint32_t levelOffset = uint32_t(mesh.meshlets.size());
+
+        for (const auto& group : groupMeshlets(mesh, pending, settings.groupSize))
+        {
+            groupIndices.clear();
+            for (uint32_t mi : group)
+                appendMeshletIndices(mesh, mesh.meshlets[mi], groupIndices);
+
+            size_t targetCount = size_t(double(groupIndices.size()) * settings.reduction) / 3 * 3;
+
+            // the locked border keeps the group watertight against neighbours simplified on their own
+            float error = 0.0f;
+            simplified.resize(groupIndices.size());
+            size_t count = group.size() > 1 ? meshopt_simplify(simplified.data(), groupIndices.data(), groupIndices.size(), positions, mesh.vertices.size(), sizeof(Vertex),
+                targetCount, 1.0f, meshopt_SimplifyLockBorder, &error) : 0;
+
+            if (count == 0 || double(count) > double(groupIndices.size()) * settings.minReduction)
+            {
+                next.insert(next.end(), group.begin(), group.end());
+                continue;
+            }
+
+            float groupError = 0.0f;
+            spheres.clear();
+
+            for (uint32_t mi : group)
+            {
+                spheres.push_back(mesh.meshletLods[mi].bounds);
+                groupError = std::max(groupError, mesh.meshletLods[mi].error);
+            }
+
+            groupError += error * scale;
+            glm::vec4 groupBounds = mergeSpheres(spheres);
+
+            for (uint32_t mi : group)
+            {
+                mesh.meshletLods[mi].parentBounds = groupBounds;
+                mesh.meshletLods[mi].parentError = groupError;
+            }
+
+            size_t first = mesh.meshlets.size();
+            appendMeshlets(mesh, simplified.data(), count, maxVertices, maxTriangles, meshletSettings.coneWeight);
+
+            for (size_t mi = first; mi < mesh.meshlets.size(); ++mi)
+            {
+                mesh.meshletLods[mi].bounds = groupBounds;
+                mesh.meshletLods[mi].error = groupError;
+                next.push_back(uint32_t(mi));
+            }
+        }
+
+        if (mesh.meshlets.size() > levelOffset)
+            mesh.clusterDagLevels.push_back({ levelOffset, uint32_t(mesh.meshlets.size()) - levelOffset });
+
+        // every group got stuck, going on would only repeat the same groups
+        if (next.size() >= pending.size())
+            break;
+
+        pending.swap(next);
+    }
+
+    // whatever is left are the roots, their parentError stays FLT_MAX
+    for (uint32_t mi : pending)
+        mesh.clusterDag.error = std::max(mesh.clusterDag.error, mesh.meshletLods[mi].error);
+
+    mesh.clusterDag.meshletCount = uint32_t(mesh.meshlets.size()) - mesh.clusterDag.meshletOffset;
+
+    // the parent errors are only known once the level above is built
+    for (ClusterDagLevel& level : mesh.clusterDagLevels)
+    {
+        level.minError = FLT_MAX;
+        level.maxParentError = 0.0f;
+
+        for (uint32_t mi = level.meshletOffset; mi < level.meshletOffset + level.meshletCount; ++mi)
+        {
+            level.minError = std::min(level.minError, mesh.meshletLods[mi].error);
+            level.maxParentError = std::max(level.maxParentError, mesh.meshletLods[mi].parentError);
+        }
+    }
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "onez.h"
+#include <volk.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <cfloat>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef GLM_FORCE_RADIANS
+#define GLM_FORCE_RADIANS
+#endif
+#ifndef GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#endif
+#include <glm/glm.hpp>
+
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/gtx/hash.hpp>
+
+// Full precision vertex the mesh is processed in, the vertex buffer holds GpuVertex from VertexFormat.h.
+struct Vertex {
+    glm::vec3 position {};
+    glm::u16vec2 uv {};     // half floats
+    alignas(16) glm::u16vec3 normal {}; // half floats
+
+    bool operator==(const Vertex& other) const {
+        return position == other.position && normal == other.normal && uv == other.uv;
+    }
+};
+
+// Fixed size header, the vertex references and micro-indices live in Mesh::meshletData.
+struct Meshlet {
+    // bounding sphere and normal cone from meshopt_computeMeshletBounds, the cone is only
+    // meaningful when coneCutoff < 127; a meshlet is backfacing when dot(center - camera, axis) >= cutoff * |center - camera| + radius
+    glm::vec3 center {};
+    float radius {};
+    int8_t coneAxis[3] {};
+    int8_t coneCutoff {};
+
+    uint32_t vertexOffset {};   // first word of the vertex indices, two per word with shortVertexIndices
+    uint32_t triangleOffset {}; // first word of the micro-indices, 3 bytes per triangle packed 4 per word
+
+    uint8_t vertexCount {};
+    uint8_t triangleCount {};
+    uint16_t reserved {};
+};
+
+static_assert(sizeof(Meshlet) == 32, "Meshlet must match the std430 layout in the mesh shader");
+
+// A meshlet expanded back into a contiguous range of the regular index buffer, for the indirect draw path.
+struct Cluster {
+    glm::vec3 center {};
+    float radius {};
+    int8_t coneAxis[3] {};
+    int8_t coneCutoff {};
+
+    uint32_t firstIndex {};
+    uint32_t indexCount {};
+    uint32_t reserved {};
+};
+
+static_assert(sizeof(Cluster) == 32, "Cluster must match the std430 layout in the culling shader");
+
+constexpr size_t kMeshletMaxVertices = 64;
+constexpr size_t kMeshletMaxTriangles = 124;
+
+// A level of detail, a range of Mesh::indices and the meshlets built from it. All levels share the vertices.
+struct MeshLod {
+    uint32_t indexOffset {};
+    uint32_t indexCount {};
+    uint32_t meshletOffset {};
+    uint32_t meshletCount {};
+    float error {}; // object space distance the surface may have moved from the full mesh, 0 for lods[0]
+};
+
+// Error bounds of a meshlet in the cluster hierarchy, parallel to Mesh::meshlets. The meshlet is part of the
+// rendered cut when its own error projects below the threshold and its parent's doesn't. Spheres are object space,
+// a parent sphere encloses its children and a parent error is never smaller, so the projected errors are monotonic.
+struct MeshletLod {
+    glm::vec4 bounds {};       // xyz center, w radius; the meshlet's own sphere on level 0, its group's above
+    glm::vec4 parentBounds {}; // of the group it was simplified into
+    float error {};            // 0 on level 0
+    float parentError = FLT_MAX; // FLT_MAX on the roots, and on meshlets outside the hierarchy
+    float reserved[2] {};
+};
+
+static_assert(sizeof(MeshletLod) == 48, "MeshletLod must match the std430 layout in the culling shaders");
+
+// The meshlets one round of buildClusterDag appended, and the error bounds the cut test can see on them. A level
+// whose smallest error projects above the threshold, or whose largest parent error projects below it, holds no
+// meshlet of the cut, so the selection only walks the meshlets of the levels in between.
+struct ClusterDagLevel {
+    uint32_t meshletOffset {};
+    uint32_t meshletCount {};
+    float minError {};
+    float maxParentError {}; // FLT_MAX when the level holds a root
+};
+
+static_assert(sizeof(ClusterDagLevel) == 16, "ClusterDagLevel must match the std430 layout in the culling shader");
+
+// Read-only run of elements, over a vector or memory something else keeps alive.
+template <typename T>
+struct ArrayView {
+    const T* items = nullptr;
+    size_t count = 0;
+
+    ArrayView() = default;
+    ArrayView(const T* items, size_t count) : items(items), count(count) {}
+    ArrayView(const std::vector<T>& vector) : items(vector.data()), count(vector.size()) {}
+
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+
+    const T& operator[](size_t index) const { return items[index]; }
+};
+
+struct CookedMesh;
+
+struct Mesh {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices; // every level of detail back to back
+
+    std::vector<MeshLod> lods; // lods[0] is the full mesh, each following level is coarser
+    MeshLod clusterDag {};     // meshlet range of the cluster hierarchy, empty unless buildClusterDag ran
+    std::vector<ClusterDagLevel> clusterDagLevels; // its levels back to back, the full mesh's meshlets first
+
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshletLod> meshletLods;
+    std::vector<uint32_t> meshletData;
+    bool shortVertexIndices = false;
+
+    std::array<glm::vec3, 2> bounding;
+
+    // Set when the mesh was loaded from a cooked file rather than built: the vertex and meshlet vectors are then
+    // left empty, the arrays are read in place from the file mapping it keeps alive and the vertices decoded from
+    // it as they are read (readVertices). Consumers go through the accessors below.
+    std::shared_ptr<const CookedMesh> cooked;
+
+    size_t vertexCount() const;
+
+    ArrayView<Meshlet> meshletArray() const;
+    ArrayView<MeshletLod> meshletLodArray() const;
+    ArrayView<uint32_t> meshletDataArray() const;
+};
+
+namespace std {
+    template<> struct hash<Vertex> {
+        size_t operator()(Vertex const& vertex) const {
+            return ((hash<glm::vec3>()(vertex.position) ^
+                   (hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
+                   (hash<glm::u16vec2>()(vertex.uv) << 1);
+        }
+    };
+}
+
+// Reorders indices for the post-transform cache and vertices for fetch locality.
+void optimizeMesh(Mesh& mesh);
+
+struct LodSettings {
+    size_t maxLods = 8;         // including the full mesh
+    float reduction = 0.5f;     // target index count of a level relative to the one before it
+    float maxError = 0.05f;     // per level, relative to the mesh extents as meshopt_simplify takes it
+    float minReduction = 0.85f; // the chain ends once a level keeps more than this share of the previous one
+};
+
+// Appends a chain of meshopt_simplify'd copies of the index buffer and records them in mesh.lods, each
+// simplified from the previous level. Runs after optimizeMesh and before buildMeshlets.
+void buildLods(Mesh& mesh, const LodSettings& settings = {});
+
+struct MeshletSettings {
+    size_t maxVertices = kMeshletMaxVertices;   // clamped to kMeshletMaxVertices
+    size_t maxTriangles = kMeshletMaxTriangles; // clamped to kMeshletMaxTriangles, rounded down to a multiple of 4
+    float coneWeight = 0.25f;  // 0 favours compact clusters, towards 1 favours tight normal cones
+    bool allowShortVertexIndices = true; // 16-bit vertex references when the mesh has fewer than 65536 vertices
+};
+
+// Spatially clusters the index buffer into meshlets and fills in their culling bounds. With lods, every
+// level is clustered on its own and its meshlet range is recorded in the MeshLod.
+void buildMeshlets(Mesh& mesh, const MeshletSettings& settings = {});
+
+struct ClusterDagSettings {
+    size_t groupSize = 4;       // neighbouring meshlets merged, simplified and split again as one group
+    float reduction = 0.5f;     // target triangle count of a simplified group relative to the merged meshlets
+    float minReduction = 0.85f; // a group that keeps more than this share moves up a level unsimplified
+    size_t maxLevels = 24;
+};
+
+// Builds a hierarchy over the full mesh: meshlets of lods[0] are grouped with their neighbours, each group is
+// simplified with its border locked and split into new meshlets, which form the next level. Appends all levels
+// as mesh.clusterDag and fills in their MeshletLod. Runs after buildMeshlets with the same settings.
+void buildClusterDag(Mesh& mesh, const ClusterDagSettings& settings = {}, const MeshletSettings& meshletSettings = {});
+
+// Vertex buffer index of the meshlet's local vertex, decoded from the reference in Mesh::meshletData.
+uint32_t meshletVertex(const Mesh& mesh, const Meshlet& meshlet, uint32_t local);
+
+// GPU bytes taken by the meshlet headers and data stream, and what the old fixed-capacity layout
+// (64 32-bit vertex slots and 126 triangle slots per meshlet) would need for the same meshlets.
+void meshletFootprint(const Mesh& mesh, size_t& packedBytes, size_t& fixedBytes);
+
+// Rewrites the meshlets as one index buffer where every meshlet owns a contiguous range, so each can be
+// drawn (or culled) as an indexed draw over the original vertex buffer.
+void buildClusters(const Mesh& mesh, std::vector<uint32_t>& indices, std::vector<Cluster>& clusters);
@@ -0,0 +1,533 @@
+#include "MeshCache.h"
+#include "ThreadPool.h"
+
+#include <meshoptimizer.h>
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER fileSize {};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return;
+	}
+
+	_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	_size = _data ? size_t(fileSize.QuadPart) : 0;
+
+	_file = file;
+	_mapping = mapping;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st {};
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return;
+	}
+
+	void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return;
+
+	_data = static_cast<const uint8_t*>(data);
+	_size = size_t(st.st_size);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#if defined(_WIN32)
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file)
+		CloseHandle(_file);
+#else
+	if (_data)
+		munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+}
+
+uint64_t hashFile(const std::filesystem::path& path)
+{
+	MappedFile file(path);
+
+	if (!file)
+		return 0;
+
+	return hash64(file.data(), file.size());
+}
+
+static const uint32_t kCookedMeshMagic = 0x4d5a4e4f; // 'ONZM'
+static const uint32_t kCookedMeshVersion = 7;
+
+struct CookedMeshHeader
+{
+	uint32_t magic;
+	uint32_t version;
+
+	uint64_t sourceHash;
+	uint64_t settingsHash;
+	uint64_t layoutHash;
+
+	// vertices and indices are stored as a CookedChunk table followed by the encoded chunks
+	uint64_t vertexCount;
+	uint64_t vertexOffset;
+	uint64_t vertexBytes;
+
+	uint64_t indexCount;
+	uint64_t indexOffset;
+	uint64_t indexBytes;
+
+	uint64_t meshletCount;
+	uint64_t meshletOffset;
+
+	uint64_t meshletDataCount;
+	uint64_t meshletDataOffset;
+
+	uint64_t lodCount;
+	uint64_t lodOffset;
+
+	uint64_t meshletLodCount;
+	uint64_t meshletLodOffset;
+
+	uint64_t dagLevelCount;
+	uint64_t dagLevelOffset;
+
+	MeshLod clusterDag;
+
+	uint32_t shortVertexIndices;
+
+	float bounding[6];
+};
+
+// Indices are meshopt encoded in independent chunks like the vertices, so the stream decodes in parallel.
+static const size_t kIndexChunkSize = 3 << 16; // indices, whole triangles as the index codec needs
+
+static size_t chunkCount(uint64_t count, size_t chunkSize)
+{
+	return size_t((count + chunkSize - 1) / chunkSize);
+}
+
+template <typename F>
+static void forEachChunk(ThreadPool* pool, size_t count, const F& body)
+{
+	if (pool)
+		pool->parallelFor(count, body);
+	else
+		for (size_t i = 0; i < count; ++i)
+			body(i);
+}
+
+static uint64_t meshLayoutHash()
+{
+	const uint64_t layout[] =
+	{
+		sizeof(Vertex),
+		offsetof(Vertex, position),
+		offsetof(Vertex, uv),
+		offsetof(Vertex, normal),
+
+		sizeof(Meshlet),
+		offsetof(Meshlet, vertexOffset),
+		offsetof(Meshlet, triangleOffset),
+		offsetof(Meshlet, vertexCount),
+		offsetof(Meshlet, triangleCount),
+
+		sizeof(MeshLod),
+		offsetof(MeshLod, meshletOffset),
+		offsetof(MeshLod, error),
+
+		sizeof(MeshletLod),
+		offsetof(MeshletLod, parentBounds),
+		offsetof(MeshletLod, error),
+
+		sizeof(ClusterDagLevel),
+		offsetof(ClusterDagLevel, minError),
+	};
+
+	return hash64(layout, sizeof(layout));
+}
+
+// field by field, the padding of the settings structs is not initialized
+static uint64_t cookSettingsHash(const CookSettings& settings)
+{
+	const double fields[] =
+	{
+		double(settings.lods.maxLods),
+		settings.lods.reduction,
+		settings.lods.maxError,
+		settings.lods.minReduction,
+
+		double(settings.meshlets.maxVertices),
+		double(settings.meshlets.maxTriangles),
+		settings.meshlets.coneWeight,
+		settings.meshlets.allowShortVertexIndices ? 1.0 : 0.0,
+
+		double(settings.clusterDag.groupSize),
+		settings.clusterDag.reduction,
+		settings.clusterDag.minReduction,
+		double(settings.clusterDag.maxLevels),
+	};
+
+	return hash64(fields, sizeof(fields));
+}
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + 15) & ~uint64_t(15);
+}
+
+std::filesystem::path cookedMeshPath(const std::filesystem::path& cacheDirectory, const std::filesystem::path& sourcePath)
+{
+	const auto source = std::filesystem::absolute(sourcePath).string();
+
+	char name[64];
+	snprintf(name, sizeof(name), ".%016llx.mesh", (unsigned long long)hash64(source.data(), source.size()));
+
+	return cacheDirectory / (sourcePath.stem().string() + name);
+}
+
+bool loadCookedMesh(const std::filesystem::path& path, uint64_t sourceHash, const CookSettings& settings, Mesh& mesh, ThreadPool* pool, CookedMeshStats* stats)
+{
+	auto cooked = std::make_shared<CookedMesh>(path);
+	const MappedFile& file = cooked->file;
+
+	if (!file || file.size() < sizeof(CookedMeshHeader))
+		return false;
+
+	CookedMeshHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != kCookedMeshMagic || header.version != kCookedMeshVersion)
+		return false;
+
+	if (header.sourceHash != sourceHash || header.settingsHash != cookSettingsHash(settings) || header.layoutHash != meshLayoutHash())
+		return false;
+
+	auto inBounds = [&](uint64_t offset, uint64_t count, size_t stride) {
+		return offset <= file.size() && count <= (file.size() - offset) / stride;
+	};
+
+	const size_t vertexChunks = chunkCount(header.vertexCount, kVertexChunkSize);
+	const size_t indexChunks = chunkCount(header.indexCount, kIndexChunkSize);
+
+	if (!inBounds(header.vertexOffset, vertexChunks, sizeof(CookedChunk)) ||
+		!inBounds(header.indexOffset, indexChunks, sizeof(CookedChunk)) ||
+		!inBounds(header.meshletOffset, header.meshletCount, sizeof(Meshlet)) ||
+		!inBounds(header.meshletDataOffset, header.meshletDataCount, sizeof(uint32_t)) ||
+		!inBounds(header.lodOffset, header.lodCount, sizeof(MeshLod)) ||
+		!inBounds(header.meshletLodOffset, header.meshletLodCount, sizeof(MeshletLod)) ||
+		!inBounds(header.dagLevelOffset, header.dagLevelCount, sizeof(ClusterDagLevel)))
+	{
+		fprintf(stderr, "Cooked mesh '%s' is truncated\n", path.string().c_str());
+		return false;
+	}
+
+	auto vertexTable = reinterpret_cast<const CookedChunk*>(file.data() + header.vertexOffset);
+	auto indexTable = reinterpret_cast<const CookedChunk*>(file.data() + header.indexOffset);
+	auto meshlets = reinterpret_cast<const Meshlet*>(file.data() + header.meshletOffset);
+	auto meshletData = reinterpret_cast<const uint32_t*>(file.data() + header.meshletDataOffset);
+	auto lods = reinterpret_cast<const MeshLod*>(file.data() + header.lodOffset);
+	auto meshletLods = reinterpret_cast<const MeshletLod*>(file.data() + header.meshletLodOffset);
+	auto dagLevels = reinterpret_cast<const ClusterDagLevel*>(file.data() + header.dagLevelOffset);
+
+	// the vertices stay encoded in the mapping, only their table is checked here
+	for (size_t i = 0; i < vertexChunks; ++i)
+	{
+		if (!inBounds(vertexTable[i].offset, vertexTable[i].size, 1))
+		{
+			fprintf(stderr, "Cooked mesh '%s' is truncated\n", path.string().c_str());
+			return false;
+		}
+	}
+
+	auto decodeBegin = std::chrono::high_resolution_clock::now();
+
+	// every chunk decodes straight into its slice of the index array
+	mesh.indices.resize(size_t(header.indexCount));
+
+	std::atomic<bool> corrupt {false};
+
+	forEachChunk(pool, indexChunks, [&](size_t chunk) {
+		const CookedChunk& table = indexTable[chunk];
+
+		if (!inBounds(table.offset, table.size, 1))
+		{
+			corrupt = true;
+			return;
+		}
+
+		size_t first = chunk * kIndexChunkSize;
+		size_t count = std::min(mesh.indices.size() - first, kIndexChunkSize);
+
+		if (meshopt_decodeIndexBuffer(&mesh.indices[first], count, sizeof(uint32_t), file.data() + table.offset, size_t(table.size)) != 0)
+			corrupt = true;
+	});
+
+	if (corrupt)
+	{
+		fprintf(stderr, "Cooked mesh '%s' has corrupt index data\n", path.string().c_str());
+		return false;
+	}
+
+	if (stats)
+	{
+		stats->encodedBytes = header.indexBytes;
+		stats->decodedBytes = header.indexCount * sizeof(uint32_t);
+		stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - decodeBegin).count();
+	}
+
+	// the sections are 16 byte aligned within the page aligned mapping, so they are read in place
+	cooked->meshlets = ArrayView<Meshlet>(meshlets, size_t(header.meshletCount));
+	cooked->meshletData = ArrayView<uint32_t>(meshletData, size_t(header.meshletDataCount));
+	cooked->meshletLods = ArrayView<MeshletLod>(meshletLods, size_t(header.meshletLodCount));
+	cooked->vertexCount = size_t(header.vertexCount);
+	cooked->vertexChunks = ArrayView<CookedChunk>(vertexTable, vertexChunks);
+
+	mesh.vertices.clear();
+	mesh.meshlets.clear();
+	mesh.meshletData.clear();
+	mesh.meshletLods.clear();
+	mesh.cooked = std::move(cooked);
+
+	mesh.lods.assign(lods, lods + header.lodCount);
+	mesh.clusterDag = header.clusterDag;
+	mesh.clusterDagLevels.assign(dagLevels, dagLevels + header.dagLevelCount);
+	mesh.shortVertexIndices = header.shortVertexIndices != 0;
+
+	mesh.bounding[0] = glm::vec3(header.bounding[0], header.bounding[1], header.bounding[2]);
+	mesh.bounding[1] = glm::vec3(header.bounding[3], header.bounding[4], header.bounding[5]);
+
+	return true;
+}
+
+bool readVertices(const Mesh& mesh, size_t first, size_t count, Vertex* destination)
+{
+	if (!mesh.cooked)
+	{
+		std::copy_n(mesh.vertices.begin() + first, count, destination);
+		return true;
+	}
+
+	const CookedMesh& cooked = *mesh.cooked;
+	std::vector<Vertex> scratch;
+
+	for (size_t chunk = first / kVertexChunkSize; chunk * kVertexChunkSize < first + count; ++chunk)
+	{
+		const size_t chunkFirst = chunk * kVertexChunkSize;
+		const size_t chunkVertices = std::min(cooked.vertexCount - chunkFirst, kVertexChunkSize);
+
+		const size_t begin = std::max(first, chunkFirst);
+		const size_t end = std::min(first + count, chunkFirst + chunkVertices);
+
+		// the codec only decodes whole chunks
+		const bool whole = begin == chunkFirst && end == chunkFirst + chunkVertices;
+
+		if (!whole)
+			scratch.resize(chunkVertices);
+
+		Vertex* target = whole ? destination + (begin - first) : scratch.data();
+		const CookedChunk& table = cooked.vertexChunks[chunk];
+
+		if (meshopt_decodeVertexBuffer(target, chunkVertices, sizeof(Vertex), cooked.file.data() + table.offset, size_t(table.size)) != 0)
+			return false;
+
+		if (!whole)
+			std::copy(scratch.begin() + (begin - chunkFirst), scratch.begin() + (end - chunkFirst), destination + (begin - first));
+	}
+
+	return true;
+}
+
+bool saveCookedMesh(const std::filesystem::path& path, uint64_t sourceHash, const CookSettings& settings, const Mesh& mesh, ThreadPool* pool, CookedMeshStats* stats)
+{
+	auto encodeBegin = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::vector<unsigned char>> vertexChunks(chunkCount(mesh.vertices.size(), kVertexChunkSize));
+	std::vector<std::vector<unsigned char>> indexChunks(chunkCount(mesh.indices.size(), kIndexChunkSize));
+
+	forEachChunk(pool, vertexChunks.size() + indexChunks.size(), [&](size_t i) {
+		if (i < vertexChunks.size())
+		{
+			size_t first = i * kVertexChunkSize;
+			size_t count = std::min(mesh.vertices.size() - first, kVertexChunkSize);
+
+			auto& chunk = vertexChunks[i];
+			chunk.resize(meshopt_encodeVertexBufferBound(count, sizeof(Vertex)));
+			chunk.resize(meshopt_encodeVertexBuffer(chunk.data(), chunk.size(), &mesh.vertices[first], count, sizeof(Vertex)));
+		}
+		else
+		{
+			size_t first = (i - vertexChunks.size()) * kIndexChunkSize;
+			size_t count = std::min(mesh.indices.size() - first, kIndexChunkSize);
+
+			auto& chunk = indexChunks[i - vertexChunks.size()];
+			chunk.resize(meshopt_encodeIndexBufferBound(count, mesh.vertices.size()));
+			chunk.resize(meshopt_encodeIndexBuffer(chunk.data(), chunk.size(), &mesh.indices[first], count));
+		}
+	});
+
+	// the tables point at the chunks, which follow them back to back
+	auto layoutChunks = [](uint64_t tableOffset, const std::vector<std::vector<unsigned char>>& chunks, std::vector<CookedChunk>& table) {
+		uint64_t offset = tableOffset + chunks.size() * sizeof(CookedChunk);
+
+		table.resize(chunks.size());
+
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			table[i] = { offset, chunks[i].size() };
+			offset += chunks[i].size();
+		}
+
+		return offset - tableOffset;
+	};
+
+	std::vector<CookedChunk> vertexTable, indexTable;
+
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+
+	CookedMeshHeader header {};
+	header.magic = kCookedMeshMagic;
+	header.version = kCookedMeshVersion;
+	header.sourceHash = sourceHash;
+	header.settingsHash = cookSettingsHash(settings);
+	header.layoutHash = meshLayoutHash();
+
+	header.vertexCount = mesh.vertices.size();
+	header.vertexOffset = alignOffset(sizeof(header));
+	header.vertexBytes = layoutChunks(header.vertexOffset, vertexChunks, vertexTable);
+
+	header.indexCount = mesh.indices.size();
+	header.indexOffset = alignOffset(header.vertexOffset + header.vertexBytes);
+	header.indexBytes = layoutChunks(header.indexOffset, indexChunks, indexTable);
+
+	const ArrayView<Meshlet> meshlets = mesh.meshletArray();
+	const ArrayView<uint32_t> meshletData = mesh.meshletDataArray();
+	const ArrayView<MeshletLod> meshletLods = mesh.meshletLodArray();
+
+	header.meshletCount = meshlets.size();
+	header.meshletOffset = alignOffset(header.indexOffset + header.indexBytes);
+
+	header.meshletDataCount = meshletData.size();
+	header.meshletDataOffset = alignOffset(header.meshletOffset + header.meshletCount * sizeof(Meshlet));
+
+	header.lodCount = mesh.lods.size();
+	header.lodOffset = alignOffset(header.meshletDataOffset + header.meshletDataCount * sizeof(uint32_t));
+
+	header.meshletLodCount = meshletLods.size();
+	header.meshletLodOffset = alignOffset(header.lodOffset + header.lodCount * sizeof(MeshLod));
+
+	header.dagLevelCount = mesh.clusterDagLevels.size();
+	header.dagLevelOffset = alignOffset(header.meshletLodOffset + header.meshletLodCount * sizeof(MeshletLod));
+
+	header.clusterDag = mesh.clusterDag;
+
+	header.shortVertexIndices = mesh.shortVertexIndices;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		header.bounding[i + 0] = mesh.bounding[0][i];
+		header.bounding[i + 3] = mesh.bounding[1][i];
+	}
+
+	// write next to the destination and rename, so a concurrent reader never maps a partial file
+	auto tempPath = path;
+	tempPath += ".tmp";
+
+	FILE* f = fopen(tempPath.string().c_str(), "wb");
+
+	if (!f)
+		return false;
+
+	uint64_t position = 0;
+
+	auto writeAt = [&](uint64_t offset, const void* data, size_t size) {
+		static const uint8_t zeros[16] {};
+
+		assert(offset >= position && offset - position < sizeof(zeros));
+		fwrite(zeros, 1, size_t(offset - position), f);
+
+		position = offset + size;
+		return fwrite(data, 1, size, f) == size;
+	};
+
+	auto writeChunks = [&](const std::vector<CookedChunk>& table, const std::vector<std::vector<unsigned char>>& chunks) {
+		for (size_t i = 0; i < chunks.size(); ++i)
+			if (!writeAt(table[i].offset, chunks[i].data(), chunks[i].size()))
+				return false;
+
+		return true;
+	};
+
+	bool ok = writeAt(0, &header, sizeof(header))
+		&& writeAt(header.vertexOffset, vertexTable.data(), vertexTable.size() * sizeof(CookedChunk))
+		&& writeChunks(vertexTable, vertexChunks)
+		&& writeAt(header.indexOffset, indexTable.data(), indexTable.size() * sizeof(CookedChunk))
+		&& writeChunks(indexTable, indexChunks)
+		&& writeAt(header.meshletOffset, meshlets.data(), meshlets.size() * sizeof(Meshlet))
+		&& writeAt(header.meshletDataOffset, meshletData.data(), meshletData.size() * sizeof(uint32_t))
+		&& writeAt(header.lodOffset, mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod))
+		&& writeAt(header.meshletLodOffset, meshletLods.data(), meshletLods.size() * sizeof(MeshletLod))
+		&& writeAt(header.dagLevelOffset, mesh.clusterDagLevels.data(), mesh.clusterDagLevels.size() * sizeof(ClusterDagLevel));
+
+	ok = (fclose(f) == 0) && ok;
+
+	if (ok)
+		std::filesystem::rename(tempPath, path, ec);
+
+	if (!ok || ec)
+	{
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+
+	if (stats)
+	{
+		stats->encodedBytes = header.vertexBytes + header.indexBytes;
+		stats->decodedBytes = header.vertexCount * sizeof(Vertex) + header.indexCount * sizeof(uint32_t);
+		stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - encodeBegin).count();
+	}
+
+	return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Read-only memory mapping of a whole file, empty if the file can't be opened.
+class MappedFile final
+{
+public:
+	explicit MappedFile(const std::filesystem::path& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const { return _data; }
+	size_t size() const { return _size; }
+
+	explicit operator bool() const { return _data != nullptr; }
+
+private:
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+
+#if defined(_WIN32)
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+};
+
+uint64_t hashFile(const std::filesystem::path& path);
+
+// Vertices are meshopt encoded in independent chunks of this many, indexed by a table of CookedChunk.
+static const size_t kVertexChunkSize = 1 << 16;
+
+struct CookedChunk
+{
+	uint64_t offset; // from the start of the file
+	uint64_t size;
+};
+
+// A cooked mesh file kept mapped as long as a mesh loaded from it, which reads its meshlet arrays in place
+// and decodes its vertices on demand (readVertices).
+struct CookedMesh
+{
+	explicit CookedMesh(const std::filesystem::path& path) : file(path) {}
+
+	MappedFile file;
+
+	size_t vertexCount = 0;
+	ArrayView<CookedChunk> vertexChunks;
+
+	ArrayView<Meshlet> meshlets;
+	ArrayView<MeshletLod> meshletLods;
+	ArrayView<uint32_t> meshletData;
+};
+
+std::filesystem::path cookedMeshPath(const std::filesystem::path& cacheDirectory, const std::filesystem::path& sourcePath);
+
+class ThreadPool;
+
+// Vertex and index streams of a cooked mesh, before and after the meshopt codecs, and the time spent decoding
+// (loading) or encoding and writing (saving) them. Loading only decodes the indices, the vertices are left to
+// readVertices.
+struct CookedMeshStats
+{
+	uint64_t encodedBytes = 0;
+	uint64_t decodedBytes = 0;
+	double milliseconds = 0;
+};
+
+// What a mesh is built with after optimizeMesh, part of the key of its cooked file.
+struct CookSettings
+{
+	LodSettings lods;
+	MeshletSettings meshlets;
+	ClusterDagSettings clusterDag;
+};
+
+// The cooked file is only accepted if it was written from a source with the same hash, with the
+// same settings and with the same Vertex/Meshlet layout as this build. Vertices and indices are meshopt encoded
+// in chunks, the index chunks are spread over the pool when one is given; the vertices and meshlet
+// arrays are not copied, the loaded mesh keeps the file mapped (Mesh::cooked).
+bool loadCookedMesh(const std::filesystem::path& path, uint64_t sourceHash, const CookSettings& settings, Mesh& mesh, ThreadPool* pool = nullptr, CookedMeshStats* stats = nullptr);
+bool saveCookedMesh(const std::filesystem::path& path, uint64_t sourceHash, const CookSettings& settings, const Mesh& mesh, ThreadPool* pool = nullptr, CookedMeshStats* stats = nullptr);
+
+// Vertices [first, first + count) of the mesh, copied or, for a cooked mesh, decoded from the chunks they
+// overlap, so its vertices are never all held decoded at once. A chunk only partly in the range decodes
+// through scratch, callers splitting a mesh should follow kVertexChunkSize to decode each chunk once.
+// False if a chunk is corrupt.
+bool readVertices(const Mesh& mesh, size_t first, size_t count, Vertex* destination);
@@ -0,0 +1,395 @@
+#include "ObjLoader.h"
+#include "MeshCache.h"
+#include "ThreadPool.h"
+
+#include <meshoptimizer.h>
+
+#define FAST_OBJ_IMPLEMENTATION
+#include <fast_obj.h>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// one triangle corner, as position/texcoord/normal indices into the merged obj arrays
+struct ObjCorner
+{
+	uint32_t p, t, n;
+};
+
+// a line-aligned slice of the mapped obj file, served to fast_obj through its file callbacks
+struct ObjChunk
+{
+	const char* path;
+	const char* data;
+	size_t size;
+	size_t offset;
+};
+
+static void* chunkOpen(const char* path, void* user_data)
+{
+	auto chunk = static_cast<ObjChunk*>(user_data);
+
+	// material libraries are not needed for geometry, so only the obj itself can be opened
+	return strcmp(path, chunk->path) == 0 ? chunk : nullptr;
+}
+
+static void chunkClose(void* file, void* user_data)
+{
+}
+
+static size_t chunkRead(void* file, void* dst, size_t bytes, void* user_data)
+{
+	auto chunk = static_cast<ObjChunk*>(file);
+
+	size_t count = std::min(bytes, chunk->size - chunk->offset);
+	memcpy(dst, chunk->data + chunk->offset, count);
+	chunk->offset += count;
+
+	return count;
+}
+
+static unsigned long chunkSize(void* file, void* user_data)
+{
+	return (unsigned long)static_cast<ObjChunk*>(file)->size;
+}
+
+// Face indices are absolute except for the relative (negative) form, which fast_obj would resolve
+// against the chunk's own vertex count.
+static bool hasRelativeIndices(const char* begin, const char* end)
+{
+	for (const char* line = begin; line < end; )
+	{
+		auto next = static_cast<const char*>(memchr(line, '\n', end - line));
+		next = next ? next + 1 : end;
+
+		while (line < next && (*line == ' ' || *line == '\t'))
+			line++;
+
+		if (next - line > 1 && line[0] == 'f' && (line[1] == ' ' || line[1] == '\t') && memchr(line, '-', next - line))
+			return true;
+
+		line = next;
+	}
+
+	return false;
+}
+
+template<typename F>
+static void parallelBlocks(ThreadPool* pool, size_t count, const F& body)
+{
+	const size_t blockSize = 64 * 1024;
+	const size_t blockCount = (count + blockSize - 1) / blockSize;
+
+	auto run = [&](size_t block) {
+		body(block, block * blockSize, std::min(count, (block + 1) * blockSize));
+	};
+
+	if (pool)
+		pool->parallelFor(blockCount, run);
+	else
+		for (size_t block = 0; block < blockCount; ++block)
+			run(block);
+}
+
+static Vertex makeVertex(const float* positions, const float* texcoords, const float* normals, const ObjCorner& corner)
+{
+	Vertex vertex {};
+
+	vertex.position = {
+		positions[3 * corner.p + 0],
+		positions[3 * corner.p + 1],
+		positions[3 * corner.p + 2]
+	};
+
+	// index 0 is fast_obj's placeholder for a missing attribute
+	if (corner.t) {
+		vertex.uv = {
+			meshopt_quantizeHalf(texcoords[2 * corner.t + 0]),
+			meshopt_quantizeHalf(1.0f - texcoords[2 * corner.t + 1])
+		};
+	}
+
+	if (corner.n) {
+		vertex.normal = {
+			meshopt_quantizeHalf(normals[3 * corner.n + 0]),
+			meshopt_quantizeHalf(normals[3 * corner.n + 1]),
+			meshopt_quantizeHalf(normals[3 * corner.n + 2])
+		};
+	}
+
+	return vertex;
+}
+
+static bool buildMesh(const std::vector<fastObjMesh*>& parts, const std::vector<size_t>& triangleCounts, Mesh& mesh, ThreadPool* pool)
+{
+	const size_t partCount = parts.size();
+
+	// every part keeps its own placeholder at index 0, the merged arrays keep a single one
+	std::vector<size_t> positionBase(partCount), texcoordBase(partCount), normalBase(partCount), cornerBase(partCount);
+
+	size_t positionCount = 1, texcoordCount = 1, normalCount = 1, cornerCount = 0;
+
+	for (size_t i = 0; i < partCount; ++i)
+	{
+		positionBase[i] = positionCount;
+		texcoordBase[i] = texcoordCount;
+		normalBase[i] = normalCount;
+		cornerBase[i] = cornerCount;
+
+		positionCount += parts[i]->position_count - 1;
+		texcoordCount += parts[i]->texcoord_count - 1;
+		normalCount += parts[i]->normal_count - 1;
+		cornerCount += triangleCounts[i] * 3;
+	}
+
+	std::vector<float> positions(positionCount * 3), texcoords(texcoordCount * 2), normals(normalCount * 3);
+	std::vector<ObjCorner> corners(cornerCount);
+
+	std::atomic<bool> valid {true};
+
+	auto mergePart = [&](size_t i) {
+		const fastObjMesh* part = parts[i];
+
+		memcpy(&positions[positionBase[i] * 3], part->positions + 3, (part->position_count - 1) * 3 * sizeof(float));
+		memcpy(&texcoords[texcoordBase[i] * 2], part->texcoords + 2, (part->texcoord_count - 1) * 2 * sizeof(float));
+		memcpy(&normals[normalBase[i] * 3], part->normals + 3, (part->normal_count - 1) * 3 * sizeof(float));
+
+		ObjCorner* output = corners.data() + cornerBase[i];
+		const fastObjIndex* input = part->indices;
+
+		auto corner = [&](const fastObjIndex& index) {
+			if (index.p >= positionCount || index.t >= texcoordCount || index.n >= normalCount)
+				valid = false;
+
+			return ObjCorner { index.p < positionCount ? index.p : 0, index.t < texcoordCount ? index.t : 0, index.n < normalCount ? index.n : 0 };
+		};
+
+		for (unsigned int face = 0; face < part->face_count; ++face)
+		{
+			const unsigned int count = part->face_vertices[face];
+
+			for (unsigned int k = 1; k + 1 < count; ++k)
+			{
+				*output++ = corner(input[0]);
+				*output++ = corner(input[k]);
+				*output++ = corner(input[k + 1]);
+			}
+
+			input += count;
+		}
+	};
+
+	if (pool)
+		pool->parallelFor(partCount, mergePart);
+	else
+		for (size_t i = 0; i < partCount; ++i)
+			mergePart(i);
+
+	if (!valid)
+	{
+		fprintf(stderr, "OBJ face index out of range\n");
+		return false;
+	}
+
+	std::vector<uint32_t> remap(cornerCount);
+	size_t vertexCount = meshopt_generateVertexRemap(remap.data(), nullptr, cornerCount, corners.data(), cornerCount, sizeof(ObjCorner));
+
+	std::vector<ObjCorner> unique(vertexCount);
+	meshopt_remapVertexBuffer(unique.data(), corners.data(), cornerCount, sizeof(ObjCorner), remap.data());
+
+	corners = {};
+
+	mesh.vertices.resize(vertexCount);
+	mesh.indices = std::move(remap);
+
+	const size_t blockCount = (vertexCount + 64 * 1024 - 1) / (64 * 1024);
+	std::vector<glm::vec3> blockMin(blockCount, glm::vec3(FLT_MAX)), blockMax(blockCount, glm::vec3(-FLT_MAX));
+
+	parallelBlocks(pool, vertexCount, [&](size_t block, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			mesh.vertices[i] = makeVertex(positions.data(), texcoords.data(), normals.data(), unique[i]);
+
+			blockMin[block] = glm::min(blockMin[block], mesh.vertices[i].position);
+			blockMax[block] = glm::max(blockMax[block], mesh.vertices[i].position);
+		}
+	});
+
+	mesh.bounding[0] = glm::vec3(FLT_MAX);
+	mesh.bounding[1] = glm::vec3(-FLT_MAX);
+
+	for (size_t block = 0; block < blockCount; ++block)
+	{
+		mesh.bounding[0] = glm::min(mesh.bounding[0], blockMin[block]);
+		mesh.bounding[1] = glm::max(mesh.bounding[1], blockMax[block]);
+	}
+
+	mesh.meshlets.clear();
+
+	return true;
+}
+
+bool loadObj(const char* path, Mesh& mesh, ThreadPool* pool)
+{
+	MappedFile file(path);
+
+	if (!file)
+	{
+		fprintf(stderr, "I/O error. Cannot open OBJ file '%s'\n", path);
+		return false;
+	}
+
+	const char* data = reinterpret_cast<const char*>(file.data());
+	const size_t size = file.size();
+
+	// small files are not worth splitting, large ones get a few chunks per thread for balance
+	const size_t minChunkSize = 4 << 20;
+	const size_t chunkCount = pool ? std::clamp<size_t>(size / minChunkSize, 1, pool->size() * 4) : 1;
+	const size_t chunkSize = (size + chunkCount - 1) / chunkCount;
+
+	std::vector<ObjChunk> chunks;
+
+	for (size_t begin = 0; begin < size; )
+	{
+		size_t end = size;
+
+		if (begin + chunkSize < size)
+		{
+			auto newline = static_cast<const char*>(memchr(data + begin + chunkSize, '\n', size - begin - chunkSize));
+			end = newline ? size_t(newline - data) + 1 : size;
+		}
+
+		chunks.push_back({ path, data + begin, end - begin, 0 });
+		begin = end;
+	}
+
+	if (chunks.size() > 1)
+	{
+		std::atomic<bool> relative {false};
+
+		pool->parallelFor(chunks.size(), [&](size_t i) {
+			if (hasRelativeIndices(chunks[i].data, chunks[i].data + chunks[i].size))
+				relative = true;
+		});
+
+		if (relative)
+			chunks = { { path, data, size, 0 } };
+	}
+
+	fastObjCallbacks callbacks {};
+	callbacks.file_open = chunkOpen;
+	callbacks.file_close = chunkClose;
+	callbacks.file_read = chunkRead;
+	callbacks.file_size = chunkSize;
+
+	std::vector<fastObjMesh*> parts(chunks.size(), nullptr);
+	std::vector<size_t> triangleCounts(chunks.size(), 0);
+
+	auto parseChunk = [&](size_t i) {
+		fastObjMesh* part = fast_obj_read_with_callbacks(path, &callbacks, &chunks[i]);
+
+		if (part)
+			for (unsigned int face = 0; face < part->face_count; ++face)
+				triangleCounts[i] += part->face_vertices[face] > 2 ? part->face_vertices[face] - 2 : 0;
+
+		parts[i] = part;
+	};
+
+	if (pool)
+		pool->parallelFor(chunks.size(), parseChunk);
+	else
+		parseChunk(0);
+
+	bool result = std::all_of(parts.begin(), parts.end(), [](fastObjMesh* part) { return part != nullptr; });
+
+	if (result)
+		result = buildMesh(parts, triangleCounts, mesh, pool);
+	else
+		fprintf(stderr, "Failed to parse OBJ file '%s'\n", path);
+
+	for (auto part : parts)
+		if (part)
+			fast_obj_destroy(part);
+
+	return result;
+}
+
+bool loadObjTinyObj(const char* path, Mesh& mesh)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn, err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path))
+	{
+		fprintf(stderr, "%s%s\n", warn.c_str(), err.c_str());
+		return false;
+	}
+
+	glm::vec3 minVertex = glm::vec3(FLT_MAX);
+	glm::vec3 maxVertex = -minVertex;
+
+	std::vector<Vertex> vertices;
+
+	for (const auto& shape : shapes)
+	{
+		for (const auto& index : shape.mesh.indices)
+		{
+			Vertex vertex{};
+			vertex.position = {
+				attrib.vertices[3 * index.vertex_index + 0],
+				attrib.vertices[3 * index.vertex_index + 1],
+				attrib.vertices[3 * index.vertex_index + 2]
+			};
+
+			maxVertex = glm::max(maxVertex, vertex.position);
+			minVertex = glm::min(minVertex, vertex.position);
+
+			if (index.texcoord_index >= 0)
+			{
+				vertex.uv = {
+					meshopt_quantizeHalf(attrib.texcoords[2 * index.texcoord_index + 0]),
+					meshopt_quantizeHalf(1.0f - attrib.texcoords[2 * index.texcoord_index + 1])
+				};
+			}
+
+			if (index.normal_index >= 0)
+			{
+				vertex.normal = {
+					meshopt_quantizeHalf(attrib.normals[3 * index.normal_index + 0]),
+					meshopt_quantizeHalf(attrib.normals[3 * index.normal_index + 1]),
+					meshopt_quantizeHalf(attrib.normals[3 * index.normal_index + 2])
+				};
+			}
+
+			vertices.push_back(vertex);
+		}
+	}
+
+	mesh.bounding[0] = minVertex;
+	mesh.bounding[1] = maxVertex;
+
+	auto index_count = vertices.size();
+
+	std::vector<uint32_t> remap(index_count);
+	size_t vertex_count = meshopt_generateVertexRemap(remap.data(), 0, index_count, vertices.data(), index_count, sizeof(Vertex));
+
+	mesh.vertices.resize(vertex_count);
+	mesh.indices.resize(index_count);
+
+	meshopt_remapVertexBuffer(mesh.vertices.data(), vertices.data(), index_count, sizeof(Vertex), remap.data());
+	meshopt_remapIndexBuffer(mesh.indices.data(), 0, index_count, remap.data());
+
+	mesh.meshlets.clear();
+
+	return true;
+}
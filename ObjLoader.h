@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Mesh.h"
+
+class ThreadPool;
+
+// Both loaders produce an indexed, not yet optimized mesh with its bounding box.
+
+// fast_obj backend. With a pool the file is split into line-aligned chunks that are parsed concurrently;
+// files using relative (negative) face indices fall back to a single fast_obj pass.
+bool loadObj(const char* path, Mesh& mesh, ThreadPool* pool = nullptr);
+
+// tinyobjloader backend, kept as the reference for the load benchmark.
+bool loadObjTinyObj(const char* path, Mesh& mesh);
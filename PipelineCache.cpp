@@ -0,0 +1,164 @@
+#include "PipelineCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <system_error>
+
+static const uint32_t kPipelineCacheMagic = 0x505a4e4f; // 'ONZP'
+static const uint32_t kPipelineCacheVersion = 1;
+
+struct PipelineCacheFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+
+	uint32_t reserved;
+
+	uint64_t dataSize;
+	uint64_t dataHash;
+};
+
+static bool isCompatible(const PipelineCacheFileHeader& header, const VkPhysicalDeviceProperties& properties)
+{
+	return header.vendorID == properties.vendorID && header.deviceID == properties.deviceID
+		&& header.driverVersion == properties.driverVersion
+		&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// the driver's own header, checked too so a mismatching blob never reaches vkCreatePipelineCache
+static bool isCompatibleBlob(const std::vector<uint8_t>& data, const VkPhysicalDeviceProperties& properties)
+{
+	VkPipelineCacheHeaderVersionOne header {};
+
+	if (data.size() < sizeof(header))
+		return false;
+
+	memcpy(&header, data.data(), sizeof(header));
+
+	return header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendorID == properties.vendorID && header.deviceID == properties.deviceID
+		&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static std::vector<uint8_t> readPipelineCacheFile(const std::filesystem::path& path, const VkPhysicalDeviceProperties& properties)
+{
+	std::vector<uint8_t> data;
+
+	FILE* file = fopen(path.string().c_str(), "rb");
+
+	if (!file)
+		return data;
+
+	PipelineCacheFileHeader header {};
+
+	if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == kPipelineCacheMagic && header.version == kPipelineCacheVersion)
+	{
+		if (!isCompatible(header, properties))
+		{
+			printf("Pipeline cache '%s' was written by a different device or driver, starting empty\n", path.string().c_str());
+		}
+		else
+		{
+			data.resize(size_t(header.dataSize));
+
+			if (fread(data.data(), 1, data.size(), file) != data.size() || hash64(data.data(), data.size()) != header.dataHash || !isCompatibleBlob(data, properties))
+				data.clear();
+		}
+	}
+
+	fclose(file);
+
+	return data;
+}
+
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& path)
+{
+	std::vector<uint8_t> data;
+
+	if (!path.empty())
+		data = readPipelineCacheFile(path, properties);
+
+	VkPipelineCacheCreateInfo createInfo { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	VkPipelineCache pipelineCache = 0;
+
+	if (vkCreatePipelineCache(device, &createInfo, 0, &pipelineCache) != VK_SUCCESS)
+	{
+		// a blob the driver rejects is not fatal, start over with an empty cache
+		createInfo.initialDataSize = 0;
+		createInfo.pInitialData = nullptr;
+
+		VK_CHECK(vkCreatePipelineCache(device, &createInfo, 0, &pipelineCache));
+	}
+
+	if (!data.empty())
+		printf("Loaded pipeline cache '%s' (%zu bytes)\n", path.string().c_str(), data.size());
+
+	return pipelineCache;
+}
+
+bool savePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& path)
+{
+	size_t dataSize = 0;
+	VK_CHECK(vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr));
+
+	std::vector<uint8_t> data(dataSize);
+	VK_CHECK(vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()));
+
+	data.resize(dataSize);
+
+	PipelineCacheFileHeader header {};
+	header.magic = kPipelineCacheMagic;
+	header.version = kPipelineCacheVersion;
+
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+	header.dataSize = data.size();
+	header.dataHash = hash64(data.data(), data.size());
+
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+
+	// write next to the destination and rename, so a crash mid-write never leaves a torn cache behind
+	auto tempPath = path;
+	tempPath += ".tmp";
+
+	FILE* file = fopen(tempPath.string().c_str(), "wb");
+
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, data.size(), file) == data.size();
+
+	ok = (fclose(file) == 0) && ok;
+
+	if (ok)
+		std::filesystem::rename(tempPath, path, ec);
+
+	if (!ok || ec)
+	{
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+
+	return true;
+}
+
+std::filesystem::path pipelineCachePath(const std::filesystem::path& cacheDirectory, const VkPhysicalDeviceProperties& properties)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "pipelines.%04x.%04x.bin", properties.vendorID, properties.deviceID);
+
+	return cacheDirectory / name;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "onez.h"
+#include <volk.h>
+
+#include <filesystem>
+
+// Creates a pipeline cache seeded from path. The stored blob is only used if it was written for the same
+// vendor, device, pipelineCacheUUID and driver version, otherwise the cache starts empty.
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& path);
+bool savePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& path);
+
+// Cache file name for the device, so switching GPUs doesn't evict the other one's cache.
+std::filesystem::path pipelineCachePath(const std::filesystem::path& cacheDirectory, const VkPhysicalDeviceProperties& properties);
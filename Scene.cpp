@@ -0,0 +1,230 @@
+#include "Scene.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+void packSceneGeometry(const std::vector<Mesh>& meshes, SceneGeometry& geometry)
+{
+	geometry = SceneGeometry();
+	geometry.bounding = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+
+	size_t vertexCount = 0;
+	bool shortVertexIndices = true;
+
+	for (const Mesh& mesh : meshes)
+	{
+		vertexCount += mesh.vertexCount();
+		shortVertexIndices = shortVertexIndices && mesh.shortVertexIndices;
+	}
+
+	// a mesh built with 32-bit references asked for them, otherwise it only depends on the shared buffer
+	geometry.shortVertexIndices = shortVertexIndices && vertexCount <= 0xffff;
+
+	std::vector<uint32_t> indices;
+	std::vector<Cluster> clusters;
+
+	for (const Mesh& mesh : meshes)
+	{
+		uint32_t meshletBase = uint32_t(geometry.meshlets.size());
+		uint32_t indexBase = uint32_t(geometry.clusterIndices.size());
+
+		SceneMesh sceneMesh {};
+
+		glm::vec3 center = (mesh.bounding[0] + mesh.bounding[1]) * 0.5f;
+		sceneMesh.bounds = glm::vec4(center, glm::length(mesh.bounding[1] - mesh.bounding[0]) * 0.5f);
+		sceneMesh.vertexOffset = geometry.vertexCount;
+
+		geometry.bounding[0] = glm::min(geometry.bounding[0], mesh.bounding[0]);
+		geometry.bounding[1] = glm::max(geometry.bounding[1], mesh.bounding[1]);
+
+		const ArrayView<Meshlet> meshlets = mesh.meshletArray();
+		const ArrayView<uint32_t> meshletData = mesh.meshletDataArray();
+		const ArrayView<MeshletLod> meshletLods = mesh.meshletLodArray();
+
+		// vertex references are rebased onto the shared vertex buffer, the micro-indices are local and copied as is
+		for (const Meshlet& source : meshlets)
+		{
+			Meshlet meshlet = source;
+			meshlet.vertexOffset = uint32_t(geometry.meshletData.size());
+
+			if (geometry.shortVertexIndices)
+			{
+				for (uint32_t j = 0; j < source.vertexCount; j += 2)
+				{
+					uint32_t second = j + 1 < source.vertexCount ? sceneMesh.vertexOffset + meshletVertex(mesh, source, j + 1) : 0;
+					geometry.meshletData.push_back((sceneMesh.vertexOffset + meshletVertex(mesh, source, j)) | (second << 16));
+				}
+			}
+			else
+			{
+				for (uint32_t j = 0; j < source.vertexCount; ++j)
+					geometry.meshletData.push_back(sceneMesh.vertexOffset + meshletVertex(mesh, source, j));
+			}
+
+			meshlet.triangleOffset = uint32_t(geometry.meshletData.size());
+
+			size_t triangleWords = (size_t(source.triangleCount) * 3 + 3) / 4;
+			geometry.meshletData.insert(geometry.meshletData.end(), meshletData.begin() + source.triangleOffset,
+				meshletData.begin() + source.triangleOffset + triangleWords);
+
+			geometry.meshlets.push_back(meshlet);
+		}
+
+		geometry.meshletLods.insert(geometry.meshletLods.end(), meshletLods.begin(), meshletLods.end());
+
+		// cluster indices stay relative to the mesh, the draws add vertexOffset
+		buildClusters(mesh, indices, clusters);
+
+		for (Cluster& cluster : clusters)
+			cluster.firstIndex += indexBase;
+
+		geometry.clusterIndices.insert(geometry.clusterIndices.end(), indices.begin(), indices.end());
+		geometry.clusters.insert(geometry.clusters.end(), clusters.begin(), clusters.end());
+
+		// a mesh without levels is its own single level
+		MeshLod whole { 0, uint32_t(mesh.indices.size()), 0, uint32_t(meshlets.size()), 0.0f };
+
+		sceneMesh.lodCount = uint32_t(std::min(std::max(mesh.lods.size(), size_t(1)), kSceneMaxLods));
+
+		for (uint32_t i = 0; i < sceneMesh.lodCount; ++i)
+		{
+			const MeshLod& lod = mesh.lods.empty() ? whole : mesh.lods[i];
+			SceneMeshLod& target = sceneMesh.lods[i];
+
+			target.meshletOffset = meshletBase + lod.meshletOffset;
+			target.meshletCount = lod.meshletCount;
+			target.error = lod.error;
+
+			// the clusters of a level are consecutive, and so are their index ranges
+			if (lod.meshletCount > 0)
+			{
+				const Cluster& first = geometry.clusters[target.meshletOffset];
+				const Cluster& last = geometry.clusters[target.meshletOffset + target.meshletCount - 1];
+
+				target.firstIndex = first.firstIndex;
+				target.indexCount = last.firstIndex + last.indexCount - first.firstIndex;
+			}
+		}
+
+		sceneMesh.dagMeshletOffset = meshletBase + mesh.clusterDag.meshletOffset;
+		sceneMesh.dagMeshletCount = mesh.clusterDag.meshletCount;
+
+		sceneMesh.dagLevelOffset = uint32_t(geometry.dagLevels.size());
+		sceneMesh.dagLevelCount = uint32_t(mesh.clusterDagLevels.size());
+
+		for (ClusterDagLevel level : mesh.clusterDagLevels)
+		{
+			level.meshletOffset += meshletBase;
+			geometry.dagLevels.push_back(level);
+		}
+
+		// merged group spheres may reach past the sphere around the bounding box
+		sceneMesh.dagRadius = sceneMesh.bounds.w;
+
+		for (uint32_t mi = mesh.clusterDag.meshletOffset; mi < mesh.clusterDag.meshletOffset + mesh.clusterDag.meshletCount; ++mi)
+		{
+			const MeshletLod& lod = meshletLods[mi];
+
+			sceneMesh.dagRadius = std::max(sceneMesh.dagRadius, glm::length(glm::vec3(lod.bounds) - center) + lod.bounds.w);
+
+			if (lod.parentError < FLT_MAX)
+				sceneMesh.dagRadius = std::max(sceneMesh.dagRadius, glm::length(glm::vec3(lod.parentBounds) - center) + lod.parentBounds.w);
+		}
+
+		geometry.meshes.push_back(sceneMesh);
+		geometry.vertexCount += uint32_t(mesh.vertexCount());
+	}
+
+	if (meshes.empty())
+		geometry.bounding = { glm::vec3(0.0f), glm::vec3(0.0f) };
+}
+
+void SceneInstances::resize(size_t count)
+{
+	positionScale.resize(count);
+	rotation.resize(count);
+	mesh.resize(count);
+	bounds.resize(count);
+}
+
+void SceneInstances::set(size_t index, const SceneMesh& sceneMesh, uint32_t meshIndex, const glm::vec3& position, float scale, const glm::quat& orientation)
+{
+	positionScale[index] = glm::vec4(position, scale);
+	rotation[index] = glm::vec4(orientation.x, orientation.y, orientation.z, orientation.w);
+	mesh[index] = meshIndex;
+
+	glm::vec3 center = position + orientation * (glm::vec3(sceneMesh.bounds) * scale);
+	bounds[index] = glm::vec4(center, sceneMesh.bounds.w * scale);
+}
+
+void SceneInstances::add(const SceneMesh& sceneMesh, uint32_t meshIndex, const glm::vec3& position, float scale, const glm::quat& orientation)
+{
+	resize(size() + 1);
+	set(size() - 1, sceneMesh, meshIndex, position, scale, orientation);
+}
+
+// PCG output permutation, enough for placement that only has to look random
+static uint32_t hashUint(uint32_t value)
+{
+	uint32_t state = value * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+static float unitFloat(uint32_t& state)
+{
+	state = hashUint(state);
+	return float(state >> 8) / 16777216.0f;
+}
+
+void generateStressScene(const std::vector<SceneMesh>& meshes, size_t instanceCount, float extent, uint32_t seed, SceneInstances& instances, ThreadPool* pool)
+{
+	instances.resize(instanceCount);
+
+	if (meshes.empty() || instanceCount == 0)
+	{
+		instances.resize(0);
+		return;
+	}
+
+	size_t side = size_t(std::ceil(std::cbrt(double(instanceCount))));
+	float cell = extent / float(side);
+
+	const size_t blockSize = 4096;
+
+	auto generate = [&](size_t block) {
+		size_t end = std::min(instanceCount, (block + 1) * blockSize);
+
+		for (size_t i = block * blockSize; i < end; ++i)
+		{
+			uint32_t state = hashUint(uint32_t(i) ^ hashUint(seed));
+
+			uint32_t meshIndex = hashUint(state) % uint32_t(meshes.size());
+			const SceneMesh& sceneMesh = meshes[meshIndex];
+
+			// Shoemake's uniform random rotation
+			float u1 = unitFloat(state), u2 = unitFloat(state) * 6.2831853f, u3 = unitFloat(state) * 6.2831853f;
+			float r1 = std::sqrt(1.0f - u1), r2 = std::sqrt(u1);
+			glm::quat orientation(r2 * std::cos(u3), r1 * std::sin(u2), r1 * std::cos(u2), r2 * std::sin(u3));
+
+			glm::vec3 cellCenter = (glm::vec3(float(i % side), float(i / side % side), float(i / side / side)) + 0.5f) * cell - extent * 0.5f;
+			glm::vec3 jitter = glm::vec3(unitFloat(state), unitFloat(state), unitFloat(state)) - 0.5f;
+
+			// between 0.5 and 0.8 of the cell across, so neighbours never overlap
+			float scale = cell * (0.25f + 0.15f * unitFloat(state)) / std::max(sceneMesh.bounds.w, FLT_MIN);
+			glm::vec3 position = cellCenter + jitter * cell * 0.2f - orientation * (glm::vec3(sceneMesh.bounds) * scale);
+
+			instances.set(i, sceneMesh, meshIndex, position, scale, orientation);
+		}
+	};
+
+	size_t blockCount = (instanceCount + blockSize - 1) / blockSize;
+
+	if (pool)
+		pool->parallelFor(blockCount, generate);
+	else
+		for (size_t block = 0; block < blockCount; ++block)
+			generate(block);
+}
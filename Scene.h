@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/gtc/quaternion.hpp>
+
+class ThreadPool;
+
+constexpr size_t kSceneMaxLods = 8; // LodSettings::maxLods, coarser levels beyond it are not registered
+
+// A level of detail of a registered mesh within the shared buffers. firstIndex/indexCount is the range its
+// clusters cover in the cluster ordered index buffer, meshletOffset/meshletCount the meshlets (clusters) themselves.
+struct SceneMeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t meshletOffset;
+	uint32_t meshletCount;
+	float error;
+	uint32_t reserved[3];
+};
+
+// Registry entry of a mesh, mirrored by SceneMesh in mesh.glsl and read by the instance culling.
+struct SceneMesh
+{
+	glm::vec4 bounds;          // object space sphere around the bounding box, xyz center, w radius
+	uint32_t vertexOffset;     // first vertex in the shared vertex buffer, cluster indices are relative to it
+	uint32_t lodCount;
+	uint32_t dagMeshletOffset; // the cluster hierarchy, empty unless buildClusterDag ran on the mesh
+	uint32_t dagMeshletCount;
+	SceneMeshLod lods[kSceneMaxLods];
+	uint32_t dagLevelOffset;   // its levels in SceneGeometry::dagLevels
+	uint32_t dagLevelCount;
+	float dagRadius;           // around the bounds center, encloses every sphere the cut test measures from
+	uint32_t reserved;
+};
+
+static_assert(sizeof(SceneMesh) == 304, "SceneMesh must match the std430 layout in the culling shader");
+
+// Every registered mesh packed back to back, in the layout of the shared vertex, index and meshlet buffers.
+struct SceneGeometry
+{
+	std::vector<SceneMesh> meshes;
+	uint32_t vertexCount = 0;
+	std::array<glm::vec3, 2> bounding; // of all meshes, what the vertex positions are quantized against
+
+	// meshlet vertex references point into the shared vertex buffer, 16-bit only if all of it fits
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshletLod> meshletLods;
+	std::vector<uint32_t> meshletData;
+	bool shortVertexIndices = false;
+
+	// hierarchy levels of every mesh, their meshlet ranges point into the shared meshlets
+	std::vector<ClusterDagLevel> dagLevels;
+
+	// vertex pulling path, clusters of every mesh in meshlet order
+	std::vector<uint32_t> clusterIndices;
+	std::vector<Cluster> clusters;
+};
+
+// Packs the meshes into geometry, in order, so mesh i of the registry is geometry.meshes[i]. Each mesh needs its
+// meshlets (buildMeshlets) and keeps its own vertices, which are encoded straight into the vertex buffer.
+void packSceneGeometry(const std::vector<Mesh>& meshes, SceneGeometry& geometry);
+
+// One entry per instance, as a structure of arrays that is uploaded array by array, so the culling pass only
+// fetches the bounds and mesh and the draws only the transform. The transform is a translation, rotation and
+// uniform scale like every model matrix the culling stages accept, and is applied before the scene transform.
+struct SceneInstances
+{
+	std::vector<glm::vec4> positionScale; // xyz translation, w scale
+	std::vector<glm::vec4> rotation;      // unit quaternion, xyz vector part and w scalar part
+	std::vector<uint32_t> mesh;           // index into SceneGeometry::meshes
+	std::vector<glm::vec4> bounds;        // the mesh bounds after the transform
+
+	size_t size() const { return mesh.size(); }
+
+	void resize(size_t count);
+	void set(size_t index, const SceneMesh& sceneMesh, uint32_t meshIndex, const glm::vec3& position, float scale, const glm::quat& orientation);
+	void add(const SceneMesh& sceneMesh, uint32_t meshIndex, const glm::vec3& position, float scale, const glm::quat& orientation);
+};
+
+// Scatters instanceCount instances over a jittered grid filling a cube of side extent around the origin, each
+// picking one of the meshes at random, rotated at random and scaled so its bounds fill most of its cell.
+// The same seed gives the same scene; the work is spread over the pool when one is given.
+void generateStressScene(const std::vector<SceneMesh>& meshes, size_t instanceCount, float extent, uint32_t seed, SceneInstances& instances, ThreadPool* pool = nullptr);
+
+// Registered meshes, their packed geometry and the instances referring to them.
+struct Scene
+{
+	std::vector<Mesh> meshes;
+	SceneGeometry geometry;
+	SceneInstances instances;
+};
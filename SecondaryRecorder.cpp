@@ -0,0 +1,85 @@
+#include "SecondaryRecorder.h"
+#include "ThreadPool.h"
+
+#include <stdexcept>
+
+void SecondaryRecorder::init(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, uint32_t threadCount)
+{
+	this->device = device;
+	this->threads = threadCount;
+
+	slots.resize(size_t(frameCount) * threadCount);
+
+	for (Slot& slot : slots)
+	{
+		// transient: everything is re-recorded every frame, and reset together with the pool
+		VkCommandPoolCreateInfo poolInfo { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+		VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &slot.pool));
+	}
+}
+
+void SecondaryRecorder::destroy()
+{
+	for (Slot& slot : slots)
+		vkDestroyCommandPool(device, slot.pool, nullptr);
+
+	slots.clear();
+	recorded.clear();
+}
+
+void SecondaryRecorder::beginFrame(uint32_t frameIndex)
+{
+	frame = frameIndex;
+
+	for (uint32_t i = 0; i < threads; ++i)
+	{
+		Slot& slot = slots[size_t(frame) * threads + i];
+
+		VK_CHECK(vkResetCommandPool(device, slot.pool, 0));
+		slot.used = 0;
+	}
+}
+
+const std::vector<VkCommandBuffer>& SecondaryRecorder::record(ThreadPool& pool, const VkCommandBufferInheritanceInfo& inheritance, uint32_t partitionCount, const Body& body)
+{
+	if (partitionCount > threads)
+		throw std::runtime_error("more partitions than recording threads!");
+
+	recorded.resize(partitionCount);
+
+	pool.parallelFor(partitionCount, [&](size_t partition) {
+		Slot& slot = slots[size_t(frame) * threads + partition];
+
+		if (slot.used == slot.buffers.size())
+		{
+			VkCommandBufferAllocateInfo allocInfo { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+			allocInfo.commandPool = slot.pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer));
+
+			slot.buffers.push_back(commandBuffer);
+		}
+
+		VkCommandBuffer commandBuffer = slot.buffers[slot.used++];
+
+		VkCommandBufferBeginInfo beginInfo { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritance;
+
+		VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+		body(commandBuffer, uint32_t(partition));
+
+		VK_CHECK(vkEndCommandBuffer(commandBuffer));
+
+		recorded[partition] = commandBuffer;
+	});
+
+	return recorded;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "onez.h"
+#include <volk.h>
+
+#include <functional>
+#include <vector>
+
+class ThreadPool;
+
+// Secondary command buffers recorded in parallel, from a command pool per frame in flight and recording thread.
+// Partition i of a record() call only ever touches pool i of the current frame, so no pool is shared between
+// threads and nothing is locked. A frame's pools are reset as a whole in beginFrame, which is only safe once
+// the frame that last used them has completed on the GPU.
+class SecondaryRecorder final
+{
+public:
+	void init(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, uint32_t threadCount);
+	void destroy();
+
+	uint32_t threadCount() const { return threads; }
+
+	void beginFrame(uint32_t frameIndex);
+
+	// Records partitionCount secondary command buffers, at most threadCount, that continue the render pass or the
+	// dynamic rendering (VkCommandBufferInheritanceRenderingInfo) described by inheritance; body(commandBuffer,
+	// partition) fills each one. They are returned in partition order and
+	// stay valid until the frame's pools are reset.
+	using Body = std::function<void(VkCommandBuffer commandBuffer, uint32_t partition)>;
+	const std::vector<VkCommandBuffer>& record(ThreadPool& pool, const VkCommandBufferInheritanceInfo& inheritance, uint32_t partitionCount, const Body& body);
+
+private:
+	struct Slot
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> buffers; // allocated so far, reused after every reset
+		uint32_t used = 0;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t threads = 0;
+	uint32_t frame = 0;
+
+	std::vector<Slot> slots; // threadCount per frame, frame after frame
+	std::vector<VkCommandBuffer> recorded;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads. threadCount includes the calling thread, which takes part in parallelFor,
+// so a pool of 1 has no workers and runs everything inline.
+class ThreadPool final
+{
+public:
+	explicit ThreadPool(uint32_t threadCount = 0)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+		for (uint32_t i = 1; i < threadCount; ++i)
+		{
+			workers.emplace_back([this]() {
+				for (;;)
+				{
+					std::function<void()> job;
+
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+						if (stopping && jobs.empty())
+							return;
+
+						job = std::move(jobs.front());
+						jobs.pop();
+					}
+
+					job();
+				}
+			});
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		condition.notify_all();
+
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t size() const { return uint32_t(workers.size()) + 1; }
+
+	template<typename F>
+	auto submit(F&& f) -> std::future<std::invoke_result_t<F>>
+	{
+		using Result = std::invoke_result_t<F>;
+
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+		auto future = task->get_future();
+
+		if (workers.empty())
+		{
+			(*task)();
+			return future;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.emplace([task]() { (*task)(); });
+		}
+
+		condition.notify_one();
+		return future;
+	}
+
+	// Calls body(i) for every i in [0, count) and returns once all of them finished.
+	// Safe to call from inside a job: the caller keeps pulling indices itself instead of only waiting.
+	template<typename F>
+	void parallelFor(size_t count, const F& body)
+	{
+		if (count == 0)
+			return;
+
+		struct State
+		{
+			std::atomic<size_t> next {0};
+			std::atomic<size_t> done {0};
+
+			std::mutex mutex;
+			std::condition_variable condition;
+		};
+
+		auto state = std::make_shared<State>();
+
+		// a helper that starts after all indices are taken returns without touching body
+		auto run = [state, count, &body]() {
+			size_t completed = 0;
+
+			for (size_t i = state->next++; i < count; i = state->next++)
+			{
+				body(i);
+				completed++;
+			}
+
+			if (completed && state->done.fetch_add(completed) + completed == count)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->condition.notify_all();
+			}
+		};
+
+		size_t helpers = std::min(count - 1, workers.size());
+
+		if (helpers)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (size_t i = 0; i < helpers; ++i)
+					jobs.emplace(run);
+			}
+
+			condition.notify_all();
+		}
+
+		run();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->condition.wait(lock, [&]() { return state->done == count; });
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+};
@@ -0,0 +1,74 @@
+#include "UniformRing.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void UniformRing::init(VkDevice device, Allocator& allocator, VkDeviceSize alignment, uint32_t frameCount, VkDeviceSize frameCapacity)
+{
+	this->device = device;
+	this->allocator = &allocator;
+	this->alignment = std::max<VkDeviceSize>(alignment, 16);
+	this->frameCapacity = (frameCapacity + this->alignment - 1) / this->alignment * this->alignment;
+
+	VkBufferCreateInfo bufferInfo { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.size = this->frameCapacity * frameCount;
+	bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VK_CHECK(vkCreateBuffer(device, &bufferInfo, nullptr, &ringBuffer));
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, ringBuffer, &memRequirements);
+
+	// the shaders read these every draw, so host visible VRAM is preferred, but only with resizable BAR: otherwise it
+	// is a 256 MB window that the rest of the renderer may need more
+	uint32_t memoryType = allocator.findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (memoryType != ~0u)
+	{
+		const VkPhysicalDeviceMemoryProperties& properties = allocator.properties();
+
+		if (properties.memoryHeaps[properties.memoryTypes[memoryType].heapIndex].size <= kSmallBarHeapSize)
+			memoryType = ~0u;
+	}
+
+	if (memoryType == ~0u)
+		memoryType = allocator.findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (memoryType == ~0u)
+		throw std::runtime_error("failed to find host visible memory for uniforms!");
+
+	// a block of its own, sized to the ring rather than a whole allocator block
+	ringMemory = allocator.allocate(memRequirements, memoryType, true, true);
+	VK_CHECK(vkBindBufferMemory(device, ringBuffer, ringMemory.memory, ringMemory.offset));
+}
+
+void UniformRing::destroy()
+{
+	vkDestroyBuffer(device, ringBuffer, nullptr);
+	allocator->free(ringMemory);
+}
+
+void UniformRing::beginFrame(uint32_t frameIndex)
+{
+	frameBegin = frameCapacity * frameIndex;
+	frameOffset = 0;
+}
+
+UniformRange UniformRing::allocate(VkDeviceSize size)
+{
+	VkDeviceSize offset = (frameOffset + alignment - 1) / alignment * alignment;
+
+	if (offset + size > frameCapacity)
+		throw std::runtime_error("uniform ring frame capacity exceeded!");
+
+	frameOffset = offset + size;
+
+	UniformRange range;
+	range.buffer = ringBuffer;
+	range.offset = frameBegin + offset;
+	range.size = size;
+	range.data = static_cast<uint8_t*>(ringMemory.data) + frameBegin + offset;
+
+	return range;
+}
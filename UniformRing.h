@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Allocator.h"
+
+#include <cstring>
+
+struct UniformRange
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+
+	void* data = nullptr;
+};
+
+// One persistently mapped uniform buffer split into a slice per frame in flight. Each frame linearly hands out
+// sub-ranges aligned to minUniformBufferOffsetAlignment, to be bound with push descriptors or dynamic offsets.
+// A slice is only reused once the frame that last wrote it has been waited for.
+class UniformRing final
+{
+public:
+	static constexpr VkDeviceSize kDefaultFrameCapacity = 256 << 10;
+
+	// a host visible device local heap this small is the fixed BAR window, not resizable BAR
+	static constexpr VkDeviceSize kSmallBarHeapSize = 256ull << 20;
+
+	void init(VkDevice device, Allocator& allocator, VkDeviceSize alignment, uint32_t frameCount, VkDeviceSize frameCapacity = kDefaultFrameCapacity);
+	void destroy();
+
+	void beginFrame(uint32_t frameIndex);
+
+	UniformRange allocate(VkDeviceSize size);
+
+	template<typename T>
+	UniformRange push(const T& value)
+	{
+		UniformRange range = allocate(sizeof(T));
+		memcpy(range.data, &value, sizeof(T));
+		return range;
+	}
+
+	VkBuffer buffer() const { return ringBuffer; }
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	Allocator* allocator = nullptr;
+
+	VkBuffer ringBuffer = VK_NULL_HANDLE;
+	Allocation ringMemory;
+
+	VkDeviceSize alignment = 0;
+	VkDeviceSize frameCapacity = 0;
+
+	VkDeviceSize frameBegin = 0;
+	VkDeviceSize frameOffset = 0;
+};
@@ -0,0 +1,423 @@
+#include "Uploader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+static const uint32_t kBatchCount = 4;
+
+void Uploader::init(VkDevice device, Allocator& allocator, VkQueue queue, uint32_t queueFamilyIndex, uint32_t dstQueueFamilyIndex,
+	VkExtent3D imageGranularity, VkDeviceSize capacity)
+{
+	this->device = device;
+	this->allocator = &allocator;
+	this->queue = queue;
+	this->queueFamilyIndex = queueFamilyIndex;
+	this->dstQueueFamilyIndex = dstQueueFamilyIndex;
+	this->imageGranularity = imageGranularity;
+	this->capacity = capacity;
+
+	VkBufferCreateInfo bufferInfo { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.size = capacity;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VK_CHECK(vkCreateBuffer(device, &bufferInfo, nullptr, &ring));
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, ring, &memRequirements);
+
+	uint32_t memoryType = allocator.findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (memoryType == ~0u)
+		throw std::runtime_error("failed to find host visible memory for the staging ring!");
+
+	ringMemory = allocator.allocate(memRequirements, memoryType, true);
+	VK_CHECK(vkBindBufferMemory(device, ring, ringMemory.memory, ringMemory.offset));
+
+	VkCommandPoolCreateInfo poolInfo { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool));
+
+	VkSemaphoreTypeCreateInfo typeInfo { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphoreInfo.pNext = &typeInfo;
+
+	VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore));
+
+	batches.resize(kBatchCount);
+
+	for (uint32_t i = 0; i < kBatchCount; ++i)
+	{
+		VkCommandBufferAllocateInfo allocInfo { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &batches[i].commandBuffer));
+
+		idle.push_back(i);
+	}
+}
+
+void Uploader::destroy()
+{
+	wait();
+
+	batches.clear();
+	idle.clear();
+	handoffs.clear();
+
+	vkDestroySemaphore(device, semaphore, nullptr);
+	vkDestroyCommandPool(device, commandPool, nullptr);
+
+	vkDestroyBuffer(device, ring, nullptr);
+	allocator->free(ringMemory);
+}
+
+VkCommandBuffer Uploader::commandBuffer()
+{
+	if (current != ~0u)
+		return batches[current].commandBuffer;
+
+	if (idle.empty())
+		retireOldest();
+
+	current = idle.back();
+	idle.pop_back();
+
+	Batch& batch = batches[current];
+	batch.bytes = 0;
+	batch.buffers.clear();
+	batch.images.clear();
+	batch.work.clear();
+
+	VkCommandBufferBeginInfo beginInfo { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VK_CHECK(vkResetCommandBuffer(batch.commandBuffer, 0));
+	VK_CHECK(vkBeginCommandBuffer(batch.commandBuffer, &beginInfo));
+
+	return batch.commandBuffer;
+}
+
+void Uploader::afterAcquire(std::function<void(VkCommandBuffer)> work)
+{
+	commandBuffer();
+
+	batches[current].work.push_back(std::move(work));
+}
+
+void Uploader::flush()
+{
+	if (current == ~0u)
+		return;
+
+	Batch& batch = batches[current];
+
+	if (transfersOwnership())
+	{
+		// release half of the queue family ownership transfer, the consumer records the acquire half
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+
+		for (VkBuffer buffer : batch.buffers)
+		{
+			VkBufferMemoryBarrier barrier { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.srcQueueFamilyIndex = queueFamilyIndex;
+			barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+			barrier.buffer = buffer;
+			barrier.size = VK_WHOLE_SIZE;
+
+			bufferBarriers.push_back(barrier);
+		}
+
+		for (VkImage image : batch.images)
+		{
+			VkImageMemoryBarrier barrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = queueFamilyIndex;
+			barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+			barrier.image = image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+
+			imageBarriers.push_back(barrier);
+		}
+
+		if (!bufferBarriers.empty() || !imageBarriers.empty())
+			vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+				0, nullptr, uint32_t(bufferBarriers.size()), bufferBarriers.data(), uint32_t(imageBarriers.size()), imageBarriers.data());
+	}
+
+	VK_CHECK(vkEndCommandBuffer(batch.commandBuffer));
+
+	batch.value = nextValue++;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &batch.value;
+
+	VkSubmitInfo submitInfo { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &semaphore;
+
+	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+
+	handoffs.push_back({ batch.value, std::move(batch.buffers), std::move(batch.images), std::move(batch.work) });
+
+	pending.push_back(current);
+	current = ~0u;
+
+	submitCount++;
+}
+
+void Uploader::wait()
+{
+	flush();
+
+	while (!pending.empty())
+		retireOldest();
+}
+
+void Uploader::retireOldest()
+{
+	assert(!pending.empty());
+
+	uint32_t index = pending.front();
+	pending.pop_front();
+
+	Batch& batch = batches[index];
+
+	VkSemaphoreWaitInfo waitInfo { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &semaphore;
+	waitInfo.pValues = &batch.value;
+
+	VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+
+	// batches retire in submission order, so their ring space is always at the tail
+	used -= batch.bytes;
+	batch.bytes = 0;
+
+	idle.push_back(index);
+}
+
+uint64_t Uploader::acquire(VkCommandBuffer commandBuffer)
+{
+	if (handoffs.empty())
+		return 0;
+
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+
+	for (auto& handoff : handoffs)
+	{
+		for (VkBuffer buffer : handoff.buffers)
+		{
+			VkBufferMemoryBarrier barrier { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			barrier.srcQueueFamilyIndex = queueFamilyIndex;
+			barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+			barrier.buffer = buffer;
+			barrier.size = VK_WHOLE_SIZE;
+
+			bufferBarriers.push_back(barrier);
+		}
+
+		for (VkImage image : handoff.images)
+		{
+			VkImageMemoryBarrier barrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = queueFamilyIndex;
+			barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+			barrier.image = image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+
+			imageBarriers.push_back(barrier);
+		}
+	}
+
+	if (transfersOwnership())
+	{
+		if (!bufferBarriers.empty() || !imageBarriers.empty())
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+				0, nullptr, uint32_t(bufferBarriers.size()), bufferBarriers.data(), uint32_t(imageBarriers.size()), imageBarriers.data());
+	}
+	else
+	{
+		// same queue family: the semaphore orders execution, a memory barrier makes the copies visible
+		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	uint64_t value = 0;
+
+	for (auto& handoff : handoffs)
+	{
+		for (auto& work : handoff.work)
+			work(commandBuffer);
+
+		value = std::max(value, handoff.value);
+	}
+
+	handoffs.clear();
+
+	return value;
+}
+
+VkDeviceSize Uploader::reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+	assert(size <= capacity);
+
+	commandBuffer();
+
+	for (;;)
+	{
+		// nothing in flight, start over at the beginning instead of wrapping later
+		if (used == 0)
+			head = 0;
+
+		VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+
+		// never split a copy source across the end of the ring, skip the remainder instead
+		if (offset + size > capacity)
+			offset = 0;
+
+		VkDeviceSize padding = offset >= head ? offset - head : capacity - head;
+
+		if (used + padding + size <= capacity)
+		{
+			head = offset + size;
+			used += padding + size;
+			batches[current].bytes += padding + size;
+
+			return offset;
+		}
+
+		// the ring is full of in-flight copies: submit ours so it can complete too, then wait for the oldest batch
+		stallCount++;
+
+		if (pending.empty())
+			flush();
+
+		retireOldest();
+		commandBuffer();
+	}
+}
+
+void Uploader::uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+	uploadBuffer(buffer, offset, size_t(size), 1, [data](void* destination, size_t first, size_t count) {
+		memcpy(destination, static_cast<const uint8_t*>(data) + first, count);
+	});
+}
+
+void Uploader::uploadBuffer(VkBuffer buffer, VkDeviceSize offset, size_t count, size_t stride, const Fill& fill)
+{
+	if (count == 0 || stride == 0)
+		return;
+
+	const size_t chunkElements = std::max(size_t(capacity / 4) / stride, size_t(1));
+
+	for (size_t copied = 0; copied < count; )
+	{
+		size_t elements = std::min(count - copied, chunkElements);
+		VkDeviceSize bytes = VkDeviceSize(elements) * stride;
+		VkDeviceSize source = reserve(bytes, 16);
+
+		fill(static_cast<uint8_t*>(ringMemory.data) + source, copied, elements);
+
+		VkBufferCopy region {};
+		region.srcOffset = source;
+		region.dstOffset = offset + VkDeviceSize(copied) * stride;
+		region.size = bytes;
+
+		vkCmdCopyBuffer(commandBuffer(), ring, buffer, 1, &region);
+
+		copied += elements;
+	}
+
+	// reserve() may have submitted earlier chunks already; the release goes into the batch with the last one,
+	// its barrier covers the earlier submissions on this queue too
+	auto& buffers = batches[current].buffers;
+
+	if (std::find(buffers.begin(), buffers.end(), buffer) == buffers.end())
+		buffers.push_back(buffer);
+
+	uploadedBytes += VkDeviceSize(count) * stride;
+}
+
+void Uploader::uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void* data)
+{
+	if (width == 0 || height == 0)
+		return;
+
+	const VkDeviceSize rowSize = VkDeviceSize(width) * texelSize;
+
+	// queues with a zero granularity (some transfer-only families) can only copy whole mip levels
+	const bool wholeLevel = imageGranularity.width == 0 || imageGranularity.height == 0;
+	const VkDeviceSize chunkSize = wholeLevel ? capacity : capacity / 4;
+	const uint32_t rowAlignment = wholeLevel ? 1 : imageGranularity.height;
+
+	if (rowSize * (wholeLevel ? height : rowAlignment) > chunkSize)
+		throw std::runtime_error("image does not fit into the staging ring!");
+
+	uint32_t rowsPerChunk = wholeLevel ? height : uint32_t(std::min<VkDeviceSize>(chunkSize / rowSize, height));
+
+	// chunk borders have to be multiples of the granularity, the last chunk may end at the image edge
+	if (rowsPerChunk < height)
+		rowsPerChunk -= rowsPerChunk % rowAlignment;
+
+	for (uint32_t row = 0; row < height; row += rowsPerChunk)
+	{
+		uint32_t rows = std::min(rowsPerChunk, height - row);
+		VkDeviceSize bytes = rowSize * rows;
+
+		// 16 is a multiple of every texel size and of the 4 byte copy offset requirement
+		VkDeviceSize source = reserve(bytes, 16);
+
+		memcpy(static_cast<uint8_t*>(ringMemory.data) + source, static_cast<const uint8_t*>(data) + rowSize * row, size_t(bytes));
+
+		VkBufferImageCopy region {};
+		region.bufferOffset = source;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, int32_t(row), 0 };
+		region.imageExtent = { width, rows, 1 };
+
+		vkCmdCopyBufferToImage(commandBuffer(), ring, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+
+	auto& images = batches[current].images;
+
+	if (std::find(images.begin(), images.end(), image) == images.end())
+		images.push_back(image);
+
+	uploadedBytes += rowSize * height;
+}
+
+void Uploader::printStats() const
+{
+	printf("Uploader: %.1f MB in %u submissions, %u stalls on a full ring%s\n", double(uploadedBytes) / 1e6, submitCount, stallCount,
+		transfersOwnership() ? " (dedicated transfer queue)" : "");
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Allocator.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Streams data to device local resources through one persistently mapped staging ring.
+// Copies are batched into a command buffer that is submitted on flush (or when the ring fills up) and signals a
+// timeline semaphore; ring space is reclaimed as that semaphore advances, so neither queue is ever idled.
+//
+// The upload queue may belong to another family than the consuming one. Resources written by a batch are then
+// released to the consumer family, and acquire() records the matching acquire barriers on the consuming queue.
+// Ownership is not transferred back, so each resource is uploaded once, before its first use.
+class Uploader final
+{
+public:
+	static constexpr VkDeviceSize kDefaultCapacity = 32ull << 20;
+
+	void init(VkDevice device, Allocator& allocator, VkQueue queue, uint32_t queueFamilyIndex, uint32_t dstQueueFamilyIndex,
+		VkExtent3D imageGranularity, VkDeviceSize capacity = kDefaultCapacity);
+	void destroy();
+
+	void uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+
+	// Uploads count elements of stride bytes that fill() writes straight into the staging ring, one call per
+	// range of whole elements, instead of producing them in a temporary array first.
+	using Fill = std::function<void(void* destination, size_t first, size_t count)>;
+	void uploadBuffer(VkBuffer buffer, VkDeviceSize offset, size_t count, size_t stride, const Fill& fill);
+
+	// Copies tightly packed texels into mip 0. The whole image must be in TRANSFER_DST_OPTIMAL by then
+	// and is handed over to the consumer in that layout.
+	void uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void* data);
+
+	// The batch being recorded on the upload queue, for layout transitions that have to precede the copies.
+	VkCommandBuffer commandBuffer();
+
+	// Work for the consuming queue that needs the current batch's data (mip generation and the like),
+	// recorded by acquire() right after the batch's acquire barriers.
+	void afterAcquire(std::function<void(VkCommandBuffer)> work);
+
+	// Submits the current batch.
+	void flush();
+	// Blocks until every submitted batch has completed.
+	void wait();
+
+	// Records acquire barriers and afterAcquire work for every batch submitted since the last call into a command
+	// buffer of the consuming queue. Returns the timeline value that submission has to wait for, 0 if none.
+	uint64_t acquire(VkCommandBuffer commandBuffer);
+	VkSemaphore timeline() const { return semaphore; }
+
+	void printStats() const;
+
+private:
+	struct Batch
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkDeviceSize bytes = 0; // ring bytes, including padding, released once value is reached
+		uint64_t value = 0;
+
+		std::vector<VkBuffer> buffers;
+		std::vector<VkImage> images;
+		std::vector<std::function<void(VkCommandBuffer)>> work;
+	};
+
+	struct Handoff
+	{
+		uint64_t value;
+
+		std::vector<VkBuffer> buffers;
+		std::vector<VkImage> images;
+		std::vector<std::function<void(VkCommandBuffer)>> work;
+	};
+
+	VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment);
+	void retireOldest();
+
+	bool transfersOwnership() const { return queueFamilyIndex != dstQueueFamilyIndex; }
+
+	VkDevice device = VK_NULL_HANDLE;
+	Allocator* allocator = nullptr;
+
+	VkQueue queue = VK_NULL_HANDLE;
+	uint32_t queueFamilyIndex = 0;
+	uint32_t dstQueueFamilyIndex = 0;
+	VkExtent3D imageGranularity {};
+
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+
+	VkBuffer ring = VK_NULL_HANDLE;
+	Allocation ringMemory;
+
+	VkDeviceSize capacity = 0;
+	VkDeviceSize head = 0;
+	VkDeviceSize used = 0;
+
+	std::vector<Batch> batches;
+	std::deque<uint32_t> pending; // submitted batches, oldest first
+	std::vector<uint32_t> idle;
+
+	std::vector<Handoff> handoffs; // submitted batches the consumer hasn't acquired yet
+
+	uint32_t current = ~0u;
+	uint64_t nextValue = 1;
+
+	uint64_t uploadedBytes = 0;
+	uint32_t submitCount = 0;
+	uint32_t stallCount = 0;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/gtc/packing.hpp>
+
+// GPU vertex layouts. Mesh::vertices stays in full precision for simplification and meshlet building, the
+// vertex buffer is encoded into one of these at upload. Every member is a scalar array, which has the same
+// offsets in C++ and in std430, and the GLSL side is generated from the same field traits, so the struct and
+// its decode can't drift apart.
+
+enum class PositionEncoding
+{
+	Float32, // as loaded
+	Unorm16, // relative to the bounds of all registered meshes, dequantized with the POSITION_OFFSET/POSITION_SCALE constants
+};
+
+enum class NormalEncoding
+{
+	Oct8,  // octahedral, 2x8 bit snorm
+	Oct16, // octahedral, 2x16 bit snorm
+};
+
+// Box the positions are quantized against, handed to the vertex and mesh stages as specialization constants.
+struct VertexQuantization
+{
+	glm::vec3 offset { 0.0f };
+	glm::vec3 scale { 1.0f };
+};
+
+inline VertexQuantization vertexQuantization(const std::array<glm::vec3, 2>& bounding)
+{
+	VertexQuantization result;
+	result.offset = bounding[0];
+	result.scale = glm::max(bounding[1] - bounding[0], glm::vec3(FLT_MIN));
+
+	return result;
+}
+
+inline VertexQuantization vertexQuantization(const Mesh& mesh)
+{
+	return vertexQuantization(mesh.bounding);
+}
+
+// constant_id of the first of POSITION_OFFSET_X/Y/Z, POSITION_SCALE_X/Y/Z; 0 is SHORT_VERTEX_INDICES
+static const uint32_t kVertexQuantizationConstant = 1;
+
+// Maps the unit sphere onto the [-1, 1] square, the lower hemisphere folded over the diagonals.
+inline glm::vec2 octEncode(glm::vec3 n)
+{
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+
+	if (sum == 0.0f)
+		return glm::vec2(0.0f);
+
+	n /= sum;
+
+	if (n.z >= 0.0f)
+		return glm::vec2(n.x, n.y);
+
+	return glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+inline glm::vec3 octDecode(glm::vec2 e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	float t = std::max(-n.z, 0.0f);
+
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+
+	return glm::normalize(n);
+}
+
+template <PositionEncoding> struct PositionField;
+
+template <> struct PositionField<PositionEncoding::Float32>
+{
+	using Type = float;
+
+	static constexpr const char* name = "float32 position";
+	static constexpr VkFormat format = VK_FORMAT_R32G32B32_SFLOAT;
+
+	static constexpr bool quantized = false;
+	static constexpr const char* glslType = "float";
+	static constexpr const char* glslLoad = "vec3(v.position[0], v.position[1], v.position[2])";
+	static constexpr const char* glslDequantize = "p";
+
+	static Type encode(float value, float, float) { return value; }
+	static float decode(Type value, float, float) { return value; }
+};
+
+template <> struct PositionField<PositionEncoding::Unorm16>
+{
+	using Type = uint16_t;
+
+	static constexpr const char* name = "unorm16 position";
+	static constexpr VkFormat format = VK_FORMAT_R16G16B16_UNORM;
+
+	static constexpr bool quantized = true;
+	static constexpr const char* glslType = "uint16_t";
+	static constexpr const char* glslLoad = "vec3(float(v.position[0]), float(v.position[1]), float(v.position[2])) / 65535.0";
+	static constexpr const char* glslDequantize = "POSITION_OFFSET + p * POSITION_SCALE";
+
+	static Type encode(float value, float offset, float scale)
+	{
+		float unit = std::min(std::max((value - offset) / scale, 0.0f), 1.0f);
+		return Type(unit * 65535.0f + 0.5f);
+	}
+
+	static float decode(Type value, float offset, float scale) { return offset + float(value) / 65535.0f * scale; }
+};
+
+template <NormalEncoding> struct NormalField;
+
+template <> struct NormalField<NormalEncoding::Oct8>
+{
+	using Type = int8_t;
+
+	static constexpr const char* name = "oct8 normal";
+	static constexpr VkFormat format = VK_FORMAT_R8G8_SNORM;
+
+	static constexpr const char* glslType = "int8_t";
+	static constexpr const char* glslLoad = "vec2(float(v.normal[0]), float(v.normal[1])) / 127.0";
+
+	static Type encode(float value) { return Type(std::round(std::min(std::max(value, -1.0f), 1.0f) * 127.0f)); }
+	static float decode(Type value) { return std::max(float(value) / 127.0f, -1.0f); }
+};
+
+template <> struct NormalField<NormalEncoding::Oct16>
+{
+	using Type = int16_t;
+
+	static constexpr const char* name = "oct16 normal";
+	static constexpr VkFormat format = VK_FORMAT_R16G16_SNORM;
+
+	static constexpr const char* glslType = "int16_t";
+	static constexpr const char* glslLoad = "vec2(float(v.normal[0]), float(v.normal[1])) / 32767.0";
+
+	static Type encode(float value) { return Type(std::round(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f)); }
+	static float decode(Type value) { return std::max(float(value) / 32767.0f, -1.0f); }
+};
+
+template <PositionEncoding P, NormalEncoding N>
+struct PackedVertex
+{
+	using Position = PositionField<P>;
+	using Normal = NormalField<N>;
+
+	typename Position::Type position[3];
+	typename Normal::Type normal[2];
+	uint16_t coord[2]; // half floats, copied from Vertex::uv
+
+	static PackedVertex encode(const Vertex& vertex, const VertexQuantization& quantization)
+	{
+		PackedVertex result {};
+
+		for (int i = 0; i < 3; ++i)
+			result.position[i] = Position::encode(vertex.position[i], quantization.offset[i], quantization.scale[i]);
+
+		glm::vec3 normal(glm::unpackHalf1x16(vertex.normal.x), glm::unpackHalf1x16(vertex.normal.y), glm::unpackHalf1x16(vertex.normal.z));
+		glm::vec2 oct = octEncode(normal);
+
+		result.normal[0] = Normal::encode(oct.x);
+		result.normal[1] = Normal::encode(oct.y);
+
+		result.coord[0] = vertex.uv.x;
+		result.coord[1] = vertex.uv.y;
+
+		return result;
+	}
+
+	glm::vec3 decodePosition(const VertexQuantization& quantization) const
+	{
+		return glm::vec3(Position::decode(position[0], quantization.offset.x, quantization.scale.x),
+			Position::decode(position[1], quantization.offset.y, quantization.scale.y),
+			Position::decode(position[2], quantization.offset.z, quantization.scale.z));
+	}
+
+	glm::vec3 decodeNormal() const
+	{
+		return octDecode(glm::vec2(Normal::decode(normal[0]), Normal::decode(normal[1])));
+	}
+
+	static VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(PackedVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	// locations 0..2: position before dequantization, octahedral normal, uv
+	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions {};
+
+		attributeDescriptions[0] = { 0, 0, Position::format, uint32_t(offsetof(PackedVertex, position)) };
+		attributeDescriptions[1] = { 1, 0, Normal::format, uint32_t(offsetof(PackedVertex, normal)) };
+		attributeDescriptions[2] = { 2, 0, VK_FORMAT_R16G16_SFLOAT, uint32_t(offsetof(PackedVertex, coord)) };
+
+		return attributeDescriptions;
+	}
+
+	// struct Vertex and its decode functions, served to the shaders as "vertex.glsl"
+	static std::string glsl()
+	{
+		std::string result = std::string("// generated from PackedVertex in VertexFormat.h: ") + Position::name + ", " + Normal::name + ", half uv\n\n";
+
+		if (Position::quantized)
+		{
+			static const char* axes[] = { "X", "Y", "Z" };
+
+			for (uint32_t i = 0; i < 6; ++i)
+			{
+				result += "layout(constant_id = " + std::to_string(kVertexQuantizationConstant + i) + ") const float POSITION_";
+				result += std::string(i < 3 ? "OFFSET_" : "SCALE_") + axes[i % 3] + (i < 3 ? " = 0.0;\n" : " = 1.0;\n");
+			}
+
+			result += "\nconst vec3 POSITION_OFFSET = vec3(POSITION_OFFSET_X, POSITION_OFFSET_Y, POSITION_OFFSET_Z);\n";
+			result += "const vec3 POSITION_SCALE = vec3(POSITION_SCALE_X, POSITION_SCALE_Y, POSITION_SCALE_Z);\n\n";
+		}
+
+		result += "struct Vertex\n{\n";
+		result += std::string("\t") + Position::glslType + " position[3];\n";
+		result += std::string("\t") + Normal::glslType + " normal[2];\n";
+		result += "\tfloat16_t coord[2];\n";
+		result += "};\n\n";
+
+		result += std::string("vec3 dequantizePosition(vec3 p)\n{\n\treturn ") + Position::glslDequantize + ";\n}\n\n";
+		result += std::string("vec3 vertexPosition(Vertex v)\n{\n\treturn dequantizePosition(") + Position::glslLoad + ");\n}\n\n";
+		result += std::string("vec3 vertexNormal(Vertex v)\n{\n\treturn octDecode(") + Normal::glslLoad + ");\n}\n\n";
+		result += "vec2 vertexCoord(Vertex v)\n{\n\treturn vec2(v.coord[0], v.coord[1]);\n}\n";
+
+		return result;
+	}
+};
+
+// the layout of the vertex buffer, trading precision for bandwidth
+using GpuVertex = PackedVertex<PositionEncoding::Unorm16, NormalEncoding::Oct8>;
+
+static_assert(sizeof(GpuVertex) == 12, "GpuVertex is expected to pack into 12 bytes");
+
+template <typename V>
+std::vector<V> encodeVertices(const Mesh& mesh, const VertexQuantization& quantization)
+{
+	std::vector<V> result(mesh.vertices.size());
+
+	for (size_t i = 0; i < mesh.vertices.size(); ++i)
+		result[i] = V::encode(mesh.vertices[i], quantization);
+
+	return result;
+}
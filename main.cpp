@@ -37,9 +37,6 @@ typedef unsigned int uint;
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
-
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
@@ -51,6 +48,7 @@ typedef unsigned int uint;
 #include <cstdint>
 #include <limits>
 #include <array>
+#include <atomic>
 
 #include <set>
 #include <unordered_set>
@@ -66,6 +64,20 @@ typedef unsigned int uint;
 #include <filesystem>
 
 #include "BuilderSPIRV.h"
+#include "Mesh.h"
+#include "Scene.h"
+#include "VertexFormat.h"
+#include "MeshCache.h"
+#include "PipelineCache.h"
+#include "Allocator.h"
+#include "Uploader.h"
+#include "UniformRing.h"
+#include "FrameGraph.h"
+#include "ObjLoader.h"
+#include "ThreadPool.h"
+#include "SecondaryRecorder.h"
+#include "FrameTimeline.h"
+#include "Bench.h"
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
@@ -73,7 +85,28 @@ const uint32_t HEIGHT = 600;
 const std::string MODEL_PATH = "viking_room/viking_room.obj";
 const std::string TEXTURE_PATH = "viking_room/viking_room.png";
 
-const int MAX_FRAMES_IN_FLIGHT = 3;
+struct LaunchOptions {
+    bool headless = false;      // render into offscreen images, no window/surface/swapchain
+    uint32_t frameCount = 1000; // frames to render before exiting in headless mode
+
+    bool useCache = true;       // read and write cooked assets under cacheDirectory
+    std::filesystem::path cacheDirectory; // defaults to <source root>/cache
+
+    uint32_t threadCount = 0;   // worker threads including the main one, 0 means one per hardware thread
+    uint32_t framesInFlight = 3; // frames the CPU may record ahead of the GPU, each with its own per-frame resources
+
+    bool meshShading = true;    // prefer EXT, then NV mesh shading when the device supports it, vertex pulling otherwise
+    bool occlusionCulling = true; // two pass Hi-Z culling of the clusters, or of the instances when those are culled
+    float lodErrorPixels = 1.0f;  // screen space error a level of detail may introduce before a finer one is picked
+    bool clusterLod = false;      // select a cut of the cluster hierarchy per meshlet instead of one discrete level
+
+    uint32_t sceneInstances = 0;  // 0 draws the model once, otherwise a generated stress scene of that many instances
+    std::vector<std::filesystem::path> sceneMeshes; // OBJ files registered next to the model, the stress scene picks among all
+
+    bool cpuDraws = false;        // cull instances and record a draw for each on the CPU, over secondary command buffers in parallel
+    bool benchRecording = false;  // time the recording of the CPU draws for 1 up to threadCount threads, then exit
+    bool benchVertexFetch = false; // time a vertex fetch pass on the GPU for every PackedVertex layout, then exit
+};
 
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
@@ -105,6 +138,7 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily; // without graphics, uploads fall back to the graphics queue if missing
 
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -117,80 +151,54 @@ struct SwapChainSupportDetails {
     std::vector<VkPresentModeKHR> presentModes;
 };
 
-struct Vertex {
-    glm::vec3 position {};
-    glm::u16vec2 uv {}; 
-    alignas(16) glm::u16vec3 normal {};
-    //glm::u16 dummy[5] = {};
-    //alignas(16) glm::vec2 coord;
-
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription bindingDescription{};
-        bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Vertex);
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-        return bindingDescription;
-    }
-
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, position);
-
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].offset = offsetof(Vertex, uv);
-        attributeDescriptions[1].format = VK_FORMAT_R16G16_SFLOAT; 
-        // It will try to generate 32bit float data from the 16bit float data 
-
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R16G16B16_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, normal);
+struct UniformBufferObject {
+    alignas(16) glm::mat4 model;
+    alignas(16) glm::mat4 view;
+    alignas(16) glm::mat4 proj;
 
-        return attributeDescriptions;
-    }
+    // only read by the culling stages, world space planes with the normal pointing inside
+    alignas(16) glm::vec4 frustum[6];
+    alignas(16) glm::vec4 cameraPosition;
 
-    bool operator==(const Vertex& other) const {
-        return position == other.position && normal == other.normal && uv == other.uv;
-    }
+    // x: first meshlet (cluster) of the selected level of detail, y: their count
+    alignas(16) glm::uvec4 lodRange;
+    // x: pixels per unit at distance 1, y: error threshold in pixels, z: 1 when lodRange covers the cluster hierarchy
+    alignas(16) glm::vec4 lodSelection;
 };
 
-struct Meshlet {
-    uint32_t vertices[64] {};
-    uint8_t indices[126*3] {};
-
-    uint8_t vertexCount {};
-    //uint8_t indexCount {};
-    uint8_t triangleCount;
+// Per frame counters written by the task shader or the cluster culling, emitted and triangles add up both passes.
+struct MeshletCullStats {
+    uint32_t submitted;
+    uint32_t emitted;
+    uint32_t triangles;
 };
 
-struct Mesh {
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    std::vector<Meshlet> meshlets;
-    
-    std::array<glm::vec3, 2> bounding;
+// Push constants of drawcull.comp.glsl.
+struct ClusterCullData {
+    float pyramidWidth;
+    float pyramidHeight;
+    uint32_t late;      // a single pass without occlusion culling runs as a late pass
+    uint32_t occlusion;
 };
 
-namespace std {
-    template<> struct hash<Vertex> {
-        size_t operator()(Vertex const& vertex) const {
-            return ((hash<glm::vec3>()(vertex.position) ^
-                   (hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
-                   (hash<glm::u16vec2>()(vertex.uv) << 1);
-        }
-    };
-}
+// Indirect command and draw parameters of one visible instance on the mesh shading path, see mesh.glsl.
+struct MeshTaskCommand {
+    uint32_t groupCountX; // taskCount for NV
+    uint32_t groupCountY; // firstTask for NV
+    uint32_t groupCountZ;
+    uint32_t instance;
+    uint32_t meshletOffset;
+    uint32_t meshletCount;
+    uint32_t reserved[2];
+};
 
-struct UniformBufferObject {
-    alignas(16) glm::mat4 model;
-    alignas(16) glm::mat4 view;
-    alignas(16) glm::mat4 proj;
+// Push constants of instancecull.comp.glsl.
+struct InstanceCullData {
+    float pyramidWidth;
+    float pyramidHeight;
+    uint32_t late;      // a single pass without occlusion culling runs as a late pass
+    uint32_t occlusion;
+    uint32_t instanceCount;
 };
 
 VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount) 
@@ -207,15 +215,37 @@ VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount)
 
 class HeVK {
 public:
+    explicit HeVK(const LaunchOptions& options = {}) : options(options) {
+
+        if (options.headless) {
+            for (auto it = preparedDeviceExtensions.begin(); it != preparedDeviceExtensions.end(); ) {
+                it = strcmp(*it, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0 ? preparedDeviceExtensions.erase(it) : std::next(it);
+            }
+        }
+    }
+
     void run() {
-        initWindow();
+        if (!options.headless) {
+            initWindow();
+        }
         initVulkan();
-        mainLoop();
+        if (options.benchRecording) {
+            benchRecording();
+        } else if (options.benchVertexFetch) {
+            benchVertexFetch();
+        } else {
+            mainLoop();
+        }
         cleanup();
     }
 
 private:
-    GLFWwindow* window;
+    const LaunchOptions options;
+    const uint32_t framesInFlight {options.framesInFlight};
+
+    ThreadPool threadPool {options.threadCount};
+
+    GLFWwindow* window = nullptr;
 
     VkInstance instance;
     VkSurfaceKHR surface;
@@ -225,11 +255,21 @@ private:
     VkPhysicalDeviceProperties deviceProperties;
     
     VkDevice device;
+    Allocator allocator;
+    Uploader uploader;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
     VkQueryPool queryPool;
 
     bool PUSH_DESCRIPTOR_SUPPORTED = false;
     bool MESH_SHADERING_SUPPORTED = false;
 
+    enum class MeshShadingPath { None, NV, EXT };
+    MeshShadingPath meshShadingPath = MeshShadingPath::None;
+
+    // extensions seen on the device being checked, the path is picked once a device is chosen
+    bool meshShaderNVAvailable = false;
+    bool meshShaderEXTAvailable = false;
+
     std::set<const char*> preparedDeviceExtensions { deviceExtensions.begin(), deviceExtensions.end() };
     //= std::unordered_set<std::string>(deviceExtensions.begin(), deviceExtensions.end());
 
@@ -243,22 +283,12 @@ private:
             } 
         },
         #if VertexPulling
-        {   VK_NV_MESH_SHADER_EXTENSION_NAME, [&]() { if (!MeshShading) return;
-                MESH_SHADERING_SUPPORTED = true;
-                preparedDeviceExtensions.insert(VK_NV_MESH_SHADER_EXTENSION_NAME);
-
-                meshShaderDraw = [&](VkCommandBuffer& commandBuffer) {
-                    vkCmdDrawMeshTasksNV(commandBuffer, defaultMesh.meshlets.size(), 0);
-                };
+        {   VK_NV_MESH_SHADER_EXTENSION_NAME, [&]() {
+                meshShaderNVAvailable = true;
             } 
         },
-        {   VK_EXT_MESH_SHADER_EXTENSION_NAME, [&]() { if (!MeshShading) return;
-                MESH_SHADERING_SUPPORTED = true;
-                preparedDeviceExtensions.insert(VK_EXT_MESH_SHADER_EXTENSION_NAME);
-
-                meshShaderDraw = [&](VkCommandBuffer& commandBuffer) {
-                    vkCmdDrawMeshTasksEXT(commandBuffer, defaultMesh.meshlets.size(), 1, 1);
-                };
+        {   VK_EXT_MESH_SHADER_EXTENSION_NAME, [&]() {
+                meshShaderEXTAvailable = true;
             } 
         }
         #endif
@@ -266,33 +296,122 @@ private:
 
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    VkQueue transferQueue;
+    uint32_t transferFamily = 0;
 
-    VkSwapchainKHR swapChain;
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> swapChainImages;
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
     std::vector<VkImageView> swapChainImageViews;
-    std::vector<VkFramebuffer> swapChainFramebuffers;
+    std::vector<Allocation> offscreenImagesMemory;
 
-    VkRenderPass renderPass;
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
 
     VkCommandPool commandPool;
 
-    Mesh defaultMesh;
+    // the CPU draws are split over one secondary command buffer per recording thread
+    bool cpuDraws = false;
+    SecondaryRecorder secondaryRecorder;
+    double recordTimeCPU = 0; // of the last frame's command buffers, in ms
+
+    // registered meshes packed into the shared vertex, index and meshlet buffers, and the instances drawing them
+    Scene scene;
+
+    Mesh& defaultMesh() { return scene.meshes.front(); }
+    const Mesh& defaultMesh() const { return scene.meshes.front(); }
 
     VkBuffer vertexBuffer {};
-    VkDeviceMemory vertexBufferMemory;
+    Allocation vertexBufferMemory;
     VkBuffer indexBuffer {};
-    VkDeviceMemory indexBufferMemory;
+    Allocation indexBufferMemory;
 
     VkBuffer meshletsBuffer {}; 
-    VkDeviceMemory meshletsBufferMemory;
-
-    std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
+    Allocation meshletsBufferMemory;
+    VkBuffer meshletDataBuffer {};
+    Allocation meshletDataBufferMemory;
+
+    // MeshletLod per meshlet (cluster), read by both paths to pick the cut of the cluster hierarchy
+    VkBuffer meshletLodBuffer {};
+    Allocation meshletLodBufferMemory;
+
+    // vertex pulling path: clusters are culled by compute into indirect draws over a cluster ordered index buffer
+    uint32_t clusterCount = 0;
+    VkBuffer clusterBuffer {};
+    Allocation clusterBufferMemory;
+    VkBuffer drawCommandBuffer {};
+    Allocation drawCommandBufferMemory;
+    VkBuffer drawCountBuffer {};
+    Allocation drawCountBufferMemory;
+
+    _Program cullProgram {};
+    VkPipeline cullPipeline = VK_NULL_HANDLE;
+
+    // instances are frustum culled by compute into one draw each, which picks its level of detail; always on for
+    // the mesh shading path, the vertex pulling path only leaves the cluster culling for a generated scene, and
+    // neither is used when cpuDraws culls the instances while recording
+    bool instanceCulling = false;
+
+    VkBuffer sceneMeshBuffer {};
+    Allocation sceneMeshBufferMemory;
+    VkBuffer dagLevelBuffer {};
+    Allocation dagLevelBufferMemory;
+    VkBuffer instancePositionScaleBuffer {};
+    Allocation instancePositionScaleBufferMemory;
+    VkBuffer instanceRotationBuffer {};
+    Allocation instanceRotationBufferMemory;
+    VkBuffer instanceMeshBuffer {};
+    Allocation instanceMeshBufferMemory;
+    VkBuffer instanceBoundsBuffer {};
+    Allocation instanceBoundsBufferMemory;
+
+    // MeshTaskCommand or VkDrawIndexedIndirectCommand per visible instance, and their count
+    VkBuffer instanceDrawBuffer {};
+    Allocation instanceDrawBufferMemory;
+    VkBuffer instanceDrawCountBuffer {};
+    Allocation instanceDrawCountBufferMemory;
+
+    _Program instanceCullProgram {};
+    VkPipeline instanceCullPipeline = VK_NULL_HANDLE;
+
+    // without push descriptors every compute dispatch allocates its set from the frame's pool, reset once the
+    // frame's timeline value has been reached
+    std::vector<VkDescriptorPool> computeDescriptorPools;
+
+    // two pass occlusion culling: the clusters (or instances) visible last frame are drawn first, the depth pyramid
+    // is reduced from their depth, then the rest is tested against it and drawn by the late scene pass on top
+    bool occlusionCulling = false;
+
+    VkBuffer visibilityBuffer {};
+    Allocation visibilityBufferMemory;
+    VkBuffer instanceVisibilityBuffer {};
+    Allocation instanceVisibilityBufferMemory;
+
+    VkImage depthPyramid = VK_NULL_HANDLE;
+    Allocation depthPyramidMemory;
+    VkImageView depthPyramidView = VK_NULL_HANDLE;
+    std::vector<VkImageView> depthPyramidMips;
+    uint32_t depthPyramidWidth = 0;
+    uint32_t depthPyramidHeight = 0;
+    uint32_t depthPyramidLevels = 0;
+
+    // farthest sample of the depth attachment, only needed with MSAA; a transient of the frame graph
+    VkImage depthResolved = VK_NULL_HANDLE;
+    VkImageView depthResolvedView = VK_NULL_HANDLE;
+
+    VkSampler depthReductionSampler = VK_NULL_HANDLE;
+    _Program depthReduceProgram {};
+    VkPipeline depthReducePipeline = VK_NULL_HANDLE;
+    _Program depthResolveProgram {};
+    VkPipeline depthResolvePipeline = VK_NULL_HANDLE;
+
+    // scales the mesh bounds into a unit-ish cube around the origin, fixed once the model is loaded
+    glm::mat4 meshTransform {1.0f};
+
+    UniformRing uniformRing;
+    UniformRange frameUniforms;
 
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
     std::vector<VkDescriptorSet> descriptorSets;
@@ -300,26 +419,44 @@ private:
 
     uint32_t mipLevels;
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+    Allocation textureImageMemory;
 
     VkImageView textureImageView;
     VkSampler textureSampler;
 
+    // the passes of a frame and what they touch, rebuilt with the swapchain; owns the attachments below
+    FrameGraph frameGraph;
+    FrameResource swapchainResource = 0; // rebound to the acquired image every frame
+    uint32_t frameImageIndex = 0; // swapchain image the scene passes of the frame being recorded draw into
+
     VkImage depthImage;
     VkImageView depthImageView;
-    VkDeviceMemory depthImageMemory;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    VkImageAspectFlags depthAspectMask = VK_IMAGE_ASPECT_DEPTH_BIT; // both aspects for layout transitions of combined formats
 
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
     VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
     VkImageView colorImageView;
     
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
+    FrameTimeline frameTimeline;
     uint32_t currentFrame = 0;
 
+    double frameTimeGPU = -1.0; // of the last frame that used the current slot, in ms
+
+    VkBuffer cullStatsBuffer {};
+    Allocation cullStatsBufferMemory;
+    MeshletCullStats cullStats {}; // of the last frame that used the current slot
+
+    uint32_t currentLod = 0; // picked per frame in updateUniformBuffer
+    MeshLod dagWindow {};    // the hierarchy levels the cluster culling walks, also picked there
+    UniformBufferObject frameConstants {}; // what updateUniformBuffer pushed last, the CPU draws cull against it
+
+    VertexQuantization positionQuantization; // the vertex buffer holds GpuVertex, positions relative to the scene geometry bounds
+    bool clusterLodActive = false; // options.clusterLod and every registered mesh has a hierarchy
+
     bool framebufferResized = false;
 
     void initWindow() {
@@ -339,11 +476,17 @@ private:
 
     VkDescriptorUpdateTemplate updateTemplate = VK_NULL_HANDLE;
 
+    std::filesystem::path cacheDirectory;
+
     void initVulkan() {
 
         auto file_path = std::filesystem::path(__FILE__);
         auto root_path = file_path.parent_path();
 
+        cacheDirectory = options.cacheDirectory.empty() ? root_path / "cache" : options.cacheDirectory;
+        setShaderCacheDirectory(options.useCache ? cacheDirectory / "shaders" : std::filesystem::path());
+        setShaderInclude("vertex.glsl", GpuVertex::glsl());
+
         VK_CHECK(volkInitialize());
 
         createInstance();
@@ -351,136 +494,183 @@ private:
         volkLoadInstance(instance);
 
         setupDebugMessenger();
-        createSurface();
+        if (!options.headless) {
+            createSurface();
+        }
         pickPhysicalDevice();
         createLogicalDevice();
-        createSwapChain();
+
+        allocator.init(device, physicalDevice);
+        {
+            uint32_t queueFamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+            std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+            uploader.init(device, allocator, transferQueue, transferFamily, findQueueFamilies(physicalDevice).graphicsFamily.value(),
+                queueFamilies[transferFamily].minImageTransferGranularity);
+        }
+        pipelineCache = loadPipelineCache(device, deviceProperties, options.useCache ? pipelineCachePath(cacheDirectory, deviceProperties) : std::filesystem::path());
+        if (options.headless) {
+            createOffscreenImages();
+        } else {
+            createSwapChain();
+        }
         createImageViews();
-        createRenderPass();
+
+        cpuDraws = options.cpuDraws && !MESH_SHADERING_SUPPORTED;
+        instanceCulling = !cpuDraws && (MESH_SHADERING_SUPPORTED || options.sceneInstances > 0);
+
+        // the pyramid is tested per instance where those are culled, including the mesh shading path, and per
+        // cluster otherwise; the CPU draws only cull against the frustum
+        occlusionCulling = options.occlusionCulling && !cpuDraws;
+        printf("Occlusion culling: %s\n", occlusionCulling ? instanceCulling ? "two pass Hi-Z per instance" : "two pass Hi-Z per cluster" : "off");
+
+        // the pipeline renders into these formats, whatever images the passes attach
+        depthFormat = findDepthFormat();
 
         createDescriptorSetLayout();
         createPipelinelayout();
 
         updateTemplate = createUpdateTemplate(device, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout);
 
+        // the mesh shader is specialized on the meshlet index width, so the scene has to be known first
+        loadScene(root_path);
+        updateMeshTransform();
+
+        positionQuantization = vertexQuantization(scene.geometry.bounding);
+
+        printf("LODs:");
+        for (const auto& lod : defaultMesh().lods) {
+            printf(" %u", lod.indexCount / 3);
+        }
+        printf(" triangles\n");
+
+        if (defaultMesh().clusterDag.meshletCount > 0) {
+            printf("Cluster hierarchy: %u meshlets in %zu levels, root error %g\n", defaultMesh().clusterDag.meshletCount, defaultMesh().clusterDagLevels.size(),
+                defaultMesh().clusterDag.error);
+        }
+
         createGraphicsPipeline(root_path);
 
+        if (!MESH_SHADERING_SUPPORTED) {
+            createCullPipeline(root_path);
+        }
+
+        if (instanceCulling) {
+            createInstanceCullPipeline(root_path);
+        }
+
+        if (!cpuDraws) {
+            createDepthPyramidPipelines(root_path);
+        }
+
         queryPool = createQueryPool(device, 128); 
         assert(queryPool);
 
         createCommandPool();
 
-        createColorResources();
-        createDepthResources();
+        if (cpuDraws) {
+            secondaryRecorder.init(device, findQueueFamilies(physicalDevice).graphicsFamily.value(), framesInFlight, threadPool.size());
+            printf("Draw recording: %u threads, a secondary command buffer each\n", secondaryRecorder.threadCount());
+        }
 
-        createFramebuffers();
         createTextureImage(root_path);
         createTextureImageView();
         createTextureSampler();
 
-        loadModel(root_path);
-
         createVertexBuffer();
 
+        clusterLodActive = options.clusterLod && std::all_of(scene.geometry.meshes.begin(), scene.geometry.meshes.end(),
+            [](const SceneMesh& mesh) { return mesh.dagMeshletCount > 0; });
+
+        createMeshletLodBuffer();
+
         if (MESH_SHADERING_SUPPORTED) {
-            buildMeshlets();
             buildMeshletsBuffer();
         } else {
-            createIndexBuffer();
-        }
-
-        createUniformBuffers();
-
-        if (!PUSH_DESCRIPTOR_SUPPORTED) {
-            createDescriptorPool();
-            createDescriptorSets();
+            createClusterBuffers();
         }
 
-        createCommandBuffers();
-        createSyncObjects();
-    }
+        createSceneBuffers();
 
-    void buildMeshlets() {
-        
-        auto& mesh = defaultMesh; Meshlet meshlet = {};
+        // read back and cleared on the CPU once the frame's timeline value has been reached
+        createBuffer(sizeof(MeshletCullStats) * framesInFlight, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullStatsBuffer, cullStatsBufferMemory);
+        memset(cullStatsBufferMemory.data, 0, sizeof(MeshletCullStats) * framesInFlight);
 
-        std::vector<uint8_t> meshletVertices(mesh.vertices.size(), 0xff);
+        // the graph imports every buffer the passes hand over to each other, so it comes last
+        frameGraph.init(device, allocator);
 
-        for (size_t i = 0; i < mesh.indices.size(); i += 3)
-        {
-            unsigned int a = mesh.indices[i + 0];
-            unsigned int b = mesh.indices[i + 1];
-            unsigned int c = mesh.indices[i + 2];
+#ifndef NDEBUG
+        FrameGraph::selfCheck(device, allocator);
+#endif
 
-            uint8_t& av = meshletVertices[a];
-            uint8_t& bv = meshletVertices[b];
-            uint8_t& cv = meshletVertices[c];
+        createDepthResources();
+        createFrameGraph();
 
-            if (meshlet.vertexCount + (av == 0xff) + (bv == 0xff) + (cv == 0xff) > 64 || meshlet.triangleCount > 126)
-            {
-                mesh.meshlets.push_back(meshlet);
+        frameGraph.printStats();
 
-                for (size_t j = 0; j < meshlet.vertexCount; ++j)
-                    meshletVertices[meshlet.vertices[j]] = 0xff;
+        uniformRing.init(device, allocator, deviceProperties.limits.minUniformBufferOffsetAlignment, framesInFlight);
 
-                meshlet = {};
-            }
+        if (!PUSH_DESCRIPTOR_SUPPORTED) {
+            createDescriptorPool();
+            createDescriptorSets();
+            createComputeDescriptorPools();
+        }
 
-            if (av == 0xff)
-            {
-                av = meshlet.vertexCount;
-                meshlet.vertices[meshlet.vertexCount++] = a;
-            }
+        createCommandBuffers();
+        createSyncObjects();
 
-            if (bv == 0xff)
-            {
-                bv = meshlet.vertexCount;
-                meshlet.vertices[meshlet.vertexCount++] = b;
-            }
+        uploader.flush();
+        uploader.printStats();
 
-            if (cv == 0xff)
-            {
-                cv = meshlet.vertexCount;
-                meshlet.vertices[meshlet.vertexCount++] = c;
-            }
+        auto memoryStats = allocator.stats();
+        printf("Memory: %u allocations in %u blocks, %.1f of %.1f MB used, %u free ranges, fragmentation %.2f\n",
+            memoryStats.allocationCount, memoryStats.blockCount, double(memoryStats.usedBytes) / 1e6, double(memoryStats.reservedBytes) / 1e6,
+            memoryStats.freeRangeCount, memoryStats.fragmentation);
+    }
 
-            meshlet.indices[meshlet.triangleCount*3 + 0] = av;
-            meshlet.indices[meshlet.triangleCount*3 + 1] = bv;
-            meshlet.indices[meshlet.triangleCount*3 + 2] = cv;
-            meshlet.triangleCount++;
-        }
+    void createMeshletLodBuffer() {
+        const auto& meshletLods = scene.geometry.meshletLods;
+        VkDeviceSize bufferSize = meshletLods.size() * sizeof(MeshletLod);
 
-        if (meshlet.triangleCount)
-            mesh.meshlets.push_back(meshlet);
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletLodBuffer, meshletLodBufferMemory);
+        uploader.uploadBuffer(meshletLodBuffer, 0, meshletLods.data(), bufferSize);
     }
 
     void buildMeshletsBuffer() {
         if (!MESH_SHADERING_SUPPORTED) { return; }
 
-        VkDeviceSize bufferSize = defaultMesh.meshlets.size() * sizeof(defaultMesh.meshlets[0]);
+        const SceneGeometry& geometry = scene.geometry;
 
-        VkBuffer stagingBuffer; VkDeviceMemory stagingBufferMemory;
+        VkDeviceSize bufferSize = geometry.meshlets.size() * sizeof(geometry.meshlets[0]);
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletsBuffer, meshletsBufferMemory);
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, defaultMesh.meshlets.data(), (size_t)bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+        uploader.uploadBuffer(meshletsBuffer, 0, geometry.meshlets.data(), bufferSize);
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletsBuffer, meshletsBufferMemory);
+        VkDeviceSize dataSize = geometry.meshletData.size() * sizeof(geometry.meshletData[0]);
 
-        copyBuffer(stagingBuffer, meshletsBuffer, bufferSize);
+        createBuffer(dataSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletDataBuffer, meshletDataBufferMemory);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
-    }
+        uploader.uploadBuffer(meshletDataBuffer, 0, geometry.meshletData.data(), dataSize);
+
+        size_t packedBytes = 0, fixedBytes = 0, indexCount = 0;
 
-    void createColorResources() {
-        VkFormat colorFormat = swapChainImageFormat;
+        for (const Mesh& mesh : scene.meshes) {
+            size_t meshPacked = 0, meshFixed = 0;
+            meshletFootprint(mesh, meshPacked, meshFixed);
 
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
-        colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+            packedBytes += meshPacked;
+            fixedBytes += meshFixed;
+            indexCount += mesh.indices.size();
+        }
+
+        double triangles = double(std::max<size_t>(indexCount / 3, 1));
+        printf("Meshlets: %zu, %.1f KB (%.2f bytes/triangle, fixed layout %.2f bytes/triangle), %s vertex indices\n",
+            geometry.meshlets.size(), double(packedBytes) / 1e3, packedBytes / triangles, fixedBytes / triangles,
+            geometry.shortVertexIndices ? "16-bit" : "32-bit");
     }
 
     VkSampleCountFlagBits getMaxUsableSampleCount() {
@@ -517,114 +707,146 @@ private:
         return fltInt16;
     }
 
-    void loadModel(const std::filesystem::path& root_path) {
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string warn, err;
+    // Registers the model and options.sceneMeshes, packs their geometry and places the instances: the model once,
+    // untransformed, or the generated stress scene.
+    void loadScene(const std::filesystem::path& root_path) {
+        scene.meshes.resize(1 + options.sceneMeshes.size());
 
-        auto model_path = root_path / "assets/bunny.obj";
- 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.string().c_str())) {
-            throw std::runtime_error(warn + err);
+        loadModel(root_path / "assets/bunny.obj", scene.meshes[0]);
+
+        for (size_t i = 0; i < options.sceneMeshes.size(); ++i) {
+            loadModel(options.sceneMeshes[i], scene.meshes[i + 1]);
         }
 
-        glm::vec3 minVertex = glm::vec3(FLT_MAX);
-        glm::vec3 maxVertex = -minVertex;
+        for (Mesh& mesh : scene.meshes) {
+            if (mesh.meshletArray().empty()) {
+                buildMeshlets(mesh);
+                buildClusterDag(mesh);
+            }
+        }
 
-        std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+        packSceneGeometry(scene.meshes, scene.geometry);
 
-        std::vector<Vertex> vertices;
-        std::vector<uint32_t> indices;
+        auto generateBegin = std::chrono::high_resolution_clock::now();
 
-        float scale = 1.0f;
+        if (options.sceneInstances > 0) {
+            generateStressScene(scene.geometry.meshes, options.sceneInstances, 2.0f, 1, scene.instances, &threadPool);
+        } else {
+            scene.instances.add(scene.geometry.meshes[0], 0, glm::vec3(0.0f), 1.0f, glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+        }
 
-        for (const auto& shape : shapes) {
-            for (const auto& index : shape.mesh.indices) {
-                Vertex vertex{};
-                vertex.position = {
-                    attrib.vertices[3 * index.vertex_index + 0]*scale,
-                    attrib.vertices[3 * index.vertex_index + 1]*scale,
-                    attrib.vertices[3 * index.vertex_index + 2]*scale
-                };
+        auto generateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - generateBegin).count();
 
-                maxVertex = glm::max(maxVertex, vertex.position);
-                minVertex = glm::min(minVertex, vertex.position);
+        printf("Scene: %zu meshes, %zu instances (placed in %.2f ms), %u vertices, %zu meshlets\n", scene.meshes.size(), scene.instances.size(),
+            generateTime, scene.geometry.vertexCount, scene.geometry.meshlets.size());
+    }
 
-                if (attrib.texcoords.size() > 0) {
+    void loadModel(const std::filesystem::path& model_path, Mesh& result) {
+        auto cooked_path = cookedMeshPath(cacheDirectory, model_path);
 
-                    float _u = attrib.texcoords[2 * index.texcoord_index + 0];
-                    float _v = 1.0f - attrib.texcoords[2 * index.texcoord_index + 1];
+        auto loadBegin = std::chrono::high_resolution_clock::now();
 
-                    // vertex.uv = { 
-                    //     parseFP32toFP16(_u),
-                    //     parseFP32toFP16(_v)
-                    // };
+        uint64_t sourceHash = options.useCache ? hashFile(model_path) : 0;
 
-                    vertex.uv = { 
-                        meshopt_quantizeHalf(_u),
-                        meshopt_quantizeHalf(_v)
-                    };
-                }
+        const CookSettings settings {};
+        CookedMeshStats cookedStats {};
 
-                if (attrib.normals.size() > 0) {
+        if (sourceHash && loadCookedMesh(cooked_path, sourceHash, settings, result, &threadPool, &cookedStats)) {
+            auto loadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loadBegin).count();
+            std::cout << "Loaded cooked mesh " << cooked_path.string() << " in " << loadTime << " ms" << std::endl;
 
-                    float nx = attrib.normals[3 * index.normal_index + 0];
-                    float ny = attrib.normals[3 * index.normal_index + 1];
-                    float nz = attrib.normals[3 * index.normal_index + 2];
+            printf("Decoded %.1f MB of indices from %.1f MB in %.2f ms (%.0f MB/s), the vertices decode as they are staged\n",
+                double(cookedStats.decodedBytes) / 1e6, double(cookedStats.encodedBytes) / 1e6, cookedStats.milliseconds,
+                double(cookedStats.decodedBytes) / 1e3 / std::max(cookedStats.milliseconds, 1e-3));
+            return;
+        }
 
-                    // vertex.normal = {
-                    //     parseFP32toFP16(nx), 
-                    //     parseFP32toFP16(ny), 
-                    //     parseFP32toFP16(nz)
-                    // };
+        if (!loadObj(model_path.string().c_str(), result, &threadPool)) {
+            throw std::runtime_error("failed to load model " + model_path.string());
+        }
 
-                    vertex.normal = {
-                        meshopt_quantizeHalf(nx),
-                        meshopt_quantizeHalf(ny),
-                        meshopt_quantizeHalf(nz)
-                    };
-                }
+        optimizeMesh(result);
+        buildLods(result, settings.lods);
+        buildMeshlets(result, settings.meshlets);
+        buildClusterDag(result, settings.clusterDag, settings.meshlets);
 
-                // if (uniqueVertices.count(vertex) == 0) {
-                //     uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                    vertices.push_back(vertex);
-                // }
+        auto loadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loadBegin).count();
+        std::cout << "Cooked mesh " << model_path.string() << " in " << loadTime << " ms" << std::endl;
 
-                indices.push_back(uniqueVertices[vertex]);
+        if (sourceHash) {
+            if (saveCookedMesh(cooked_path, sourceHash, settings, result, &threadPool, &cookedStats)) {
+                printf("Encoded %.1f MB of vertices and indices into %.1f MB in %.2f ms (%.0f MB/s)\n",
+                    double(cookedStats.decodedBytes) / 1e6, double(cookedStats.encodedBytes) / 1e6, cookedStats.milliseconds,
+                    double(cookedStats.decodedBytes) / 1e3 / std::max(cookedStats.milliseconds, 1e-3));
+            } else {
+                std::cerr << "Failed to write cooked mesh " << cooked_path.string() << std::endl;
             }
         }
+    }
 
-        defaultMesh.bounding[0] = minVertex;
-        defaultMesh.bounding[1] = maxVertex;
+    // The depth attachment itself is a transient of the frame graph, the pyramid is kept from frame to frame.
+    void createDepthResources() {
+        depthAspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencilComponent(depthFormat) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
 
-        defaultMesh.vertices = vertices;
-        defaultMesh.indices = indices;
+        // the culling shaders bind the pyramid even when they run a single pass
+        if (!cpuDraws) {
+            createDepthPyramid();
+        }
+    }
 
-        auto index_count = indices.size();
+    static uint32_t previousPow2(uint32_t value) {
+        uint32_t result = 1;
+        while (result * 2 <= value) {
+            result *= 2;
+        }
+        return result;
+    }
 
-        std::vector<uint32_t> remap(index_count);
-	    size_t vertex_count = meshopt_generateVertexRemap(remap.data(), 0, index_count, vertices.data(), index_count, sizeof(Vertex));
+    void createDepthPyramid() {
+        // a power of two below the screen, so every level halves exactly
+        depthPyramidWidth = previousPow2(swapChainExtent.width);
+        depthPyramidHeight = previousPow2(swapChainExtent.height);
+        depthPyramidLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(depthPyramidWidth, depthPyramidHeight)))) + 1;
 
-        auto& result = defaultMesh;
+        auto usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 
-        result.vertices.resize(vertex_count);
-        result.indices.resize(index_count);
+        createImage(depthPyramidWidth, depthPyramidHeight, depthPyramidLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthPyramid, depthPyramidMemory);
+        depthPyramidView = createImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, depthPyramidLevels);
 
-        meshopt_remapVertexBuffer(result.vertices.data(), vertices.data(), index_count, sizeof(Vertex), remap.data());
-        meshopt_remapIndexBuffer(result.indices.data(), 0, index_count, remap.data());
+        depthPyramidMips.resize(depthPyramidLevels);
+        for (uint32_t i = 0; i < depthPyramidLevels; ++i) {
+            depthPyramidMips[i] = createImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, i);
+        }
 
-        meshopt_optimizeVertexCache(result.indices.data(), result.indices.data(), index_count, vertex_count);
-        meshopt_optimizeVertexFetch(result.vertices.data(), result.indices.data(), index_count, result.vertices.data(), vertex_count, sizeof(Vertex));
+        // no transition here: the frame graph moves it to GENERAL on its first use within a frame, where it stays,
+        // each level is written as a storage image and sampled by the next one or the culling
     }
 
-    void createDepthResources() {
-        VkFormat depthFormat = findDepthFormat();
+    void destroyDepthPyramid(bool deferred = false) {
+        if (VK_NULL_HANDLE == depthPyramid) { return; }
 
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-        
-        transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+        retire(deferred, [this, mips = std::move(depthPyramidMips), view = depthPyramidView, image = depthPyramid, memory = depthPyramidMemory]() mutable {
+            for (auto mip : mips) {
+                vkDestroyImageView(device, mip, nullptr);
+            }
+
+            vkDestroyImageView(device, view, nullptr);
+            vkDestroyImage(device, image, nullptr);
+            allocator.free(memory);
+        });
+
+        depthPyramidMips.clear();
+        depthPyramid = VK_NULL_HANDLE;
+    }
+
+    // Runs destroy right away, or through the frame timeline once the frames in flight are done with what it
+    // destroys, for the resources replaced while frames are still in flight.
+    void retire(bool deferred, std::function<void()> destroy) {
+        if (deferred) {
+            frameTimeline.defer(std::move(destroy));
+        } else {
+            destroy();
+        }
     }
 
     VkFormat findDepthFormat() {
@@ -686,14 +908,14 @@ private:
         }
     }
 
-    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0) {
         VkImageViewCreateInfo viewInfo{};
         viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
         viewInfo.image = image;
         viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
         viewInfo.format = format;
         viewInfo.subresourceRange.aspectMask = aspectFlags;
-        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
         viewInfo.subresourceRange.levelCount = mipLevels;
         viewInfo.subresourceRange.baseArrayLayer = 0;
         viewInfo.subresourceRange.layerCount = 1;
@@ -718,7 +940,7 @@ private:
         textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
     }
 
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageMemory) {
         VkImageCreateInfo imageInfo{};
         imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -742,16 +964,9 @@ private:
         VkMemoryRequirements memRequirements;
         vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
+        imageMemory = allocator.allocate(memRequirements, findMemoryType(memRequirements.memoryTypeBits, properties), tiling == VK_IMAGE_TILING_LINEAR);
 
-        vkBindImageMemory(device, image, imageMemory, 0);
+        vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
     }
 
     void createTextureImage(const std::filesystem::path& root_path) {
@@ -760,7 +975,6 @@ private:
         auto file_path = root_path / TEXTURE_PATH;
 
         stbi_uc* pixels = stbi_load(file_path.string().c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        VkDeviceSize imageSize = texWidth * texHeight * 4;
 
         mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
@@ -768,29 +982,20 @@ private:
             throw std::runtime_error("failed to load texture image!");
         }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-            memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
-
-        stbi_image_free(pixels);
-
         createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
     
-        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-            copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-        generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
+        transitionImageLayout(uploader.commandBuffer(), textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+            uploader.uploadImage(textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 4, pixels);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        // blits need a graphics queue, the mips are generated once the first frame has acquired the image
+        uploader.afterAcquire([this, texWidth, texHeight](VkCommandBuffer commandBuffer) {
+            generateMipmaps(commandBuffer, textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
+        });
+
+        stbi_image_free(pixels);
     }
 
-    void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
+    void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
         // Check if image format supports linear blitting
         VkFormatProperties formatProperties;
         vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
@@ -798,8 +1003,6 @@ private:
         if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
             throw std::runtime_error("texture image format does not support linear blitting!");
         }
-        
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
         VkImageMemoryBarrier imageBarrier{};
         imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -874,45 +1077,9 @@ private:
             0, nullptr,
             0, nullptr,
             1, &imageBarrier);
-
-        endSingleTimeCommands(commandBuffer);
-    }
-
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-
-        region.imageOffset = {0, 0, 0};
-        region.imageExtent = {
-            width,
-            height,
-            1
-        };
-
-        vkCmdCopyBufferToImage(
-            commandBuffer,
-            buffer,
-            image,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &region
-        );
-
-        endSingleTimeCommands(commandBuffer);
     }
 
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
+    void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
         VkImageMemoryBarrier imageBarrier{};
         imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         imageBarrier.oldLayout = oldLayout;
@@ -971,8 +1138,6 @@ private:
             0, nullptr,
             1, &imageBarrier
         );
-
-        endSingleTimeCommands(commandBuffer);
     }
 
     VkCommandBuffer beginSingleTimeCommands() {
@@ -1013,62 +1178,124 @@ private:
         double frameAvgCPU = 0;
         double frameAvgGPU = 0;
 
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+        double frameSumCPU = 0;
+        double frameSumGPU = 0;
+        double recordSumCPU = 0;
+        uint32_t gpuSamples = 0;
 
-            auto frameBeginCPU = glfwGetTime();
+        uint64_t meshletsSubmitted = 0;
+        uint64_t meshletsEmitted = 0;
+        uint64_t trianglesDrawn = 0;
+
+        auto loopBegin = std::chrono::high_resolution_clock::now();
+
+        for (uint32_t frame = 0; options.headless ? frame < options.frameCount : !glfwWindowShouldClose(window); ++frame) {
+            if (!options.headless) {
+                glfwPollEvents();
+            }
+
+            auto frameBeginCPU = std::chrono::high_resolution_clock::now();
                 drawFrame();
-            auto frameEndCPU = glfwGetTime();
+            auto frameEndCPU = std::chrono::high_resolution_clock::now();
 
-            auto frameTimeCPU = frameEndCPU - frameBeginCPU;
-            frameTimeCPU *= 1000;
+            double frameTimeCPU = std::chrono::duration<double, std::milli>(frameEndCPU - frameBeginCPU).count();
+            frameSumCPU += frameTimeCPU;
+            recordSumCPU += recordTimeCPU;
 
-            uint64_t queryResults[2]; 
-            auto frameIndex = (currentFrame + MAX_FRAMES_IN_FLIGHT-1) % MAX_FRAMES_IN_FLIGHT; 
+            frameAvgCPU = frameAvgCPU * 0.95 + frameTimeCPU * 0.05;
 
-            auto result = vkGetQueryPoolResults(device, queryPool, frameIndex*2, ARRAYSIZE(queryResults), sizeof(queryResults), queryResults, sizeof(queryResults[0]), VK_QUERY_RESULT_64_BIT);
-		    VK_CHECK(result); 
+            // the first frames in flight have no completed frame to read the timestamps and counters of yet
+            if (frameTimeGPU >= 0) {
+                frameSumGPU += frameTimeGPU;
+                gpuSamples++;
 
-            if (result != VK_SUCCESS) {
-                continue;
+                meshletsSubmitted += cullStats.submitted;
+                meshletsEmitted += cullStats.emitted;
+                trianglesDrawn += cullStats.triangles;
+
+                frameAvgGPU = frameAvgGPU * 0.95 + frameTimeGPU * 0.05;
             }
 
-            double frameBeginGPU = double(queryResults[0]) * deviceProperties.limits.timestampPeriod * 1e-6; 
-            double frameEndGPU = double(queryResults[1]) * deviceProperties.limits.timestampPeriod * 1e-6; 
+            char lodName[32];
+            if (options.sceneInstances > 0 || cpuDraws) {
+                snprintf(lodName, sizeof(lodName), "per instance");
+            } else if (clusterLodActive) {
+                snprintf(lodName, sizeof(lodName), "dag");
+            } else {
+                snprintf(lodName, sizeof(lodName), "%u/%zu", currentLod, defaultMesh().lods.size());
+            }
 
-            auto frameTimeGPU = frameEndGPU - frameBeginGPU;
+            char buff[192];
+            snprintf(buff, sizeof(buff), "avg cputime %.2f ms, avg gputime %.2f ms, fps %.2f, %u triangles, lod %s, %s %u/%u", 
+                                    frameAvgCPU, frameAvgGPU, 1000/frameTimeCPU, cullStats.triangles, lodName,
+                                    cullItems(), cullStats.emitted, cullStats.submitted);
 
-            frameAvgCPU = frameAvgCPU * 0.95 + frameTimeCPU * 0.05;
-            frameAvgGPU = frameAvgGPU * 0.95 + frameTimeGPU * 0.05;
+            if (options.headless) {
+                if (frame % 100 == 0) {
+                    std::cout << "frame " << frame << ": " << buff << std::endl;
+                }
+            } else {
+                glfwSetWindowTitle(window, buff);
+            }
+        }
+
+        vkDeviceWaitIdle(device);
+
+        if (options.headless) {
+            double loopTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loopBegin).count();
 
-            char buff[128];
-            snprintf(buff, sizeof(buff), "avg cputime %.2f ms, avg gputime %.2f ms, fps %.2f, %llu triangles", 
-                                    frameAvgCPU, frameAvgGPU, 1000/frameTimeCPU, defaultMesh.indices.size()/3);
+            printf("headless: %u frames in %.2f s, cputime %.3f ms, gputime %.3f ms (%u samples), fps %.2f, %llu triangles drawn per frame\n",
+                options.frameCount, loopTime, frameSumCPU / std::max(options.frameCount, 1u), frameSumGPU / std::max(gpuSamples, 1u), 
+                gpuSamples, options.frameCount / loopTime, (unsigned long long)(trianglesDrawn / std::max(gpuSamples, 1u)));
 
-            glfwSetWindowTitle(window, buff);
+            printf("headless: recording %.3f ms per frame on %u threads\n", recordSumCPU / std::max(options.frameCount, 1u),
+                cpuDraws ? secondaryRecorder.threadCount() : 1u);
+
+            printf("headless: %s culling kept %.1f%% of %llu %s per frame\n", MESH_SHADERING_SUPPORTED ? "task" : instanceCulling ? "instance" : cpuDraws ? "CPU instance" : "cluster",
+                100.0 * meshletsEmitted / std::max<uint64_t>(meshletsSubmitted, 1), (unsigned long long)(meshletsSubmitted / std::max(gpuSamples, 1u)),
+                cullItems());
         }
+    }
 
-        vkDeviceWaitIdle(device);
+    // what cullStats counts: meshlets tested by the task stage, instances tested by compute or the CPU draws, or
+    // clusters tested by compute
+    const char* cullItems() const {
+        return MESH_SHADERING_SUPPORTED ? "meshlets" : instanceCulling || cpuDraws ? "instances" : "clusters";
     }
 
-    void cleanupSwapChain() {
-        vkDestroyImageView(device, depthImageView, nullptr);
-        vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+    // Deferred when the swapchain is recreated: the frames in flight may still use all of it, and the old
+    // swapchain handle stays in swapChain for createSwapChain to retire.
+    void cleanupSwapChain(bool deferred = false) {
+        destroyDepthPyramid(deferred);
 
-        vkDestroyImageView(device, colorImageView, nullptr);
-        vkDestroyImage(device, colorImage, nullptr);
-        vkFreeMemory(device, colorImageMemory, nullptr);
+        retire(deferred, [this, depth = depthImageView, color = colorImageView, resolved = depthResolvedView, views = swapChainImageViews] {
+            vkDestroyImageView(device, depth, nullptr);
+            vkDestroyImageView(device, color, nullptr);
+            vkDestroyImageView(device, resolved, nullptr);
 
-        for (auto framebuffer : swapChainFramebuffers) {
-            vkDestroyFramebuffer(device, framebuffer, nullptr);
-        }
+            for (auto imageView : views) {
+                vkDestroyImageView(device, imageView, nullptr);
+            }
+        });
+
+        depthResolvedView = VK_NULL_HANDLE;
 
-        for (auto imageView : swapChainImageViews) {
-            vkDestroyImageView(device, imageView, nullptr);
+        // the attachments are the graph's transients
+        frameGraph.reset(deferred ? &frameTimeline : nullptr);
+
+        if (options.headless) {
+            retire(deferred, [this, images = swapChainImages, memory = offscreenImagesMemory]() mutable {
+                for (size_t i = 0; i < images.size(); i++) {
+                    vkDestroyImage(device, images[i], nullptr);
+                    allocator.free(memory[i]);
+                }
+            });
+            return;
         }
 
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
+        retire(deferred, [this, oldSwapChain = swapChain] {
+            vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+        });
     }
 
     void cleanup() {
@@ -1076,13 +1303,37 @@ private:
 
         vkDestroyPipeline(device, graphicsPipeline, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-        vkDestroyRenderPass(device, renderPass, nullptr);
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+        if (VK_NULL_HANDLE != cullPipeline) {
+            vkDestroyPipeline(device, cullPipeline, nullptr);
+            destroyProgram(device, cullProgram);
+        }
+
+        if (VK_NULL_HANDLE != instanceCullPipeline) {
+            vkDestroyPipeline(device, instanceCullPipeline, nullptr);
+            destroyProgram(device, instanceCullProgram);
+        }
+
+        for (auto pool : computeDescriptorPools) {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+
+        if (VK_NULL_HANDLE != depthReducePipeline) {
+            vkDestroyPipeline(device, depthReducePipeline, nullptr);
+            destroyProgram(device, depthReduceProgram);
+        }
+
+        if (VK_NULL_HANDLE != depthResolvePipeline) {
+            vkDestroyPipeline(device, depthResolvePipeline, nullptr);
+            destroyProgram(device, depthResolveProgram);
+        }
+
+        if (VK_NULL_HANDLE != depthReductionSampler) {
+            vkDestroySampler(device, depthReductionSampler, nullptr);
         }
 
+        uniformRing.destroy();
+
         if (VK_NULL_HANDLE != descriptorPool) {
             vkDestroyDescriptorPool(device, descriptorPool, nullptr);
         }
@@ -1091,42 +1342,104 @@ private:
         vkDestroyImageView(device, textureImageView, nullptr);
 
         vkDestroyImage(device, textureImage, nullptr);
-        vkFreeMemory(device, textureImageMemory, nullptr);
+        allocator.free(textureImageMemory);
 
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
         vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexBufferMemory, nullptr);
+        allocator.free(indexBufferMemory);
+
+        if (VK_NULL_HANDLE != clusterBuffer) {
+            vkDestroyBuffer(device, clusterBuffer, nullptr);
+            allocator.free(clusterBufferMemory);
+
+            vkDestroyBuffer(device, drawCommandBuffer, nullptr);
+            allocator.free(drawCommandBufferMemory);
+
+            vkDestroyBuffer(device, drawCountBuffer, nullptr);
+            allocator.free(drawCountBufferMemory);
+
+            vkDestroyBuffer(device, visibilityBuffer, nullptr);
+            allocator.free(visibilityBufferMemory);
+        }
 
         vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexBufferMemory, nullptr);
+        allocator.free(vertexBufferMemory);
 
         if (VK_NULL_HANDLE != meshletsBuffer) {
             vkDestroyBuffer(device, meshletsBuffer, nullptr);
-            vkFreeMemory(device, meshletsBufferMemory, nullptr);
+            allocator.free(meshletsBufferMemory);
+
+            vkDestroyBuffer(device, meshletDataBuffer, nullptr);
+            allocator.free(meshletDataBufferMemory);
+        }
+
+        vkDestroyBuffer(device, cullStatsBuffer, nullptr);
+        allocator.free(cullStatsBufferMemory);
+
+        vkDestroyBuffer(device, meshletLodBuffer, nullptr);
+        allocator.free(meshletLodBufferMemory);
+
+        vkDestroyBuffer(device, sceneMeshBuffer, nullptr);
+        allocator.free(sceneMeshBufferMemory);
+        vkDestroyBuffer(device, dagLevelBuffer, nullptr);
+        allocator.free(dagLevelBufferMemory);
+        vkDestroyBuffer(device, instancePositionScaleBuffer, nullptr);
+        allocator.free(instancePositionScaleBufferMemory);
+        vkDestroyBuffer(device, instanceRotationBuffer, nullptr);
+        allocator.free(instanceRotationBufferMemory);
+        vkDestroyBuffer(device, instanceMeshBuffer, nullptr);
+        allocator.free(instanceMeshBufferMemory);
+        vkDestroyBuffer(device, instanceBoundsBuffer, nullptr);
+        allocator.free(instanceBoundsBufferMemory);
+
+        if (VK_NULL_HANDLE != instanceDrawBuffer) {
+            vkDestroyBuffer(device, instanceDrawBuffer, nullptr);
+            allocator.free(instanceDrawBufferMemory);
+
+            vkDestroyBuffer(device, instanceDrawCountBuffer, nullptr);
+            allocator.free(instanceDrawCountBufferMemory);
+
+            vkDestroyBuffer(device, instanceVisibilityBuffer, nullptr);
+            allocator.free(instanceVisibilityBufferMemory);
         }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < framesInFlight; i++) {
             vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
             vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(device, inFlightFences[i], nullptr);
+        }
+
+        frameTimeline.destroy();
+
+        if (cpuDraws) {
+            secondaryRecorder.destroy();
         }
 
         vkDestroyCommandPool(device, commandPool, nullptr);
         vkDestroyQueryPool(device, queryPool, 0);
 
+        if (options.useCache && !savePipelineCache(device, pipelineCache, deviceProperties, pipelineCachePath(cacheDirectory, deviceProperties))) {
+            std::cerr << "Failed to write pipeline cache" << std::endl;
+        }
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+        uploader.destroy();
+        allocator.destroy();
         vkDestroyDevice(device, nullptr);
 
         if (enableValidationLayers) {
             DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
         }
 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        if (!options.headless) {
+            vkDestroySurfaceKHR(instance, surface, nullptr);
+        }
         vkDestroyInstance(instance, nullptr);
 
-        glfwDestroyWindow(window);
-
-        glfwTerminate();
+        if (!options.headless) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
     }
 
     void recreateSwapChain() {
@@ -1137,17 +1450,14 @@ private:
             glfwWaitEvents();
         }
 
-        vkDeviceWaitIdle(device);
-
-        cleanupSwapChain();
+        // no idle wait, what the frames in flight still use goes through the timeline's deletion queue
+        cleanupSwapChain(true);
 
         createSwapChain();
         createImageViews();
 
-        createColorResources();
         createDepthResources();
-
-        createFramebuffers();
+        createFrameGraph();
     }
 
     void createInstance() {
@@ -1161,7 +1471,7 @@ private:
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 2, 0);
         appInfo.pEngineName = "onze";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 2, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_2;
+        appInfo.apiVersion = VK_API_VERSION_1_3;
 
         VkInstanceCreateInfo createInstanceInfo{};
         createInstanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -1248,6 +1558,60 @@ private:
         deviceProperties = {}; 
 	    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties); 
 	    bool supportTiming = deviceProperties.limits.timestampComputeAndGraphics;
+
+        selectMeshShadingPath();
+    }
+
+    void selectMeshShadingPath() {
+        meshShadingPath = MeshShadingPath::None;
+
+        // the CPU draws are plain indexed draws, the task stage would need the GPU written commands
+        if (MeshShading && options.meshShading && !options.cpuDraws && (meshShaderEXTAvailable || meshShaderNVAvailable)) {
+            // the extension alone doesn't promise task shaders, ask for the features we actually use
+            VkPhysicalDeviceMeshShaderFeaturesEXT featuresEXT = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+            VkPhysicalDeviceMeshShaderFeaturesNV featuresNV = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_NV };
+
+            VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+            void** next = &features.pNext;
+
+            if (meshShaderEXTAvailable) {
+                *next = &featuresEXT;
+                next = &featuresEXT.pNext;
+            }
+            if (meshShaderNVAvailable) {
+                *next = &featuresNV;
+                next = &featuresNV.pNext;
+            }
+
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+            if (meshShaderEXTAvailable && featuresEXT.taskShader && featuresEXT.meshShader) {
+                meshShadingPath = MeshShadingPath::EXT;
+            } else if (meshShaderNVAvailable && featuresNV.taskShader && featuresNV.meshShader) {
+                meshShadingPath = MeshShadingPath::NV;
+            }
+        }
+
+        MESH_SHADERING_SUPPORTED = meshShadingPath != MeshShadingPath::None;
+
+        if (meshShadingPath == MeshShadingPath::EXT) {
+            preparedDeviceExtensions.insert(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+
+            meshShaderDraw = [&](VkCommandBuffer& commandBuffer) {
+                vkCmdDrawMeshTasksIndirectCountEXT(commandBuffer, instanceDrawBuffer, 0, instanceDrawCountBuffer, 0,
+                    uint32_t(scene.instances.size()), sizeof(MeshTaskCommand));
+            };
+        } else if (meshShadingPath == MeshShadingPath::NV) {
+            preparedDeviceExtensions.insert(VK_NV_MESH_SHADER_EXTENSION_NAME);
+
+            meshShaderDraw = [&](VkCommandBuffer& commandBuffer) {
+                vkCmdDrawMeshTasksIndirectCountNV(commandBuffer, instanceDrawBuffer, 0, instanceDrawCountBuffer, 0,
+                    uint32_t(scene.instances.size()), sizeof(MeshTaskCommand));
+            };
+        }
+
+        const char* pathNames[] = { "vertex pulling", "NV mesh shading", "EXT mesh shading" };
+        std::cout << "Geometry path: " << pathNames[int(meshShadingPath)] << std::endl;
     }
 
     void createLogicalDevice() {
@@ -1256,6 +1620,10 @@ private:
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
 
+        if (indices.transferFamily.has_value()) {
+            uniqueQueueFamilies.insert(indices.transferFamily.value());
+        }
+
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies) {
             VkDeviceQueueCreateInfo queueCreateInfo{};
@@ -1296,6 +1664,7 @@ private:
 
         VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
         features.features.multiDrawIndirect = true;
+        features.features.drawIndirectFirstInstance = true; // the culled draws carry their instance in firstInstance
         features.features.pipelineStatisticsQuery = true;
         features.features.shaderInt16 = true;
         features.features.shaderInt64 = true;
@@ -1318,21 +1687,32 @@ private:
             features12.samplerFilterMinmax = true;
             features12.scalarBlockLayout = true;
             features12.drawIndirectCount = true;
+            features12.timelineSemaphore = true;
+
+        // the scene passes render without render pass objects, and every barrier goes through vkCmdPipelineBarrier2
+        VkPhysicalDeviceVulkan13Features features13 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
+        features13.dynamicRendering = true;
+        features13.synchronization2 = true;
 
         deviceCreateInfo.pNext = &features;
 
         features.pNext = &features11;
         features11.pNext = &features12;
+        features12.pNext = &features13;
 
-        if (MESH_SHADERING_SUPPORTED) {
-            VkPhysicalDeviceMeshShaderFeaturesNV featuresMesh = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_NV };
-            featuresMesh.meshShader = true;
+        VkPhysicalDeviceMeshShaderFeaturesEXT featuresMeshEXT = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+        VkPhysicalDeviceMeshShaderFeaturesNV featuresMeshNV = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_NV };
+
+        if (meshShadingPath == MeshShadingPath::EXT) {
+            featuresMeshEXT.taskShader = true;
+            featuresMeshEXT.meshShader = true;
 
-        // VkPhysicalDeviceMeshShaderFeaturesEXT featuresMesh = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
-	    // featuresMesh.taskShader = true;
-	    // featuresMesh.meshShader = true;
+            features13.pNext = &featuresMeshEXT;
+        } else if (meshShadingPath == MeshShadingPath::NV) {
+            featuresMeshNV.taskShader = true;
+            featuresMeshNV.meshShader = true;
 
-            features12.pNext = &featuresMesh;
+            features13.pNext = &featuresMeshNV;
         }
 
         VK_CHECK (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device)); 
@@ -1342,6 +1722,9 @@ private:
 
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+        transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+        vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
     }
 
     void createSwapChain() {
@@ -1382,6 +1765,7 @@ private:
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         createInfo.presentMode = presentMode;
         createInfo.clipped = VK_TRUE;
+        createInfo.oldSwapchain = swapChain; // the one being recreated, if any, destroyed through the timeline
 
         if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
             throw std::runtime_error("failed to create swap chain!");
@@ -1395,92 +1779,31 @@ private:
         swapChainExtent = extent;
     }
 
-    void createRenderPass() {
-
-        VkAttachmentDescription colorAttachment{};
-        colorAttachment.format = swapChainImageFormat;
-        colorAttachment.samples = msaaSamples;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference colorAttachmentRef{};
-        colorAttachmentRef.attachment = 0;
-        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentDescription depthAttachment{};
-        depthAttachment.format = findDepthFormat();
-        depthAttachment.samples = msaaSamples;
-        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference depthAttachmentRef{};
-        depthAttachmentRef.attachment = 1;
-        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentDescription colorAttachmentResolve{};
-        colorAttachmentResolve.format = swapChainImageFormat;
-        colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-        VkAttachmentReference colorAttachmentResolveRef{};
-        colorAttachmentResolveRef.attachment = 2;
-        colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkSubpassDescription subpass{};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments = &colorAttachmentRef;
-        subpass.pDepthStencilAttachment = &depthAttachmentRef;
-        subpass.pResolveAttachments = &colorAttachmentResolveRef;
-
-        VkSubpassDependency dependency{};
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.dstSubpass = 0;
-        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-        std::vector<VkAttachmentDescription> attachments {colorAttachment, depthAttachment, colorAttachmentResolve};
-
-        VkRenderPassCreateInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-        renderPassInfo.pAttachments = attachments.data();
-        renderPassInfo.subpassCount = 1;
-        renderPassInfo.pSubpasses = &subpass;
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies = &dependency;
-
-        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create render pass!");
+    void createOffscreenImages() {
+        swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        swapChainExtent = { WIDTH, HEIGHT };
+
+        swapChainImages.resize(framesInFlight);
+        offscreenImagesMemory.resize(framesInFlight);
+
+        for (size_t i = 0; i < framesInFlight; i++) {
+            createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImagesMemory[i]);
         }
     }
 
     void createDescriptorSetLayout() {
 
         std::vector<VkDescriptorSetLayoutBinding> bindings;
-        bindings.reserve(4);
+        bindings.reserve(10);
 
         VkDescriptorSetLayoutBinding uboLayoutBinding{};
         uboLayoutBinding.binding = 0;
         uboLayoutBinding.descriptorCount = 1;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        // push descriptor layouts can't hold dynamic descriptors, the offset goes into the pushed range instead
+        uboLayoutBinding.descriptorType = PUSH_DESCRIPTOR_SUPPORTED ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         uboLayoutBinding.pImmutableSamplers = nullptr;
-        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_NV;
+        // the NV stage bits alias the EXT ones, so these cover both mesh shading paths
+        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
 
         bindings.push_back(uboLayoutBinding);
 
@@ -1498,7 +1821,7 @@ private:
             vertexLayoutBinding.descriptorCount = 1;
             vertexLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
             vertexLayoutBinding.pImmutableSamplers = nullptr;
-            vertexLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_NV;
+            vertexLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT;
 
             bindings.push_back(vertexLayoutBinding);
 
@@ -1508,11 +1831,45 @@ private:
                 meshletsLayoutBinding.descriptorCount = 1;
                 meshletsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
                 meshletsLayoutBinding.pImmutableSamplers = nullptr;
-                meshletsLayoutBinding.stageFlags = VK_SHADER_STAGE_MESH_BIT_NV;
+                meshletsLayoutBinding.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
 
                 bindings.push_back(meshletsLayoutBinding);
+
+                VkDescriptorSetLayoutBinding meshletDataLayoutBinding = meshletsLayoutBinding;
+                meshletDataLayoutBinding.binding = 4;
+                meshletDataLayoutBinding.stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT;
+
+                bindings.push_back(meshletDataLayoutBinding);
+
+                VkDescriptorSetLayoutBinding cullStatsLayoutBinding = meshletsLayoutBinding;
+                cullStatsLayoutBinding.binding = 5;
+                cullStatsLayoutBinding.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT;
+
+                bindings.push_back(cullStatsLayoutBinding);
+
+                VkDescriptorSetLayoutBinding meshletLodsLayoutBinding = meshletsLayoutBinding;
+                meshletLodsLayoutBinding.binding = 6;
+                meshletLodsLayoutBinding.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT;
+
+                bindings.push_back(meshletLodsLayoutBinding);
+
+                VkDescriptorSetLayoutBinding taskCommandsLayoutBinding = meshletsLayoutBinding;
+                taskCommandsLayoutBinding.binding = 9;
+                taskCommandsLayoutBinding.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT;
+
+                bindings.push_back(taskCommandsLayoutBinding);
             }
 
+            // the instance table, positionScale and rotation, read wherever vertices get transformed
+            VkDescriptorSetLayoutBinding instanceLayoutBinding = vertexLayoutBinding;
+            instanceLayoutBinding.binding = 7;
+            instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+
+            bindings.push_back(instanceLayoutBinding);
+
+            instanceLayoutBinding.binding = 8;
+            bindings.push_back(instanceLayoutBinding);
+
         VkDescriptorSetLayoutCreateInfo layoutInfo{};
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
         layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -1544,7 +1901,7 @@ private:
         VkDescriptorSetLayout setLayout = descriptorSetLayout; //createSetLayout(device, rtxEnabled);
 
         std::vector<VkDescriptorUpdateTemplateEntry> entries;
-        entries.reserve(4);
+        entries.reserve(10);
 
         VkDescriptorUpdateTemplateEntry ele {}; 
 
@@ -1585,6 +1942,22 @@ private:
             ele.offset = sizeof(DescriptorInfo) * 3;
             ele.stride = sizeof(DescriptorInfo);
             entries.push_back(ele);
+
+            ele.dstBinding = 4;
+            ele.offset = sizeof(DescriptorInfo) * 4;
+            entries.push_back(ele);
+
+            ele.dstBinding = 5;
+            ele.offset = sizeof(DescriptorInfo) * 5;
+            entries.push_back(ele);
+
+            ele.dstBinding = 6;
+            ele.offset = sizeof(DescriptorInfo) * 6;
+            entries.push_back(ele);
+
+            ele.dstBinding = 9;
+            ele.offset = sizeof(DescriptorInfo) * 9;
+            entries.push_back(ele);
         }
         else
         {
@@ -1598,6 +1971,19 @@ private:
             entries.push_back(ele);
         }
 
+        ele = {};
+        ele.dstBinding = 7;
+        ele.dstArrayElement = 0;
+        ele.descriptorCount = 1;
+        ele.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        ele.offset = sizeof(DescriptorInfo) * 7;
+        ele.stride = sizeof(DescriptorInfo);
+        entries.push_back(ele);
+
+        ele.dstBinding = 8;
+        ele.offset = sizeof(DescriptorInfo) * 8;
+        entries.push_back(ele);
+
         VkDescriptorUpdateTemplateCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
 
         createInfo.descriptorUpdateEntryCount = uint32_t(entries.size());
@@ -1622,131 +2008,66 @@ private:
 
         _Shader vertShader {}, fragShader {};
 
-        //_Shader taskShader{}; 
+        _Shader taskShader{}; 
         _Shader meshShader{};
 
-        if (MESH_SHADERING_SUPPORTED) {
-            //loadinShader(taskShader, device, "../shaders/shader.task.glsl");
-            loadinShader(meshShader, device, root_path, "shaders/test.mesh.glsl");
-            loadinShader(fragShader, device, root_path, "shaders/test.frag.glsl");
+        auto shaderBegin = std::chrono::high_resolution_clock::now();
+
+        bool shadersLoaded = false;
+
+        if (meshShadingPath == MeshShadingPath::EXT) {
+            shadersLoaded = loadinShaders(threadPool, device, root_path, {
+                { &taskShader, "shaders/test.ext.task.glsl" },
+                { &meshShader, "shaders/test.ext.mesh.glsl" },
+                { &fragShader, "shaders/test.frag.glsl" },
+            });
+        } else if (meshShadingPath == MeshShadingPath::NV) {
+            shadersLoaded = loadinShaders(threadPool, device, root_path, {
+                { &taskShader, "shaders/test.task.glsl" },
+                { &meshShader, "shaders/test.mesh.glsl" },
+                { &fragShader, "shaders/test.frag.glsl" },
+            });
         } else {
-            loadinShader(vertShader, device, root_path, "shaders/shader.vert");
-            loadinShader(fragShader, device, root_path, "shaders/shader.frag");
+            shadersLoaded = loadinShaders(threadPool, device, root_path, {
+                { &vertShader, "shaders/shader.vert" },
+                { &fragShader, "shaders/shader.frag" },
+            });
         }
 
-        std::vector<VkPipelineShaderStageCreateInfo> shaderStages{}; //= {vertShaderStageInfo, fragShaderStageInfo};
-        shaderStages.reserve(3);
+        if (!shadersLoaded) {
+            throw std::runtime_error("failed to load shaders!");
+        }
 
-        if (MESH_SHADERING_SUPPORTED) {
-            VkPipelineShaderStageCreateInfo meshShaderStageInfo{};
-            meshShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            meshShaderStageInfo.stage = VK_SHADER_STAGE_MESH_BIT_NV; //VK_SHADER_STAGE_MESH_BIT_EXT;
-            meshShaderStageInfo.module = meshShader.vkModule;
-            meshShaderStageInfo.pName = "main";
-            shaderStages.push_back(meshShaderStageInfo);
-        } else {
-            VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-            vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-            vertShaderStageInfo.module = vertShader.vkModule;
-            vertShaderStageInfo.pName = "main";
-            shaderStages.push_back(vertShaderStageInfo);
-        }
-
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragShaderStageInfo.module = fragShader.vkModule;
-        fragShaderStageInfo.pName = "main";
-        shaderStages.push_back(fragShaderStageInfo);
-
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-        VkPipelineViewportStateCreateInfo viewportState{};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.scissorCount = 1;
-
-        VkPipelineRasterizationStateCreateInfo rasterizer{};
-        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizer.depthClampEnable = VK_FALSE;
-        rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_NONE;
-        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-        rasterizer.depthBiasEnable = VK_FALSE;
-
-        VkPipelineMultisampleStateCreateInfo multisampling{};
-        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampling.sampleShadingEnable = VK_FALSE;
-        // multisampling.minSampleShading = .2f;
-        multisampling.rasterizationSamples = msaaSamples;
-
-        VkPipelineDepthStencilStateCreateInfo depthStencil{};
-        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-        depthStencil.depthTestEnable = VK_TRUE;
-        depthStencil.depthWriteEnable = VK_TRUE;
-
-        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-
-        depthStencil.depthBoundsTestEnable = VK_FALSE;
-        depthStencil.minDepthBounds = 0.0f; // Optional
-        depthStencil.maxDepthBounds = 1.0f; // Optional
-
-        depthStencil.stencilTestEnable = VK_FALSE;
-        depthStencil.front = {}; // Optional
-        depthStencil.back = {}; // Optional
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
-
-        VkPipelineColorBlendStateCreateInfo colorBlending{};
-        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlending.logicOpEnable = VK_FALSE;
-        colorBlending.logicOp = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount = 1;
-        colorBlending.pAttachments = &colorBlendAttachment;
-        colorBlending.blendConstants[0] = 0.0f;
-        colorBlending.blendConstants[1] = 0.0f;
-        colorBlending.blendConstants[2] = 0.0f;
-        colorBlending.blendConstants[3] = 0.0f;
-
-        std::vector<VkDynamicState> dynamicStates = {
-            VK_DYNAMIC_STATE_VIEWPORT,
-            VK_DYNAMIC_STATE_SCISSOR
+        {
+            uint32_t hits = 0, misses = 0;
+            getShaderCacheStats(hits, misses);
+
+            auto shaderTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shaderBegin).count();
+            std::cout << "Loaded shaders in " << shaderTime << " ms (cache: " << hits << " hits, " << misses << " misses)" << std::endl;
+        }
+
+        // constant_id 0 in the mesh shader selects 16-bit meshlet vertex indices, the following six dequantize
+        // GpuVertex positions in the mesh or vertex stage
+        static_assert(kVertexQuantizationConstant == 1, "the constants below are listed in id order");
+
+        auto floatBits = [](float value) {
+            int bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return bits;
         };
-        VkPipelineDynamicStateCreateInfo dynamicState{};
-        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-        dynamicState.pDynamicStates = dynamicStates.data();
-
-        VkGraphicsPipelineCreateInfo pipelineInfo{};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
-        pipelineInfo.pStages = shaderStages.data();
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizer;
-        pipelineInfo.pMultisampleState = &multisampling;
-        pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.pDynamicState = &dynamicState;
-        pipelineInfo.layout = pipelineLayout;
-        pipelineInfo.renderPass = renderPass;
-        pipelineInfo.subpass = 0;
-        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-        pipelineInfo.pDepthStencilState = &depthStencil;
+
+        const glm::vec3& offset = positionQuantization.offset;
+        const glm::vec3& scale = positionQuantization.scale;
+
+        _Constants meshConstants = { scene.geometry.shortVertexIndices ? 1 : 0,
+            floatBits(offset.x), floatBits(offset.y), floatBits(offset.z), floatBits(scale.x), floatBits(scale.y), floatBits(scale.z) };
 
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
         #if !VertexPulling         
-            auto bindingDescription = Vertex::getBindingDescription();
-            auto attributeDescriptions = Vertex::getAttributeDescriptions();
+            auto bindingDescription = GpuVertex::getBindingDescription();
+            auto attributeDescriptions = GpuVertex::getAttributeDescriptions();
 
             vertexInputInfo.vertexBindingDescriptionCount = 1;
             vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
@@ -1754,13 +2075,21 @@ private:
             vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
         #endif
 
-        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        VkPipelineRenderingCreateInfo renderingInfo = sceneRenderingInfo();
+
+        auto pipelineBegin = std::chrono::high_resolution_clock::now();
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
+        if (MESH_SHADERING_SUPPORTED) {
+            graphicsPipeline = createGraphicsPipelineVK13(device, pipelineCache, renderingInfo, { &taskShader, &meshShader, &fragShader }, pipelineLayout, meshConstants, msaaSamples);
+        } else {
+            graphicsPipeline = createGraphicsPipelineVK13(device, pipelineCache, renderingInfo, { &vertShader, &fragShader }, pipelineLayout, meshConstants, msaaSamples, &vertexInputInfo);
         }
 
+        auto pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pipelineBegin).count();
+        std::cout << "Created graphics pipeline in " << pipelineTime << " ms" << std::endl;
+
         if (MESH_SHADERING_SUPPORTED) {
+            vkDestroyShaderModule(device, taskShader.vkModule, nullptr);
             vkDestroyShaderModule(device, meshShader.vkModule, nullptr);
         }
 
@@ -1768,28 +2097,178 @@ private:
         vkDestroyShaderModule(device, vertShader.vkModule, nullptr);
     }
 
-    void createFramebuffers() {
-        swapChainFramebuffers.resize(swapChainImageViews.size());
+    // The attachment formats the scene passes render into, which is all the pipeline has to know about them.
+    VkPipelineRenderingCreateInfo sceneRenderingInfo() const {
+        VkPipelineRenderingCreateInfo renderingInfo { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachmentFormats = &swapChainImageFormat;
+        renderingInfo.depthAttachmentFormat = depthFormat;
+        return renderingInfo;
+    }
+
+    // Declares what recordCommandBuffer records, as passes reading and writing the attachments and the buffers they
+    // hand over to each other, in the order they run. The MSAA color and depth attachments and the resolved depth
+    // are transients the graph allocates; their views are made here, once it has.
+    void createFrameGraph() {
+        auto attachmentInfo = [&](VkFormat format, VkSampleCountFlagBits samples, VkImageUsageFlags usage) {
+            VkImageCreateInfo imageInfo { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = format;
+            imageInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = samples;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = usage;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            return imageInfo;
+        };
+
+        VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (occlusionCulling ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+
+        // with a single sample the scene passes draw straight into the swapchain image, otherwise the last one
+        // resolves into it
+        FrameResource color = ~0u;
+
+        if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+            color = frameGraph.createImage("color", attachmentInfo(swapChainImageFormat, msaaSamples, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT), VK_IMAGE_ASPECT_COLOR_BIT);
+        }
+
+        FrameResource depth = frameGraph.createImage("depth", attachmentInfo(depthFormat, msaaSamples, depthUsage), depthAspectMask);
+
+        // rebound to the acquired image by recordCommandBuffer, then handed to the present (or left for a copy) in
+        // the layout it needs
+        swapchainResource = frameGraph.importImage("swapchain", VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+        frameGraph.markOutput(swapchainResource, options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+        const VkPipelineStageFlags2 depthStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+        const VkAccessFlags2 depthAccess = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        // the count is cleared by a transfer before the dispatch appends to it
+        const VkPipelineStageFlags2 countStages = VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        const VkAccessFlags2 countAccess = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+        std::vector<FrameAccess> drawReads;
+
+        // bound by the culling shaders even when nothing reduces into it; moved out of UNDEFINED by its first use
+        FrameResource pyramid = ~0u;
+
+        if (!cpuDraws) {
+            pyramid = frameGraph.importImage("depth pyramid", depthPyramid, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+        }
+
+        const FrameAccess pyramidRead = frameRead(pyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+
+        // what the culling pass touches, pyramid included
+        std::vector<FrameAccess> culling;
+
+        if (instanceCulling) {
+            FrameResource draws = frameGraph.importBuffer("instance draws", instanceDrawBuffer);
+            FrameResource drawCount = frameGraph.importBuffer("instance draw count", instanceDrawCountBuffer);
+            FrameResource visibility = frameGraph.importBuffer("instance visibility", instanceVisibilityBuffer);
 
-        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-            std::vector<VkImageView> attachments {
-                colorImageView,
-                depthImageView,
-                swapChainImageViews[i]
+            culling = {
+                frameWrite(visibility, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT),
+                frameWrite(draws, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT),
+                frameWrite(drawCount, countStages, countAccess),
+                pyramidRead,
             };
 
-            VkFramebufferCreateInfo framebufferInfo{};
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.renderPass = renderPass;
-            framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());;
-            framebufferInfo.pAttachments = attachments.data();
-            framebufferInfo.width = swapChainExtent.width;
-            framebufferInfo.height = swapChainExtent.height;
-            framebufferInfo.layers = 1;
-
-            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
+            frameGraph.addPass("instance culling", culling, [this](VkCommandBuffer commandBuffer) { recordInstanceCulling(commandBuffer, !occlusionCulling); });
+
+            // the task stage reads the commands as well as the indirect draw
+            VkPipelineStageFlags2 taskStage = MESH_SHADERING_SUPPORTED ? VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT : 0;
+
+            drawReads = {
+                frameRead(draws, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | taskStage, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT),
+                frameRead(drawCount, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT),
+            };
+        }
+
+        if (!instanceCulling && !cpuDraws) {
+            FrameResource draws = frameGraph.importBuffer("cluster draws", drawCommandBuffer);
+            FrameResource drawCount = frameGraph.importBuffer("cluster draw count", drawCountBuffer);
+            FrameResource visibility = frameGraph.importBuffer("cluster visibility", visibilityBuffer);
+
+            culling = {
+                frameWrite(visibility, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT),
+                frameWrite(draws, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT),
+                frameWrite(drawCount, countStages, countAccess),
+                pyramidRead,
+            };
+
+            // without occlusion culling this is the only pass, it then draws everything that passes
+            frameGraph.addPass("cluster culling", culling, [this](VkCommandBuffer commandBuffer) { recordClusterCulling(commandBuffer, !occlusionCulling); });
+
+            drawReads = {
+                frameRead(draws, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT),
+                frameRead(drawCount, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT),
+            };
+        }
+
+        // the passes writing the swapchain image: the last one to draw, or both when there's nothing to resolve
+        auto sceneAccesses = [&](bool late) {
+            const VkAccessFlags2 load = late ? VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT : 0;
+            const bool resolves = late || !occlusionCulling;
+
+            std::vector<FrameAccess> accesses = drawReads;
+            accesses.push_back(frameWrite(depth, depthStages, depthAccess, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL));
+
+            if (color != ~0u) {
+                accesses.push_back(frameWrite(color, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | load, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL));
+            }
+
+            if (color == ~0u || resolves) {
+                accesses.push_back(frameWrite(swapchainResource, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | (color == ~0u ? load : 0),
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL));
+            }
+
+            return accesses;
+        };
+
+        frameGraph.addPass("scene", sceneAccesses(false), [this](VkCommandBuffer commandBuffer) { recordScenePass(commandBuffer, false); });
+
+        // reduced from the depth the first scene pass leaves behind, for the late culling to test against
+        FrameResource depthResolve = ~0u;
+
+        if (occlusionCulling) {
+            std::vector<FrameAccess> pyramidPass = {
+                frameRead(depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+                frameWrite(pyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL),
+            };
+
+            if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+                depthResolve = frameGraph.createImage("resolved depth", attachmentInfo(VK_FORMAT_R32_SFLOAT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT), VK_IMAGE_ASPECT_COLOR_BIT);
+                pyramidPass.push_back(frameWrite(depthResolve, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL));
             }
+
+            frameGraph.addPass("depth pyramid", pyramidPass, [this](VkCommandBuffer commandBuffer) { recordDepthPyramid(commandBuffer); });
+
+            frameGraph.addPass(instanceCulling ? "late instance culling" : "late cluster culling", culling, [this](VkCommandBuffer commandBuffer) {
+                if (instanceCulling) {
+                    recordInstanceCulling(commandBuffer, true);
+                } else {
+                    recordClusterCulling(commandBuffer, true);
+                }
+            });
+
+            // continues on what the first pass stored
+            frameGraph.addPass("late scene", sceneAccesses(true), [this](VkCommandBuffer commandBuffer) { recordScenePass(commandBuffer, true); });
+        }
+
+        frameGraph.compile();
+
+        colorImage = color != ~0u ? frameGraph.image(color) : VK_NULL_HANDLE;
+        colorImageView = VK_NULL_HANDLE != colorImage ? createImageView(colorImage, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1) : VK_NULL_HANDLE;
+
+        depthImage = frameGraph.image(depth);
+        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+        depthResolved = depthResolve != ~0u ? frameGraph.image(depthResolve) : VK_NULL_HANDLE;
+
+        if (VK_NULL_HANDLE != depthResolved) {
+            depthResolvedView = createImageView(depthResolved, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
         }
     }
 
@@ -1806,17 +2285,40 @@ private:
         }
     }
 
-    void createVertexBuffer() {
-        VkDeviceSize bufferSize = sizeof(defaultMesh.vertices[0]) * defaultMesh.vertices.size();
+    // Vertices [first, first + count) of the mesh packed as V, in blocks along the cooked chunks so the pool
+    // decodes each of them once per call, a chunk's worth of Vertex at a time.
+    template <typename V>
+    void packVertices(const Mesh& mesh, V* destination, size_t first, size_t count) {
+        const size_t firstBlock = first / kVertexChunkSize;
+        const size_t blockCount = (first + count + kVertexChunkSize - 1) / kVertexChunkSize - firstBlock;
+
+        std::atomic<bool> corrupt {false};
+
+        threadPool.parallelFor(blockCount, [&](size_t block) {
+            size_t begin = std::max(first, (firstBlock + block) * kVertexChunkSize);
+            size_t end = std::min(first + count, (firstBlock + block + 1) * kVertexChunkSize);
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+            std::vector<Vertex> vertices(end - begin);
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, defaultMesh.vertices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+            if (!readVertices(mesh, begin, vertices.size(), vertices.data())) {
+                corrupt = true;
+                return;
+            }
+
+            for (size_t i = 0; i < vertices.size(); ++i) {
+                destination[begin - first + i] = V::encode(vertices[i], positionQuantization);
+            }
+        });
+
+        if (corrupt) {
+            throw std::runtime_error("failed to decode cooked vertices!");
+        }
+    }
+
+    void createVertexBuffer() {
+        size_t vertexCount = scene.geometry.vertexCount;
+
+        VkDeviceSize bufferSize = sizeof(GpuVertex) * vertexCount;
 
         // createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
 
@@ -1824,60 +2326,324 @@ private:
 
         createBuffer(bufferSize, usageFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
 
-        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+        auto encodeBegin = std::chrono::high_resolution_clock::now();
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        // decoded and packed by the pool right into the staging ring, no decoded or packed copy of the whole buffer
+        for (size_t m = 0; m < scene.meshes.size(); ++m) {
+            const Mesh& mesh = scene.meshes[m];
+            VkDeviceSize offset = sizeof(GpuVertex) * scene.geometry.meshes[m].vertexOffset;
+
+            uploader.uploadBuffer(vertexBuffer, offset, mesh.vertexCount(), sizeof(GpuVertex), [&](void* destination, size_t first, size_t count) {
+                packVertices(mesh, static_cast<GpuVertex*>(destination), first, count);
+            });
+        }
+
+        auto encodeTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - encodeBegin).count();
+
+        printf("Vertices: %zu, %.1f KB at %zu bytes each (%.1f KB unpacked), staged in %.2f ms (%.0f MB/s)\n", vertexCount, double(bufferSize) / 1e3,
+            sizeof(GpuVertex), double(sizeof(Vertex) * vertexCount) / 1e3, encodeTime, double(bufferSize) / 1e3 / std::max(encodeTime, 1e-3));
     }
 
-    void createIndexBuffer() {
-        VkDeviceSize bufferSize = sizeof(defaultMesh.indices[0]) * defaultMesh.indices.size();
+    void createClusterBuffers() {
+        const auto& clusterIndices = scene.geometry.clusterIndices;
+        const auto& clusters = scene.geometry.clusters;
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        clusterCount = static_cast<uint32_t>(clusters.size());
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, defaultMesh.indices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+        VkDeviceSize bufferSize = sizeof(clusterIndices[0]) * clusterIndices.size();
 
         createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+        uploader.uploadBuffer(indexBuffer, 0, clusterIndices.data(), bufferSize);
+
+        bufferSize = sizeof(Cluster) * clusters.size();
 
-        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterBuffer, clusterBufferMemory);
+        uploader.uploadBuffer(clusterBuffer, 0, clusters.data(), bufferSize);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        createBuffer(sizeof(VkDrawIndexedIndirectCommand) * clusters.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawCommandBuffer, drawCommandBufferMemory);
+        createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawCountBuffer, drawCountBufferMemory);
+
+        // nothing is visible before the first frame, so its early pass draws nothing and the late pass everything
+        std::vector<uint32_t> visibility(clusters.size(), 0);
+
+        bufferSize = sizeof(visibility[0]) * visibility.size();
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, visibilityBuffer, visibilityBufferMemory);
+        uploader.uploadBuffer(visibilityBuffer, 0, visibility.data(), bufferSize);
+
+        printf("Clusters: %u indirect draws over %zu indices\n", clusterCount, clusterIndices.size());
     }
 
-    void createUniformBuffers() {
-        VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+    // Logs the creation time like createGraphicsPipeline does, a pipeline cache hit shows as a much shorter one.
+    VkPipeline createTimedComputePipeline(const char* name, const _Shader& shader, VkPipelineLayout layout, _Constants constants = {}) {
+        auto pipelineBegin = std::chrono::high_resolution_clock::now();
+
+        VkPipeline pipeline = createComputePipeline(device, pipelineCache, shader, layout, constants);
+
+        auto pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pipelineBegin).count();
+        std::cout << "Created " << name << " pipeline in " << pipelineTime << " ms" << std::endl;
+
+        return pipeline;
+    }
 
-        uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-        uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    void createCullPipeline(const std::filesystem::path& root_path) {
+        _Shader cullShader {};
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+        if (!loadinShaders(threadPool, device, root_path, { { &cullShader, "shaders/drawcull.comp.glsl" } })) {
+            throw std::runtime_error("failed to load the cluster culling shader!");
         }
+
+        cullProgram = createProgram(device, VK_PIPELINE_BIND_POINT_COMPUTE, { &cullShader }, sizeof(ClusterCullData), PUSH_DESCRIPTOR_SUPPORTED);
+        cullPipeline = createTimedComputePipeline("cluster cull", cullShader, cullProgram.layout);
+
+        vkDestroyShaderModule(device, cullShader.vkModule, nullptr);
+    }
+
+    // The sampler is bound by either culling shader, the reduction only runs with occlusion culling.
+    void createDepthPyramidPipelines(const std::filesystem::path& root_path) {
+        createDepthReductionSampler();
+
+        if (!occlusionCulling) { return; }
+
+        _Shader reduceShader {};
+        _Shader resolveShader {};
+
+        if (!loadinShaders(threadPool, device, root_path, { { &reduceShader, "shaders/depthreduce.comp.glsl" }, { &resolveShader, "shaders/depthresolve.comp.glsl" } })) {
+            throw std::runtime_error("failed to load the depth pyramid shaders!");
+        }
+
+        depthReduceProgram = createProgram(device, VK_PIPELINE_BIND_POINT_COMPUTE, { &reduceShader }, sizeof(glm::vec2), PUSH_DESCRIPTOR_SUPPORTED);
+        depthReducePipeline = createTimedComputePipeline("depth reduce", reduceShader, depthReduceProgram.layout);
+
+        if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+            depthResolveProgram = createProgram(device, VK_PIPELINE_BIND_POINT_COMPUTE, { &resolveShader }, sizeof(glm::vec2), PUSH_DESCRIPTOR_SUPPORTED);
+            depthResolvePipeline = createTimedComputePipeline("depth resolve", resolveShader, depthResolveProgram.layout, { int(msaaSamples) });
+        }
+
+        vkDestroyShaderModule(device, reduceShader.vkModule, nullptr);
+        vkDestroyShaderModule(device, resolveShader.vkModule, nullptr);
+    }
+
+    // Uploads the registry and the instance table, and the draw buffers the instance culling fills.
+    void createSceneBuffers() {
+        const SceneInstances& instances = scene.instances;
+        uint32_t instanceCount = static_cast<uint32_t>(instances.size());
+
+        auto upload = [&](VkBuffer& buffer, Allocation& memory, const void* data, VkDeviceSize size) {
+            createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+            uploader.uploadBuffer(buffer, 0, data, size);
+        };
+
+        upload(sceneMeshBuffer, sceneMeshBufferMemory, scene.geometry.meshes.data(), sizeof(SceneMesh) * scene.geometry.meshes.size());
+        upload(dagLevelBuffer, dagLevelBufferMemory, scene.geometry.dagLevels.data(), sizeof(ClusterDagLevel) * scene.geometry.dagLevels.size());
+        upload(instancePositionScaleBuffer, instancePositionScaleBufferMemory, instances.positionScale.data(), sizeof(glm::vec4) * instanceCount);
+        upload(instanceRotationBuffer, instanceRotationBufferMemory, instances.rotation.data(), sizeof(glm::vec4) * instanceCount);
+        upload(instanceMeshBuffer, instanceMeshBufferMemory, instances.mesh.data(), sizeof(uint32_t) * instanceCount);
+        upload(instanceBoundsBuffer, instanceBoundsBufferMemory, instances.bounds.data(), sizeof(glm::vec4) * instanceCount);
+
+        if (!instanceCulling) { return; }
+
+        VkDeviceSize drawSize = std::max(sizeof(MeshTaskCommand), sizeof(VkDrawIndexedIndirectCommand));
+
+        createBuffer(drawSize * instanceCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceDrawBuffer, instanceDrawBufferMemory);
+        createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceDrawCountBuffer, instanceDrawCountBufferMemory);
+
+        // nothing is visible before the first frame, as for the clusters
+        std::vector<uint32_t> visibility(instanceCount, 0);
+        upload(instanceVisibilityBuffer, instanceVisibilityBufferMemory, visibility.data(), sizeof(uint32_t) * instanceCount);
+
+        printf("Instances: %u, %.1f MB of instance data, up to %u indirect draws\n", instanceCount,
+            double((sizeof(glm::vec4) * 3 + sizeof(uint32_t)) * instanceCount) / 1e6, instanceCount);
+    }
+
+    void createInstanceCullPipeline(const std::filesystem::path& root_path) {
+        _Shader cullShader {};
+
+        if (!loadinShaders(threadPool, device, root_path, { { &cullShader, "shaders/instancecull.comp.glsl" } })) {
+            throw std::runtime_error("failed to load the instance culling shader!");
+        }
+
+        // TASK_COMMANDS: what the culling writes for each visible instance
+        int taskCommands = meshShadingPath == MeshShadingPath::EXT ? 1 : meshShadingPath == MeshShadingPath::NV ? 2 : 0;
+
+        instanceCullProgram = createProgram(device, VK_PIPELINE_BIND_POINT_COMPUTE, { &cullShader }, sizeof(InstanceCullData), PUSH_DESCRIPTOR_SUPPORTED);
+        instanceCullPipeline = createTimedComputePipeline("instance cull", cullShader, instanceCullProgram.layout, { taskCommands });
+
+        vkDestroyShaderModule(device, cullShader.vkModule, nullptr);
+    }
+
+    // Frustum culls every instance and leaves a draw of the level of detail it picked for each survivor in
+    // instanceDrawBuffer, their count in instanceDrawCountBuffer. The passes split the instances like
+    // recordClusterCulling does the clusters.
+    void recordInstanceCulling(VkCommandBuffer commandBuffer, bool late) {
+        vkCmdFillBuffer(commandBuffer, instanceDrawCountBuffer, 0, sizeof(uint32_t), 0);
+
+        VkBufferMemoryBarrier2 clearBarrier = makeBufferBarrier(instanceDrawCountBuffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+        pipelineBarrier(commandBuffer, 1, &clearBarrier, 0, nullptr);
+
+        DescriptorInfo descriptors[] = { DescriptorInfo(frameUniforms.buffer, frameUniforms.offset, frameUniforms.size), sceneMeshBuffer, instanceMeshBuffer,
+            instanceBoundsBuffer, instancePositionScaleBuffer, instanceDrawBuffer, instanceDrawBuffer, instanceDrawCountBuffer,
+            DescriptorInfo(cullStatsBuffer, currentFrame * sizeof(MeshletCullStats), sizeof(MeshletCullStats)),
+            instanceVisibilityBuffer, DescriptorInfo(depthReductionSampler, depthPyramidView, VK_IMAGE_LAYOUT_GENERAL), dagLevelBuffer };
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, instanceCullPipeline);
+        bindComputeDescriptors(commandBuffer, instanceCullProgram, descriptors);
+
+        InstanceCullData cullData = { float(depthPyramidWidth), float(depthPyramidHeight), late ? 1u : 0u, occlusionCulling ? 1u : 0u,
+            static_cast<uint32_t>(scene.instances.size()) };
+        vkCmdPushConstants(commandBuffer, instanceCullProgram.layout, instanceCullProgram.pushConstantStages, 0, sizeof(cullData), &cullData);
+
+        vkCmdDispatch(commandBuffer, (cullData.instanceCount + 63) / 64, 1, 1);
+    }
+
+    void createDepthReductionSampler() {
+        // samplerFilterMinmax is enabled in createLogicalDevice
+        VkSamplerReductionModeCreateInfo reductionInfo { VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO };
+        reductionInfo.reductionMode = VK_SAMPLER_REDUCTION_MODE_MAX;
+
+        VkSamplerCreateInfo samplerInfo { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        samplerInfo.pNext = &reductionInfo;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.minLod = 0.0f;
+        samplerInfo.maxLod = 16.0f;
+
+        VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &depthReductionSampler));
+    }
+
+    // Frustum/cone culls every cluster and leaves the survivors in drawCommandBuffer, with their count in drawCountBuffer.
+    // The early pass only considers what the previous late pass flagged visible, the late pass also tests the depth pyramid.
+    void recordClusterCulling(VkCommandBuffer commandBuffer, bool late) {
+        vkCmdFillBuffer(commandBuffer, drawCountBuffer, 0, sizeof(uint32_t), 0);
+
+        VkBufferMemoryBarrier2 clearBarrier = makeBufferBarrier(drawCountBuffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+        pipelineBarrier(commandBuffer, 1, &clearBarrier, 0, nullptr);
+
+        DescriptorInfo descriptors[] = { DescriptorInfo(frameUniforms.buffer, frameUniforms.offset, frameUniforms.size), clusterBuffer, drawCommandBuffer, drawCountBuffer,
+            visibilityBuffer, DescriptorInfo(depthReductionSampler, depthPyramidView, VK_IMAGE_LAYOUT_GENERAL),
+            DescriptorInfo(cullStatsBuffer, currentFrame * sizeof(MeshletCullStats), sizeof(MeshletCullStats)), meshletLodBuffer };
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+        bindComputeDescriptors(commandBuffer, cullProgram, descriptors);
+
+        ClusterCullData cullData = { float(depthPyramidWidth), float(depthPyramidHeight), late ? 1u : 0u, occlusionCulling ? 1u : 0u };
+        vkCmdPushConstants(commandBuffer, cullProgram.layout, cullProgram.pushConstantStages, 0, sizeof(cullData), &cullData);
+
+        vkCmdDispatch(commandBuffer, (selectedLod().meshletCount + 63) / 64, 1, 1);
+    }
+
+    // Reduces the depth the early pass left behind into depthPyramid, keeping the farthest depth per texel.
+    void recordDepthPyramid(VkCommandBuffer commandBuffer) {
+        VkImageView sourceView = depthImageView;
+        VkImageLayout sourceLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        if (VK_NULL_HANDLE != depthResolved) {
+            DescriptorInfo descriptors[] = { DescriptorInfo(depthResolvedView, VK_IMAGE_LAYOUT_GENERAL), DescriptorInfo(depthReductionSampler, depthImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) };
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthResolvePipeline);
+            bindComputeDescriptors(commandBuffer, depthResolveProgram, descriptors);
+
+            glm::vec2 imageSize(swapChainExtent.width, swapChainExtent.height);
+            vkCmdPushConstants(commandBuffer, depthResolveProgram.layout, depthResolveProgram.pushConstantStages, 0, sizeof(imageSize), &imageSize);
+
+            vkCmdDispatch(commandBuffer, (swapChainExtent.width + 31) / 32, (swapChainExtent.height + 31) / 32, 1);
+
+            VkImageMemoryBarrier2 resolveBarrier = makeImageBarrier(depthResolved, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+            pipelineBarrier(commandBuffer, 0, nullptr, 1, &resolveBarrier);
+
+            sourceView = depthResolvedView;
+            sourceLayout = VK_IMAGE_LAYOUT_GENERAL;
+        }
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthReducePipeline);
+
+        for (uint32_t i = 0; i < depthPyramidLevels; ++i) {
+            DescriptorInfo descriptors[] = { DescriptorInfo(depthPyramidMips[i], VK_IMAGE_LAYOUT_GENERAL),
+                i == 0 ? DescriptorInfo(depthReductionSampler, sourceView, sourceLayout) : DescriptorInfo(depthReductionSampler, depthPyramidMips[i - 1], VK_IMAGE_LAYOUT_GENERAL) };
+
+            bindComputeDescriptors(commandBuffer, depthReduceProgram, descriptors);
+
+            uint32_t levelWidth = std::max(depthPyramidWidth >> i, 1u);
+            uint32_t levelHeight = std::max(depthPyramidHeight >> i, 1u);
+
+            glm::vec2 imageSize(levelWidth, levelHeight);
+            vkCmdPushConstants(commandBuffer, depthReduceProgram.layout, depthReduceProgram.pushConstantStages, 0, sizeof(imageSize), &imageSize);
+
+            vkCmdDispatch(commandBuffer, (levelWidth + 31) / 32, (levelHeight + 31) / 32, 1);
+
+            VkImageMemoryBarrier2 levelBarrier = makeImageBarrier(depthPyramid, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+            pipelineBarrier(commandBuffer, 0, nullptr, 1, &levelBarrier);
+        }
+    }
+
+    // A pool per frame in flight for the compute sets, sized for the culling passes and a level of the pyramid
+    // each; a level per mip of a 16k pyramid still fits.
+    void createComputeDescriptorPools() {
+        const uint32_t maxSets = 32;
+
+        VkDescriptorPoolSize poolSizes[] = {
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * 10 }, // the early and late culling, instancecull binds the most
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxSets },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxSets },
+        };
+
+        VkDescriptorPoolCreateInfo poolInfo { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        poolInfo.maxSets = maxSets;
+        poolInfo.poolSizeCount = ARRAYSIZE(poolSizes);
+        poolInfo.pPoolSizes = poolSizes;
+
+        computeDescriptorPools.resize(framesInFlight);
+
+        for (auto& pool : computeDescriptorPools) {
+            VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool));
+        }
+    }
+
+    // Pushes the descriptors of a compute dispatch, or writes them into a set of the frame's pool and binds that.
+    void bindComputeDescriptors(VkCommandBuffer commandBuffer, const _Program& program, const DescriptorInfo* descriptors) {
+        if (PUSH_DESCRIPTOR_SUPPORTED) {
+            vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, program.updateTemplate, program.layout, 0, descriptors);
+            return;
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        allocInfo.descriptorPool = computeDescriptorPools[currentFrame];
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &program.setLayout;
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &set));
+
+        vkUpdateDescriptorSetWithTemplate(device, set, program.updateTemplate, descriptors);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, program.layout, 0, 1, &set, 0, nullptr);
     }
 
     void createDescriptorPool() {
         if (PUSH_DESCRIPTOR_SUPPORTED) { return; }
 
         std::array<VkDescriptorPoolSize, 3> poolSizes{};
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        poolSizes[0].descriptorCount = framesInFlight;
         poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolSizes[1].descriptorCount = framesInFlight;
 
         poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolSizes[2].descriptorCount = framesInFlight * (MESH_SHADERING_SUPPORTED ? 8 : 3);
 
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
         poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolInfo.maxSets = framesInFlight;
 
         if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
             throw std::runtime_error("failed to create descriptor pool!");
@@ -1887,22 +2653,23 @@ private:
     void createDescriptorSets() {
         if (PUSH_DESCRIPTOR_SUPPORTED) { return; }
 
-        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+        std::vector<VkDescriptorSetLayout> layouts(framesInFlight, descriptorSetLayout);
         VkDescriptorSetAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        allocInfo.descriptorSetCount = framesInFlight;
         allocInfo.pSetLayouts = layouts.data();
 
-        descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        descriptorSets.resize(framesInFlight);
         if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate descriptor sets!");
         }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < framesInFlight; i++) {
             
+            // the ring offset of the frame's constants is supplied as a dynamic offset at bind time
             VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = uniformBuffers[i];
+            bufferInfo.buffer = uniformRing.buffer();
             bufferInfo.offset = 0;
             bufferInfo.range = sizeof(UniformBufferObject);
 
@@ -1911,13 +2678,14 @@ private:
             imageInfo.imageView = textureImageView;
             imageInfo.sampler = textureSampler;
 
-            std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+            std::array<VkWriteDescriptorSet, 10> descriptorWrites{};
+            uint32_t descriptorWriteCount = 3;
 
             descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             descriptorWrites[0].dstSet = descriptorSets[i];
             descriptorWrites[0].dstBinding = 0;
             descriptorWrites[0].dstArrayElement = 0;
-            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             descriptorWrites[0].descriptorCount = 1;
             descriptorWrites[0].pBufferInfo = &bufferInfo;
 
@@ -1932,7 +2700,7 @@ private:
                 VkDescriptorBufferInfo _bufferInfo{};
                 _bufferInfo.buffer = vertexBuffer;
                 _bufferInfo.offset = 0;
-                _bufferInfo.range = sizeof(Vertex) * defaultMesh.vertices.size();
+                _bufferInfo.range = sizeof(GpuVertex) * scene.geometry.vertexCount;
 
                 descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
                 descriptorWrites[2].dstSet = descriptorSets[i];
@@ -1942,15 +2710,57 @@ private:
                 descriptorWrites[2].descriptorCount = 1;
                 descriptorWrites[2].pBufferInfo = &_bufferInfo;
 
-            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+                VkDescriptorBufferInfo _meshletsInfo { meshletsBuffer, 0, VK_WHOLE_SIZE };
+                VkDescriptorBufferInfo _meshletDataInfo { meshletDataBuffer, 0, VK_WHOLE_SIZE };
+                VkDescriptorBufferInfo _cullStatsInfo { cullStatsBuffer, i * sizeof(MeshletCullStats), sizeof(MeshletCullStats) };
+                VkDescriptorBufferInfo _meshletLodsInfo { meshletLodBuffer, 0, VK_WHOLE_SIZE };
+                VkDescriptorBufferInfo _positionScaleInfo { instancePositionScaleBuffer, 0, VK_WHOLE_SIZE };
+                VkDescriptorBufferInfo _rotationInfo { instanceRotationBuffer, 0, VK_WHOLE_SIZE };
+                VkDescriptorBufferInfo _taskCommandsInfo { instanceDrawBuffer, 0, VK_WHOLE_SIZE };
+
+                if (MESH_SHADERING_SUPPORTED) {
+                    descriptorWrites[3] = descriptorWrites[2];
+                    descriptorWrites[3].dstBinding = 3;
+                    descriptorWrites[3].pBufferInfo = &_meshletsInfo;
+
+                    descriptorWrites[4] = descriptorWrites[2];
+                    descriptorWrites[4].dstBinding = 4;
+                    descriptorWrites[4].pBufferInfo = &_meshletDataInfo;
+
+                    descriptorWrites[5] = descriptorWrites[2];
+                    descriptorWrites[5].dstBinding = 5;
+                    descriptorWrites[5].pBufferInfo = &_cullStatsInfo;
+
+                    descriptorWrites[6] = descriptorWrites[2];
+                    descriptorWrites[6].dstBinding = 6;
+                    descriptorWrites[6].pBufferInfo = &_meshletLodsInfo;
+
+                    descriptorWrites[7] = descriptorWrites[2];
+                    descriptorWrites[7].dstBinding = 9;
+                    descriptorWrites[7].pBufferInfo = &_taskCommandsInfo;
+
+                    descriptorWriteCount = 8;
+                }
+
+                descriptorWrites[descriptorWriteCount] = descriptorWrites[2];
+                descriptorWrites[descriptorWriteCount].dstBinding = 7;
+                descriptorWrites[descriptorWriteCount++].pBufferInfo = &_positionScaleInfo;
+
+                descriptorWrites[descriptorWriteCount] = descriptorWrites[2];
+                descriptorWrites[descriptorWriteCount].dstBinding = 8;
+                descriptorWrites[descriptorWriteCount++].pBufferInfo = &_rotationInfo;
+
+            vkUpdateDescriptorSets(device, descriptorWriteCount, descriptorWrites.data(), 0, nullptr);
         }
     }
 
-    VkBufferMemoryBarrier makeBufferBarrier(VkBuffer buffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask)
+    VkBufferMemoryBarrier2 makeBufferBarrier(VkBuffer buffer, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask)
     {
-        VkBufferMemoryBarrier result = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+        VkBufferMemoryBarrier2 result = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
 
+        result.srcStageMask = srcStageMask;
         result.srcAccessMask = srcAccessMask;
+        result.dstStageMask = dstStageMask;
         result.dstAccessMask = dstAccessMask;
         result.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         result.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -1961,11 +2771,14 @@ private:
         return result;
     }
 
-    VkImageMemoryBarrier makeImageBarrier(VkImage image, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkImageLayout oldLayout, VkImageLayout newLayout)
+    VkImageMemoryBarrier2 makeImageBarrier(VkImage image, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask,
+        VkImageLayout oldLayout, VkImageLayout newLayout)
     {
-        VkImageMemoryBarrier result = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        VkImageMemoryBarrier2 result = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
 
+        result.srcStageMask = srcStageMask;
         result.srcAccessMask = srcAccessMask;
+        result.dstStageMask = dstStageMask;
         result.dstAccessMask = dstAccessMask;
         result.oldLayout = oldLayout;
         result.newLayout = newLayout;
@@ -1979,7 +2792,18 @@ private:
         return result;
     }
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    void pipelineBarrier(VkCommandBuffer commandBuffer, uint32_t bufferBarrierCount, const VkBufferMemoryBarrier2* bufferBarriers, uint32_t imageBarrierCount, const VkImageMemoryBarrier2* imageBarriers)
+    {
+        VkDependencyInfo dependencyInfo = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dependencyInfo.bufferMemoryBarrierCount = bufferBarrierCount;
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers;
+        dependencyInfo.imageMemoryBarrierCount = imageBarrierCount;
+        dependencyInfo.pImageMemoryBarriers = imageBarriers;
+
+        vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferMemory) {
         VkBufferCreateInfo bufferInfo{};
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         bufferInfo.size = size;
@@ -1993,43 +2817,23 @@ private:
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
-        }
-
-        vkBindBufferMemory(device, buffer, bufferMemory, 0);
-    }
-
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        bufferMemory = allocator.allocate(memRequirements, findMemoryType(memRequirements.memoryTypeBits, properties), true);
 
-        VkBufferCopy copyRegion{};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-        endSingleTimeCommands(commandBuffer);
+        vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
     }
 
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+        uint32_t memoryType = allocator.findMemoryType(typeFilter, properties);
 
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
-            }
+        if (memoryType == ~0u) {
+            throw std::runtime_error("failed to find suitable memory type!");
         }
 
-        throw std::runtime_error("failed to find suitable memory type!");
+        return memoryType;
     }
 
     void createCommandBuffers() {
-        commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        commandBuffers.resize(framesInFlight);
 
         VkCommandBufferAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -2042,7 +2846,8 @@ private:
         }
     }
 
-    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    // Returns the upload timeline value the submission has to wait for, 0 if it uses no new uploads.
+    uint64_t recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -2050,83 +2855,180 @@ private:
             throw std::runtime_error("failed to begin recording command buffer!");
         }
 
-        vkCmdResetQueryPool(commandBuffer, queryPool, 0, 128);
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, imageIndex*2 + 0);
+        uint64_t uploadValue = uploader.acquire(commandBuffer);
 
-        VkRenderPassBeginInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = swapChainExtent;
+        vkCmdResetQueryPool(commandBuffer, queryPool, currentFrame*2, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, currentFrame*2 + 0);
 
-        std::array<VkClearValue, 2> clearValues{};
-        clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
-        clearValues[1].depthStencil = {1.0f, 0};
+        // the submission waits for the acquire before the color attachment output, the transition out of whatever
+        // layout the image was presented in has to as well
+        frameImageIndex = imageIndex;
+        frameGraph.rebindImage(swapchainResource, swapChainImages[imageIndex], VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
+        frameGraph.execute(commandBuffer);
 
-        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-        renderPassInfo.pClearValues = clearValues.data();
+        // the culling stages count into host visible memory that drawFrame reads once the frame has completed, which
+        // only makes their atomics visible to the host behind this barrier; the CPU draws count on the CPU
+        if (!cpuDraws) {
+            VkPipelineStageFlags2 statsStages = MESH_SHADERING_SUPPORTED ? VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            VkBufferMemoryBarrier2 statsBarrier = makeBufferBarrier(cullStatsBuffer, statsStages, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+            pipelineBarrier(commandBuffer, 1, &statsBarrier, 0, nullptr);
+        }
 
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, currentFrame*2 + 1);
 
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
 
-            VkViewport viewport{};
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float) swapChainExtent.width;
-            viewport.height = (float) swapChainExtent.height;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
-            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        return uploadValue;
+    }
 
-            VkRect2D scissor{};
-            scissor.offset = {0, 0};
-            scissor.extent = swapChainExtent;
-            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);            
+    // Draws whatever the last culling pass (and the task shader) lets through, or with the CPU draws whatever
+    // recordInstanceDraws keeps. The first pass clears the attachments and the late one continues on what it
+    // stored; the one drawing last resolves the samples into the swapchain image.
+    void recordScenePass(VkCommandBuffer commandBuffer, bool late) {
+        const bool multisampled = VK_NULL_HANDLE != colorImageView;
+        const bool last = late || !occlusionCulling;
 
-            VkDeviceSize offsets[] = {0};
+        VkRenderingAttachmentInfo colorAttachment { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+        colorAttachment.imageView = multisampled ? colorImageView : swapChainImageViews[frameImageIndex];
+        colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = multisampled && last ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
 
-                if (PUSH_DESCRIPTOR_SUPPORTED) {
+        if (multisampled && last) {
+            colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+            colorAttachment.resolveImageView = swapChainImageViews[frameImageIndex];
+            colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        }
 
-                    std::vector<VkWriteDescriptorSet> descriptorWrites{};
-                    
-                    VkDescriptorBufferInfo uniformBufferInfo{};
-                    uniformBufferInfo.buffer = uniformBuffers[imageIndex];
-                    uniformBufferInfo.offset = 0;
-                    uniformBufferInfo.range = sizeof(UniformBufferObject);
+        // the depth pyramid and the late pass read what the first pass leaves behind
+        VkRenderingAttachmentInfo depthAttachment { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+        depthAttachment.imageView = depthImageView;
+        depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthAttachment.loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = occlusionCulling && !late ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.clearValue.depthStencil = {1.0f, 0};
 
-                    uint32_t idx = static_cast<uint32_t>(descriptorWrites.size());
-                    descriptorWrites.push_back(VkWriteDescriptorSet());
+        VkRenderingInfo renderingInfo { VK_STRUCTURE_TYPE_RENDERING_INFO };
+        renderingInfo.flags = cpuDraws ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+        renderingInfo.renderArea.offset = {0, 0};
+        renderingInfo.renderArea.extent = swapChainExtent;
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachments = &colorAttachment;
+        renderingInfo.pDepthAttachment = &depthAttachment;
 
-                    descriptorWrites.back().sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                    descriptorWrites.back().dstSet = 0;
-                    descriptorWrites.back().dstBinding = idx;
-                    descriptorWrites.back().dstArrayElement = 0;
-                    descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                    descriptorWrites.back().descriptorCount = 1;
-                    descriptorWrites.back().pBufferInfo = &uniformBufferInfo;
+        if (cpuDraws) {
+            vkCmdBeginRendering(commandBuffer, &renderingInfo);
+
+                MeshletCullStats stats {};
+                const auto& secondaries = recordInstanceDraws(drawPartitions(), stats);
+                vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+
+                // read back like the GPU counted stats, once this frame's slot comes around again
+                static_cast<MeshletCullStats*>(cullStatsBufferMemory.data)[currentFrame] = stats;
+
+            vkCmdEndRendering(commandBuffer);
+            return;
+        }
+
+        vkCmdBeginRendering(commandBuffer, &renderingInfo);
+
+            bindSceneState(commandBuffer);
+
+            if (MESH_SHADERING_SUPPORTED) {
+
+                meshShaderDraw(commandBuffer);
+            } else {
+
+                if (instanceCulling) {
+                    vkCmdDrawIndexedIndirectCount(commandBuffer, instanceDrawBuffer, 0, instanceDrawCountBuffer, 0, uint32_t(scene.instances.size()), sizeof(VkDrawIndexedIndirectCommand));
+                } else {
+                    vkCmdDrawIndexedIndirectCount(commandBuffer, drawCommandBuffer, 0, drawCountBuffer, 0, clusterCount, sizeof(VkDrawIndexedIndirectCommand));
+                }
+            } 
+
+        vkCmdEndRendering(commandBuffer);
+    }
+
+    // Pipeline, dynamic state, descriptors and index buffer of the scene pass, set again in every secondary
+    // command buffer since those inherit none of it.
+    void bindSceneState(VkCommandBuffer commandBuffer) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) swapChainExtent.width;
+        viewport.height = (float) swapChainExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-                    VkDescriptorImageInfo imageInfo{};
-                    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                    imageInfo.imageView = textureImageView;
-                    imageInfo.sampler = textureSampler;
+        VkRect2D scissor{};
+        scissor.offset = {0, 0};
+        scissor.extent = swapChainExtent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);            
+
+            if (PUSH_DESCRIPTOR_SUPPORTED) {
+
+                std::vector<VkWriteDescriptorSet> descriptorWrites{};
+                
+                VkDescriptorBufferInfo uniformBufferInfo{};
+                uniformBufferInfo.buffer = frameUniforms.buffer;
+                uniformBufferInfo.offset = frameUniforms.offset;
+                uniformBufferInfo.range = frameUniforms.size;
+
+                uint32_t idx = static_cast<uint32_t>(descriptorWrites.size());
+                descriptorWrites.push_back(VkWriteDescriptorSet());
+
+                descriptorWrites.back().sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites.back().dstSet = 0;
+                descriptorWrites.back().dstBinding = idx;
+                descriptorWrites.back().dstArrayElement = 0;
+                descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                descriptorWrites.back().descriptorCount = 1;
+                descriptorWrites.back().pBufferInfo = &uniformBufferInfo;
+
+                VkDescriptorImageInfo imageInfo{};
+                imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                imageInfo.imageView = textureImageView;
+                imageInfo.sampler = textureSampler;
+
+                idx += 1;
+                descriptorWrites.push_back(VkWriteDescriptorSet());
+                
+                descriptorWrites.back().sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites.back().dstSet = 0;
+                descriptorWrites.back().dstBinding = idx;
+                descriptorWrites.back().dstArrayElement = 0;
+                descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                descriptorWrites.back().descriptorCount = 1;
+                descriptorWrites.back().pImageInfo = &imageInfo;
+
+                    VkDescriptorBufferInfo _vertexBufferInfo{};
+                    _vertexBufferInfo.buffer = vertexBuffer;
+                    _vertexBufferInfo.offset = 0;
+                    _vertexBufferInfo.range = sizeof(GpuVertex) * scene.geometry.vertexCount;
 
                     idx += 1;
                     descriptorWrites.push_back(VkWriteDescriptorSet());
-                    
+
                     descriptorWrites.back().sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
                     descriptorWrites.back().dstSet = 0;
                     descriptorWrites.back().dstBinding = idx;
                     descriptorWrites.back().dstArrayElement = 0;
-                    descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                    descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
                     descriptorWrites.back().descriptorCount = 1;
-                    descriptorWrites.back().pImageInfo = &imageInfo;
+                    descriptorWrites.back().pBufferInfo = &_vertexBufferInfo;
 
-                        VkDescriptorBufferInfo _vertexBufferInfo{};
-                        _vertexBufferInfo.buffer = vertexBuffer;
-                        _vertexBufferInfo.offset = 0;
-                        _vertexBufferInfo.range = sizeof(Vertex) * defaultMesh.vertices.size();
+                    if (MESH_SHADERING_SUPPORTED) {
+                        VkDescriptorBufferInfo _meshletsBufferInfo{};
+                        _meshletsBufferInfo.buffer = meshletsBuffer;
+                        _meshletsBufferInfo.offset = 0;
+                        _meshletsBufferInfo.range = sizeof(Meshlet) * scene.geometry.meshlets.size();
 
                         idx += 1;
                         descriptorWrites.push_back(VkWriteDescriptorSet());
@@ -2137,167 +3039,508 @@ private:
                         descriptorWrites.back().dstArrayElement = 0;
                         descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
                         descriptorWrites.back().descriptorCount = 1;
-                        descriptorWrites.back().pBufferInfo = &_vertexBufferInfo;
+                        descriptorWrites.back().pBufferInfo = &_meshletsBufferInfo;
+                    }
 
-                        if (MESH_SHADERING_SUPPORTED) {
-                            VkDescriptorBufferInfo _meshletsBufferInfo{};
-                            _meshletsBufferInfo.buffer = meshletsBuffer;
-                            _meshletsBufferInfo.offset = 0;
-                            _meshletsBufferInfo.range = sizeof(Meshlet) * defaultMesh.meshlets.size();
+                //vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, descriptorWrites.size(), descriptorWrites.data());
 
-                            idx += 1;
-                            descriptorWrites.push_back(VkWriteDescriptorSet());
+                auto imginfo = DescriptorInfo(textureSampler, textureImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-                            descriptorWrites.back().sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                            descriptorWrites.back().dstSet = 0;
-                            descriptorWrites.back().dstBinding = idx;
-                            descriptorWrites.back().dstArrayElement = 0;
-                            descriptorWrites.back().descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-                            descriptorWrites.back().descriptorCount = 1;
-                            descriptorWrites.back().pBufferInfo = &_meshletsBufferInfo;
-                        }
+                DescriptorInfo _descriptors[] = { DescriptorInfo(frameUniforms.buffer, frameUniforms.offset, frameUniforms.size), imginfo, vertexBuffer, meshletsBuffer, meshletDataBuffer,
+                    DescriptorInfo(cullStatsBuffer, currentFrame * sizeof(MeshletCullStats), sizeof(MeshletCullStats)), meshletLodBuffer,
+                    instancePositionScaleBuffer, instanceRotationBuffer, instanceDrawBuffer };
+                vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, updateTemplate, pipelineLayout, 0, _descriptors);
 
-                    //vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, descriptorWrites.size(), descriptorWrites.data());
+            } else {
 
-                    auto imginfo = DescriptorInfo(textureSampler, textureImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+                uint32_t dynamicOffset = static_cast<uint32_t>(frameUniforms.offset);
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &dynamicOffset);
+            }
 
-                    DescriptorInfo _descriptors[] = { uniformBuffers[imageIndex], imginfo, vertexBuffer, meshletsBuffer};
-                    vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, updateTemplate, pipelineLayout, 0, _descriptors);
+        if (!MESH_SHADERING_SUPPORTED) {
+            #if !VertexPulling
+                VkDeviceSize offsets[] = {0};
+                VkBuffer vertexBuffers[] = { vertexBuffer };
+                vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+            #endif
+            vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
+    }
 
-                } else {
+    // a partition per recording thread, unless there are too few instances to be worth a secondary each
+    uint32_t drawPartitions() const {
+        const size_t instancesPerPartition = 1024;
 
-                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
-                }
+        size_t partitions = (scene.instances.size() + instancesPerPartition - 1) / instancesPerPartition;
+        return static_cast<uint32_t>(std::clamp<size_t>(partitions, 1, secondaryRecorder.threadCount()));
+    }
 
-            if (MESH_SHADERING_SUPPORTED) {
+    // Records the CPU draws of a scene pass into partitionCount secondary command buffers in parallel, each covering
+    // a contiguous range of the instances, and adds up what they culled in stats. They only need to know the
+    // attachment formats, not which images the pass renders into.
+    const std::vector<VkCommandBuffer>& recordInstanceDraws(uint32_t partitionCount, MeshletCullStats& stats) {
+        VkCommandBufferInheritanceRenderingInfo renderingInheritance { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO };
+        renderingInheritance.colorAttachmentCount = 1;
+        renderingInheritance.pColorAttachmentFormats = &swapChainImageFormat;
+        renderingInheritance.depthAttachmentFormat = depthFormat;
+        renderingInheritance.rasterizationSamples = msaaSamples;
 
-                meshShaderDraw(commandBuffer);
-                // vkCmdDrawMeshTasksNV(commandBuffer, defaultMesh.meshlets.size(), 0);
-                // vkCmdDrawMeshTasksEXT(commandBuffer, defaultMesh.meshlets.size(), 1, 1);      
-            } else {
+        VkCommandBufferInheritanceInfo inheritance { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+        inheritance.pNext = &renderingInheritance;
 
-                #if !VertexPulling
-                    VkBuffer vertexBuffers[] = { vertexBuffer };
-                    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-                #endif
-                vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-                vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(defaultMesh.indices.size()), 1, 0, 0, 0);
-            } 
+        std::vector<MeshletCullStats> partitionStats(partitionCount);
+        size_t instanceCount = scene.instances.size();
 
-        vkCmdEndRenderPass(commandBuffer);
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, imageIndex*2 + 1);
+        const auto& secondaries = secondaryRecorder.record(threadPool, inheritance, partitionCount, [&](VkCommandBuffer commandBuffer, uint32_t partition) {
+            bindSceneState(commandBuffer);
+            drawInstances(commandBuffer, instanceCount * partition / partitionCount, instanceCount * (partition + 1) / partitionCount, partitionStats[partition]);
+        });
 
-        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
+        for (const auto& partial : partitionStats) {
+            stats.submitted += partial.submitted;
+            stats.emitted += partial.emitted;
+            stats.triangles += partial.triangles;
+        }
+
+        return secondaries;
+    }
+
+    // The CPU twin of instancecull.comp.glsl: frustum culls the instances in [first, last) against frameConstants
+    // and draws the level of detail the same rule picks for each survivor.
+    void drawInstances(VkCommandBuffer commandBuffer, size_t first, size_t last, MeshletCullStats& stats) const {
+        const UniformBufferObject& ubo = frameConstants;
+        const SceneInstances& instances = scene.instances;
+
+        float sceneScale = glm::length(glm::vec3(ubo.model[0]));
+
+        for (size_t i = first; i < last; ++i) {
+            glm::vec4 bounds = instances.bounds[i];
+            glm::vec3 center = glm::vec3(ubo.model * glm::vec4(glm::vec3(bounds), 1.0f));
+            float radius = bounds.w * sceneScale;
+
+            bool visible = true;
+
+            for (const glm::vec4& plane : ubo.frustum) {
+                visible = visible && glm::dot(glm::vec3(plane), center) + plane.w >= -radius;
+            }
+
+            if (!visible) {
+                continue;
+            }
+
+            const SceneMesh& mesh = scene.geometry.meshes[instances.mesh[i]];
+
+            float distance = std::max(glm::length(center - glm::vec3(ubo.cameraPosition)) - radius, 0.1f);
+            float errorScale = sceneScale * instances.positionScale[i].w * ubo.lodSelection.x / distance;
+
+            uint32_t lod = 0;
+
+            while (lod + 1 < mesh.lodCount && mesh.lods[lod + 1].error * errorScale <= ubo.lodSelection.y) {
+                ++lod;
+            }
+
+            // firstInstance leads the vertex shader to the instance transform
+            vkCmdDrawIndexed(commandBuffer, mesh.lods[lod].indexCount, 1, mesh.lods[lod].firstIndex, int32_t(mesh.vertexOffset), uint32_t(i));
+
+            stats.emitted++;
+            stats.triangles += mesh.lods[lod].indexCount / 3;
+        }
+
+        stats.submitted += uint32_t(last - first);
+    }
+
+    // Records the CPU draws of one frame over and over with 1, 2, 4... up to all threads of the pool, and reports
+    // how the recording time scales. Nothing is submitted.
+    void benchRecording() {
+        const uint32_t passCount = 64;
+        const uint32_t threadCount = secondaryRecorder.threadCount();
+
+        updateUniformBuffer(0);
+
+        printf("Recording: %zu instances, %u passes per thread count\n", scene.instances.size(), passCount);
+
+        double baseline = 0;
+
+        for (uint32_t threads = 1; ; threads = std::min(threads * 2, threadCount)) {
+            MeshletCullStats stats {};
+
+            auto begin = std::chrono::high_resolution_clock::now();
+
+            for (uint32_t pass = 0; pass < passCount; ++pass) {
+                secondaryRecorder.beginFrame(0);
+                recordInstanceDraws(threads, stats);
+            }
+
+            double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count() / passCount;
+            baseline = threads == 1 ? time : baseline;
+
+            printf("Recording: %2u threads, %.3f ms per frame, %.2fx, %u draws\n", threads, time, baseline / time, stats.emitted / passCount);
+
+            if (threads == threadCount) {
+                break;
+            }
+        }
+
+        secondaryRecorder.beginFrame(0);
+    }
+
+    // The GPU half of --bench-vertices: a pass of vertexfetch.comp.glsl over the full model in cluster index order
+    // for every PackedVertex layout, timed with the frame's timestamp queries. Best of a few submissions each.
+    void benchVertexFetch() {
+        const SceneMeshLod& full = scene.geometry.meshes.front().lods[0];
+
+        VkBuffer indices {};
+        Allocation indicesMemory;
+        createBuffer(sizeof(uint32_t) * full.indexCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indices, indicesMemory);
+        uploader.uploadBuffer(indices, 0, scene.geometry.clusterIndices.data() + full.firstIndex, sizeof(uint32_t) * full.indexCount);
+
+        VkBuffer checksum {};
+        Allocation checksumMemory;
+        createBuffer(sizeof(glm::vec4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, checksum, checksumMemory);
+
+        printf("Vertex fetch: %u indices over %zu vertices\n", full.indexCount, defaultMesh().vertexCount());
+
+        benchVertexLayout<PackedVertex<PositionEncoding::Float32, NormalEncoding::Oct16>>(indices, full.indexCount, checksum);
+        benchVertexLayout<PackedVertex<PositionEncoding::Float32, NormalEncoding::Oct8>>(indices, full.indexCount, checksum);
+        benchVertexLayout<PackedVertex<PositionEncoding::Unorm16, NormalEncoding::Oct16>>(indices, full.indexCount, checksum);
+        benchVertexLayout<PackedVertex<PositionEncoding::Unorm16, NormalEncoding::Oct8>>(indices, full.indexCount, checksum);
+
+        vkDestroyBuffer(device, indices, nullptr);
+        allocator.free(indicesMemory);
+        vkDestroyBuffer(device, checksum, nullptr);
+        allocator.free(checksumMemory);
+    }
+
+    template <typename V>
+    void benchVertexLayout(VkBuffer indices, uint32_t indexCount, VkBuffer checksum) {
+        const Mesh& mesh = defaultMesh();
+        const uint32_t runCount = 5;
+
+        VkBuffer vertices {};
+        Allocation verticesMemory;
+        createBuffer(sizeof(V) * mesh.vertexCount(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertices, verticesMemory);
+
+        uploader.uploadBuffer(vertices, 0, mesh.vertexCount(), sizeof(V), [&](void* destination, size_t first, size_t count) {
+            packVertices(mesh, static_cast<V*>(destination), first, count);
+        });
+
+        // the single time submissions below don't wait on the upload timeline
+        uploader.flush();
+        uploader.wait();
+
+        // the shader cache keys on the expanded source, so every layout gets its own entry
+        setShaderInclude("vertex.glsl", V::glsl());
+
+        _Shader shader {};
+        bool loaded = loadinShaders(threadPool, device, std::filesystem::path(__FILE__).parent_path(), { { &shader, "shaders/vertexfetch.comp.glsl" } });
+
+        setShaderInclude("vertex.glsl", GpuVertex::glsl());
+
+        if (!loaded) {
+            throw std::runtime_error("failed to load the vertex fetch shader!");
+        }
+
+        const glm::vec3& offset = positionQuantization.offset;
+        const glm::vec3& scale = positionQuantization.scale;
+
+        _Program program = createProgram(device, VK_PIPELINE_BIND_POINT_COMPUTE, { &shader }, sizeof(uint32_t), PUSH_DESCRIPTOR_SUPPORTED);
+        VkPipeline pipeline = createComputePipeline(device, pipelineCache, shader, program.layout, { 0,
+            glm::floatBitsToInt(offset.x), glm::floatBitsToInt(offset.y), glm::floatBitsToInt(offset.z),
+            glm::floatBitsToInt(scale.x), glm::floatBitsToInt(scale.y), glm::floatBitsToInt(scale.z) });
+
+        vkDestroyShaderModule(device, shader.vkModule, nullptr);
+
+        double best = 0.0;
+
+        for (uint32_t run = 0; run < runCount; ++run) {
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+            uploader.acquire(commandBuffer);
+
+            vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+
+            DescriptorInfo descriptors[] = { vertices, indices, checksum };
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+            bindComputeDescriptors(commandBuffer, program, descriptors);
+            vkCmdPushConstants(commandBuffer, program.layout, program.pushConstantStages, 0, sizeof(indexCount), &indexCount);
+
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 0);
+            vkCmdDispatch(commandBuffer, (indexCount + 63) / 64, 1, 1);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+
+            endSingleTimeCommands(commandBuffer);
+
+            uint64_t queryResults[2];
+            VK_CHECK(vkGetQueryPoolResults(device, queryPool, 0, ARRAYSIZE(queryResults), sizeof(queryResults), queryResults, sizeof(queryResults[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+            double time = double(queryResults[1] - queryResults[0]) * deviceProperties.limits.timestampPeriod * 1e-6;
+            best = run ? std::min(best, time) : time;
+
+            if (!computeDescriptorPools.empty()) {
+                VK_CHECK(vkResetDescriptorPool(device, computeDescriptorPools[currentFrame], 0));
+            }
         }
+
+        printf("  %-18s %-14s %2zu B/vertex %9.1f KB  fetch %7.3f ms  %6.2f G indices/s\n", V::Position::name, V::Normal::name, sizeof(V),
+            double(sizeof(V) * mesh.vertexCount()) / 1e3, best, double(indexCount) / std::max(best, 1e-6) / 1e6);
+
+        vkDestroyPipeline(device, pipeline, nullptr);
+        destroyProgram(device, program);
+
+        vkDestroyBuffer(device, vertices, nullptr);
+        allocator.free(verticesMemory);
     }
 
     void createSyncObjects() {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+        imageAvailableSemaphores.resize(framesInFlight);
+        renderFinishedSemaphores.resize(framesInFlight);
+
+        // the binary semaphores only order acquire and present, the frames are paced on the timeline
+        frameTimeline.init(device, framesInFlight);
+        printf("Frames in flight: %u\n", frameTimeline.framesInFlight());
 
         VkSemaphoreCreateInfo semaphoreInfo{};
         semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        VkFenceCreateInfo fenceInfo{};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < framesInFlight; i++) {
             if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create synchronization objects for a frame!");
             }
         }
     }
 
-    void updateUniformBuffer(uint32_t currentImage) {
-        static auto startTime = std::chrono::high_resolution_clock::now();
+    void updateMeshTransform() {
+        glm::vec3 mesh_size = (defaultMesh().bounding[1] - defaultMesh().bounding[0])/2.0f;
+        glm::vec3 mesh_center = (defaultMesh().bounding[1] + defaultMesh().bounding[0])/2.0f;
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+        float max_dim = std::max(mesh_size.x, std::max(mesh_size.y, mesh_size.z));
 
-        UniformBufferObject ubo{};
+        meshTransform = glm::translate(glm::mat4(1.0f), -mesh_center);
+        meshTransform = glm::scale(meshTransform, glm::vec3(0.5f/max_dim));
+    }
+
+    // Coarsest level whose error, projected at the nearest point of the mesh's bounding sphere, stays within
+    // lodErrorPixels. model is a rotation and uniform scale like everywhere else.
+    uint32_t selectLod(const glm::mat4& model, const glm::mat4& view, const glm::mat4& proj) const {
+        glm::vec3 center = (defaultMesh().bounding[0] + defaultMesh().bounding[1]) * 0.5f;
+        float scale = glm::length(glm::vec3(model[0]));
+        float radius = glm::length(defaultMesh().bounding[1] - defaultMesh().bounding[0]) * 0.5f * scale;
 
-        glm::vec3 mesh_size = (defaultMesh.bounding[1] - defaultMesh.bounding[0])/2.0f;
-        glm::vec3 mesh_center = (defaultMesh.bounding[1] + defaultMesh.bounding[0])/2.0f;
-
-        uint max_axis = [&]() {
-            uint selected_axis = 0;
-            float selected_value = mesh_size[0];
-            for (uint i=1; i<3; ++i) {
-                if(mesh_size[i] > selected_value) {
-                    selected_axis = i;
-                    selected_value = mesh_size[i];
-                } // if
+        glm::vec3 viewCenter = glm::vec3(view * model * glm::vec4(center, 1.0f));
+
+        // at least the near plane, inside the sphere every level would be measured at the camera
+        float distance = std::max(glm::length(viewCenter) - radius, 0.1f);
+        float pixelsPerUnit = std::abs(proj[1][1]) * 0.5f * float(swapChainExtent.height) / distance;
+
+        uint32_t lod = 0;
+
+        while (lod + 1 < defaultMesh().lods.size() && defaultMesh().lods[lod + 1].error * scale * pixelsPerUnit <= options.lodErrorPixels) {
+            ++lod;
+        }
+
+        return lod;
+    }
+
+    // Meshlet range of the hierarchy levels that can hold part of the cut, the window instancecull.comp.glsl picks
+    // per instance. The cluster culling then tests those levels only, rather than every meshlet of the hierarchy.
+    MeshLod selectDagWindow(const glm::mat4& model, const glm::mat4& view, float pixelsPerUnit) const {
+        const SceneMesh& mesh = scene.geometry.meshes.front();
+
+        float scale = glm::length(glm::vec3(model[0]));
+        float radius = mesh.dagRadius * scale;
+        float distance = glm::length(glm::vec3(view * model * glm::vec4(glm::vec3(mesh.bounds), 1.0f)));
+
+        float nearest = std::max(distance - radius, 0.1f);
+        float farthest = std::max(distance + radius, 0.1f);
+
+        MeshLod window = defaultMesh().clusterDag;
+        uint32_t first = mesh.dagLevelCount, last = 0;
+
+        for (uint32_t i = 0; i < mesh.dagLevelCount; ++i) {
+            const ClusterDagLevel& level = scene.geometry.dagLevels[mesh.dagLevelOffset + i];
+
+            if (level.minError * scale * pixelsPerUnit / nearest <= options.lodErrorPixels &&
+                level.maxParentError * scale * pixelsPerUnit / farthest > options.lodErrorPixels) {
+                first = std::min(first, i);
+                last = i;
             }
-            return selected_axis;
-        }();
+        }
 
-        float max_dim = mesh_size[max_axis];
+        if (first <= last) {
+            const ClusterDagLevel& firstLevel = scene.geometry.dagLevels[mesh.dagLevelOffset + first];
+            const ClusterDagLevel& lastLevel = scene.geometry.dagLevels[mesh.dagLevelOffset + last];
 
-        ubo.model = glm::translate(glm::mat4(1.0f), -mesh_center);
-        ubo.model = glm::scale(ubo.model, glm::vec3(0.5f/max_dim));
+            window.meshletOffset = firstLevel.meshletOffset;
+            window.meshletCount = lastLevel.meshletOffset + lastLevel.meshletCount - firstLevel.meshletOffset;
+        }
 
-        ubo.model = glm::rotate(ubo.model, time * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        return window;
+    }
+
+    // meshlet (cluster) range the task shaders or the cluster culling walk this frame
+    const MeshLod& selectedLod() const {
+        return clusterLodActive ? dagWindow : defaultMesh().lods[currentLod];
+    }
+
+    void updateUniformBuffer(uint32_t frameIndex) {
+        static auto startTime = std::chrono::high_resolution_clock::now();
+
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+
+        UniformBufferObject ubo{};
+
+        // the scene transform; the single instance of the model sits at the origin, so it carries the mesh fit as well
+        glm::mat4 sceneTransform = options.sceneInstances > 0 ? glm::mat4(1.0f) : meshTransform;
+        ubo.model = glm::rotate(sceneTransform, time * glm::radians(options.sceneInstances > 0 ? 10.0f : 90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     
         ubo.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
         ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 100.0f);
         ubo.proj[1][1] *= -1;
 
-        void* data;
-        vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-            memcpy(data, &ubo, sizeof(ubo));
-        vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+        // Gribb/Hartmann planes of proj * view, depth runs 0..1 so the near plane is just the third row
+        glm::mat4 viewProj = glm::transpose(ubo.proj * ubo.view);
+
+        ubo.frustum[0] = viewProj[3] + viewProj[0];
+        ubo.frustum[1] = viewProj[3] - viewProj[0];
+        ubo.frustum[2] = viewProj[3] + viewProj[1];
+        ubo.frustum[3] = viewProj[3] - viewProj[1];
+        ubo.frustum[4] = viewProj[2];
+        ubo.frustum[5] = viewProj[3] - viewProj[2];
+
+        for (auto& plane : ubo.frustum) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+
+        ubo.cameraPosition = glm::inverse(ubo.view)[3];
+
+        float pixelsPerUnit = std::abs(ubo.proj[1][1]) * 0.5f * float(swapChainExtent.height);
+
+        currentLod = selectLod(ubo.model, ubo.view, ubo.proj);
+
+        if (clusterLodActive) {
+            dagWindow = selectDagWindow(ubo.model, ubo.view, pixelsPerUnit);
+        }
+
+        const MeshLod& lod = selectedLod();
+        ubo.lodRange = glm::uvec4(lod.meshletOffset, lod.meshletCount, 0, 0);
+        ubo.lodSelection = glm::vec4(pixelsPerUnit, options.lodErrorPixels, clusterLodActive ? 1.0f : 0.0f, 0.0f);
+
+        // the timeline wait in drawFrame guarantees the GPU is done with this frame's slice of the ring
+        uniformRing.beginFrame(frameIndex);
+        frameUniforms = uniformRing.push(ubo);
+        frameConstants = ubo;
     }
 
     void drawFrame() {
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+        // waits for the frame that last used this slot to complete on the GPU
+        currentFrame = frameTimeline.beginFrame();
 
-        uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        // so the sets it allocated from its pool can go
+        if (!computeDescriptorPools.empty()) {
+            VK_CHECK(vkResetDescriptorPool(device, computeDescriptorPools[currentFrame], 0));
+        }
 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-            recreateSwapChain();
-            return;
-        } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-            throw std::runtime_error("failed to acquire swap chain image!");
+        frameTimeGPU = -1.0;
+
+        if (frameTimeline.submittedFrames() >= framesInFlight) {
+            uint64_t queryResults[2]; 
+            VK_CHECK(vkGetQueryPoolResults(device, queryPool, currentFrame*2, ARRAYSIZE(queryResults), sizeof(queryResults), queryResults, sizeof(queryResults[0]), VK_QUERY_RESULT_64_BIT));
+
+            frameTimeGPU = double(queryResults[1] - queryResults[0]) * deviceProperties.limits.timestampPeriod * 1e-6;
+        }
+
+        {
+            auto stats = static_cast<MeshletCullStats*>(cullStatsBufferMemory.data) + currentFrame;
+
+            cullStats = *stats;
+            *stats = {};
+        }
+
+        uint32_t imageIndex = currentFrame;
+
+        if (!options.headless) {
+            VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapChain();
+                return;
+            } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("failed to acquire swap chain image!");
+            }
         }
 
         updateUniformBuffer(currentFrame);
 
-        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        auto recordBegin = std::chrono::high_resolution_clock::now();
 
         vkResetCommandBuffer(commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
-        recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+
+        if (cpuDraws) {
+            secondaryRecorder.beginFrame(currentFrame);
+        }
+
+        uint64_t uploadValue = recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+
+        recordTimeCPU = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordBegin).count();
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
+        // binary semaphores ignore their entry in the timeline value arrays
+        std::array<VkSemaphore, 2> waitSemaphores {};
+        std::array<VkPipelineStageFlags, 2> waitStages {};
+        std::array<uint64_t, 2> waitValues {};
+        uint32_t waitCount = 0;
 
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+        VkSemaphore signalSemaphores[] = {frameTimeline.semaphore(), renderFinishedSemaphores[currentFrame]};
+        uint64_t signalValues[] = {frameTimeline.frameValue(), 0};
 
-        VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-        submitInfo.signalSemaphoreCount = 1;
+        if (!options.headless) {
+            waitSemaphores[waitCount] = imageAvailableSemaphores[currentFrame];
+            waitStages[waitCount++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        }
+
+        submitInfo.signalSemaphoreCount = options.headless ? 1 : 2;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
-        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+        if (uploadValue) {
+            waitSemaphores[waitCount] = uploader.timeline();
+            waitValues[waitCount] = uploadValue;
+            waitStages[waitCount++] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        }
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+        timelineInfo.waitSemaphoreValueCount = waitCount;
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+        timelineInfo.pSignalSemaphoreValues = signalValues;
+
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = waitCount;
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
 
+        frameTimeline.endFrame();
+
+        if (options.headless) {
+            return;
+        }
+
         VkPresentInfoKHR presentInfo{};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
         presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = signalSemaphores;
+        presentInfo.pWaitSemaphores = &renderFinishedSemaphores[currentFrame];
 
         VkSwapchainKHR swapChains[] = {swapChain};
         presentInfo.swapchainCount = 1;
@@ -2305,7 +3548,7 @@ private:
 
         presentInfo.pImageIndices = &imageIndex;
 
-        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
         if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
             framebufferResized = false;
@@ -2313,8 +3556,6 @@ private:
         } else if (result != VK_SUCCESS) {
             throw std::runtime_error("failed to present swap chain image!");
         }
-
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
     }
 
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
@@ -2385,8 +3626,8 @@ private:
 
         bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-        bool swapChainAdequate = false;
-        if (extensionsSupported) {
+        bool swapChainAdequate = options.headless;
+        if (extensionsSupported && !options.headless) {
             SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
             swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
         }
@@ -2394,7 +3635,35 @@ private:
         VkPhysicalDeviceFeatures supportedFeatures;
         vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-        return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+        // dynamic rendering and synchronization2 are core from here on
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+
+        bool apiSupported = properties.apiVersion >= VK_API_VERSION_1_3;
+
+        // the culling shaders sum their counters over the subgroup, one atomic per subgroup
+        bool subgroupSupported = false;
+
+        if (apiSupported) {
+            VkPhysicalDeviceSubgroupProperties subgroupProperties { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+            VkPhysicalDeviceProperties2 properties2 { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+            properties2.pNext = &subgroupProperties;
+            vkGetPhysicalDeviceProperties2(device, &properties2);
+
+            const VkSubgroupFeatureFlags operations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+
+            subgroupSupported = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT)
+                && (subgroupProperties.supportedOperations & operations) == operations;
+
+            // so does the NV task shader, which also compacts its meshlets with a ballot
+            if (!(subgroupProperties.supportedStages & VK_SHADER_STAGE_TASK_BIT_NV)
+                || !(subgroupProperties.supportedOperations & VK_SUBGROUP_FEATURE_BALLOT_BIT)) {
+                meshShaderNVAvailable = false;
+            }
+        }
+
+        return indices.isComplete() && extensionsSupported && swapChainAdequate && apiSupported && subgroupSupported && supportedFeatures.samplerAnisotropy
+            && supportedFeatures.drawIndirectFirstInstance;
     }
 
     bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
@@ -2406,6 +3675,13 @@ private:
 
         std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
+        meshShaderNVAvailable = false;
+        meshShaderEXTAvailable = false;
+
+        if (options.headless) {
+            requiredExtensions.erase(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        }
+
         for (const auto& extension : availableExtensions) {
 
             if (optionalDeviceExtensionActions.count(extension.extensionName))  {
@@ -2435,7 +3711,11 @@ private:
             }
 
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            if (options.headless) {
+                presentSupport = indices.graphicsFamily.has_value();
+            } else {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            }
 
             if (presentSupport) {
                 indices.presentFamily = i;
@@ -2448,15 +3728,37 @@ private:
             i++;
         }
 
+        // prefer a transfer-only family (the DMA engine), then any non-graphics family that can copy
+        for (uint32_t j = 0; j < queueFamilyCount; j++) {
+            VkQueueFlags flags = queueFamilies[j].queueFlags;
+
+            if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) {
+                continue;
+            }
+
+            if (!(flags & VK_QUEUE_COMPUTE_BIT)) {
+                indices.transferFamily = j;
+                break;
+            }
+
+            if (!indices.transferFamily.has_value()) {
+                indices.transferFamily = j;
+            }
+        }
+
         return indices;
     }
 
     std::vector<const char*> getRequiredExtensions() {
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        std::vector<const char*> extensions;
 
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        if (!options.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
 
         if (enableValidationLayers) {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -2497,23 +3799,94 @@ private:
     }
 };
 
-int main() {
-
-    HeVK app;
-
-    glslang_initialize_process();
+int main(int argc, char** argv) {
+
+    LaunchOptions options {};
+
+    bool benchLoad = false;          // time the OBJ loaders and exit, no Vulkan involved
+    bool benchMeshletBuild = false;  // time buildMeshlets and report meshlet fill, then exit
+    bool benchVertices = false;      // compare the packed vertex layouts, then exit
+    size_t benchTriangles = 10000000; // size of the synthetic OBJ used by the benchmarks
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.frameCount = uint32_t(std::max(atoi(argv[++i]), 1));
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            options.useCache = false;
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            options.cacheDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--no-mesh-shading") == 0) {
+            options.meshShading = false;
+        } else if (strcmp(argv[i], "--no-occlusion") == 0) {
+            options.occlusionCulling = false;
+        } else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc) {
+            options.lodErrorPixels = float(std::max(atof(argv[++i]), 0.0));
+        } else if (strcmp(argv[i], "--cluster-lod") == 0) {
+            options.clusterLod = true;
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            options.sceneInstances = uint32_t(std::max(atoll(argv[++i]), 0ll));
+        } else if (strcmp(argv[i], "--scene-mesh") == 0 && i + 1 < argc) {
+            options.sceneMeshes.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--cpu-draws") == 0) {
+            options.cpuDraws = true;
+        } else if (strcmp(argv[i], "--bench-recording") == 0) {
+            options.cpuDraws = true;
+            options.benchRecording = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threadCount = uint32_t(std::max(atoi(argv[++i]), 0));
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            options.framesInFlight = uint32_t(std::clamp(atoi(argv[++i]), 1, 8));
+        } else if (strcmp(argv[i], "--bench-load") == 0) {
+            benchLoad = true;
+        } else if (strcmp(argv[i], "--bench-meshlets") == 0) {
+            benchMeshletBuild = true;
+        } else if (strcmp(argv[i], "--bench-vertices") == 0) {
+            benchVertices = true;
+        } else if (strcmp(argv[i], "--bench-triangles") == 0 && i + 1 < argc) {
+            benchTriangles = size_t(std::max(atoll(argv[++i]), 1ll));
+        }
+    }
+
+    if (benchLoad || benchMeshletBuild || benchVertices) {
+        auto root_path = std::filesystem::path(__FILE__).parent_path();
+        ThreadPool pool {options.threadCount};
+
+        if (benchLoad) {
+            benchObjLoad(root_path / MODEL_PATH, benchTriangles, pool);
+        }
+        if (benchMeshletBuild) {
+            benchMeshlets(root_path / MODEL_PATH, benchTriangles, pool);
+        }
+        if (benchVertices) {
+            benchVertexFormats(root_path / MODEL_PATH, benchTriangles, pool);
+        }
+
+        // the fetch timing of the vertex layouts needs the device, the rest is done
+        if (!benchVertices) {
+            return EXIT_SUCCESS;
+        }
+
+        options.headless = true;
+        options.benchVertexFetch = true;
+    }
+
+    HeVK app {options};
 
     // testShaderCompilation("./shaders/shader.frag.spv", "../shaders/shader.frag.spv");
     // testShaderCompilation("./shaders/shader.vert.spv", "../shaders/shader.vert.spv");
 
+    // glslang is finalized on either way out, after the last compile
     try {
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
+        finalizeShaderCompiler();
         return EXIT_FAILURE;
     }
 
-    glslang_finalize_process();
+    finalizeShaderCompiler();
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 // #include <vulkan/vulkan_core.h>
 
 #include <iostream>
+#include <cstdint>
+#include <cstring>
 #include "shaders/mesh.glsl"
 
 #define VK_CHECK(x)                                                    \
@@ -23,7 +25,50 @@
 
 #define ARRAYSIZE(array) ( sizeof(array)/sizeof(array[0]) )
 
+// MurmurHash64A, used to key on-disk caches
+inline uint64_t hash64(const void* data, size_t size, uint64_t seed = 0)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	const int r = 47;
+
+	uint64_t h = seed ^ (size * m);
+
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	const uint8_t* end = bytes + (size / 8) * 8;
+
+	for (; bytes != end; bytes += 8)
+	{
+		uint64_t k;
+		memcpy(&k, bytes, 8);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	switch (size & 7)
+	{
+	case 7: h ^= uint64_t(bytes[6]) << 48; [[fallthrough]];
+	case 6: h ^= uint64_t(bytes[5]) << 40; [[fallthrough]];
+	case 5: h ^= uint64_t(bytes[4]) << 32; [[fallthrough]];
+	case 4: h ^= uint64_t(bytes[3]) << 24; [[fallthrough]];
+	case 3: h ^= uint64_t(bytes[2]) << 16; [[fallthrough]];
+	case 2: h ^= uint64_t(bytes[1]) << 8;  [[fallthrough]];
+	case 1: h ^= uint64_t(bytes[0]);
+	        h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
 #define VertexPulling 1
-#define MeshShading 0
+#define MeshShading 1 // allows the mesh shading paths, which one is used is probed at runtime
 
 // #endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 450
+
+// One level of the depth pyramid. The sampler reduces its 2x2 footprint with MAX, so every texel keeps the
+// farthest depth of the area it covers in the level above.
+layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;
+
+layout(binding = 0, r32f) uniform writeonly image2D outImage;
+layout(binding = 1) uniform sampler2D inImage;
+
+layout(push_constant) uniform block
+{
+	vec2 imageSize;
+};
+
+void main()
+{
+	uvec2 pos = gl_GlobalInvocationID.xy;
+
+	if (pos.x >= uint(imageSize.x) || pos.y >= uint(imageSize.y))
+		return;
+
+	float depth = texture(inImage, (vec2(pos) + vec2(0.5)) / imageSize).x;
+
+	imageStore(outImage, ivec2(pos), vec4(depth));
+}
@@ -0,0 +1,30 @@
+#version 450
+
+// Single sample copy of a multisampled depth attachment that keeps the farthest sample, the first pyramid
+// level is reduced from it.
+layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;
+
+layout(constant_id = 0) const int SAMPLE_COUNT = 4;
+
+layout(binding = 0, r32f) uniform writeonly image2D outImage;
+layout(binding = 1) uniform sampler2DMS inImage;
+
+layout(push_constant) uniform block
+{
+	vec2 imageSize;
+};
+
+void main()
+{
+	ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+
+	if (pos.x >= int(imageSize.x) || pos.y >= int(imageSize.y))
+		return;
+
+	float depth = 0.0;
+
+	for (int i = 0; i < SAMPLE_COUNT; ++i)
+		depth = max(depth, texelFetch(inImage, pos, i).x);
+
+	imageStore(outImage, pos, vec4(depth));
+}
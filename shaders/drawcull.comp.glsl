@@ -0,0 +1,129 @@
+#version 450
+#extension GL_GOOGLE_include_directive: require
+#extension GL_KHR_shader_subgroup_basic: require
+#extension GL_KHR_shader_subgroup_arithmetic: require
+
+#include "mesh.glsl"
+
+// one thread per cluster, survivors append an indexed draw for vkCmdDrawIndexedIndirectCount. With occlusion
+// culling it runs twice a frame: the early pass redraws what was visible last frame, the late pass tests every
+// cluster against the depth pyramid built in between and only draws the ones that were not drawn early.
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+
+    vec4 frustum[6]; // world space, xyz points inside
+    vec4 cameraPosition;
+
+    uvec4 lodRange; // x: first cluster of the selected level of detail, y: their count
+    vec4 lodSelection; // x: pixels per unit at distance 1, y: error threshold in pixels, z: 1 for the hierarchy
+} ubo;
+
+layout(binding = 1) readonly buffer Clusters
+{
+	Cluster clusters[];
+};
+
+layout(binding = 2) writeonly buffer DrawCommands
+{
+	DrawIndexedCommand draws[];
+};
+
+// cleared to zero before the dispatch
+layout(binding = 3) buffer DrawCount
+{
+	uint drawCount;
+};
+
+// per cluster, written by the late pass and read by the early pass of the next frame
+layout(binding = 4) buffer Visibility
+{
+	uint visibility[];
+};
+
+// farthest depth per texel, sampled with a MAX reduction sampler
+layout(binding = 5) uniform sampler2D depthPyramid;
+
+layout(binding = 6) buffer CullStats
+{
+	uint submitted;
+	uint emitted;
+	uint triangles;
+} stats;
+
+layout(binding = 7) readonly buffer ClusterLods
+{
+	MeshletLod clusterLods[];
+};
+
+layout(push_constant) uniform block
+{
+	vec2 pyramidSize;
+	uint late;      // a single pass without occlusion culling runs as a late pass
+	uint occlusion;
+};
+
+void main()
+{
+	if (gl_GlobalInvocationID.x >= ubo.lodRange.y)
+		return;
+
+	uint ci = ubo.lodRange.x + gl_GlobalInvocationID.x;
+
+	// the late (or only) pass sees every cluster of the level once
+	if (late != 0)
+	{
+		uint tested = subgroupAdd(1u);
+
+		if (subgroupElect())
+			atomicAdd(stats.submitted, tested);
+	}
+
+	// only drawn for a scene of a single untransformed instance, so the scene transform is the whole model matrix
+	bool visible = MESHLET_LOD_SELECTED(clusterLods[ci], ubo.model, ubo) && MESHLET_VISIBLE(clusters[ci], ubo.model, ubo);
+
+	if (late == 0)
+	{
+		if (visibility[ci] == 0 || !visible)
+			return;
+	}
+	else if (occlusion != 0)
+	{
+		if (visible)
+			visible = occlusionVisible((ubo.model * vec4(clusters[ci].center, 1.0)).xyz, clusters[ci].radius * length(ubo.model[0].xyz),
+				ubo.proj * ubo.view, depthPyramid, pyramidSize);
+
+		// a cluster flagged last frame that passes the frustum test has been drawn by the early pass
+		bool drawnEarly = visibility[ci] != 0;
+
+		visibility[ci] = visible ? 1 : 0;
+
+		if (!visible || drawnEarly)
+			return;
+	}
+	else if (!visible)
+	{
+		return;
+	}
+
+	// subgroup sums over the threads still active, so one atomic per subgroup reaches the host visible counters
+	uint drawn = subgroupAdd(1u);
+	uint triangles = subgroupAdd(clusters[ci].indexCount / 3);
+
+	if (subgroupElect())
+	{
+		atomicAdd(stats.emitted, drawn);
+		atomicAdd(stats.triangles, triangles);
+	}
+
+	uint di = atomicAdd(drawCount, 1);
+
+	draws[di].indexCount = clusters[ci].indexCount;
+	draws[di].instanceCount = 1;
+	draws[di].firstIndex = clusters[ci].firstIndex;
+	draws[di].vertexOffset = 0;
+	draws[di].firstInstance = 0;
+}
@@ -0,0 +1,227 @@
+#version 450
+#extension GL_GOOGLE_include_directive: require
+#extension GL_KHR_shader_subgroup_basic: require
+#extension GL_KHR_shader_subgroup_arithmetic: require
+
+#include "mesh.glsl"
+
+// 0: an indexed draw of the picked level for the vertex pulling path, 1: an EXT task command, 2: an NV one
+layout(constant_id = 0) const int TASK_COMMANDS = 0;
+
+// one thread per instance, visible instances pick a level of detail and append a draw whose firstInstance
+// (or, for the task commands, gl_DrawIDARB) leads the geometry stages back to the instance transform. With
+// occlusion culling it runs twice a frame like drawcull.comp.glsl, over whole instances instead of clusters.
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model; // the scene transform, applied on top of each instance
+    mat4 view;
+    mat4 proj;
+
+    vec4 frustum[6]; // world space, xyz points inside
+    vec4 cameraPosition;
+
+    uvec4 lodRange;
+    vec4 lodSelection; // x: pixels per unit at distance 1, y: error threshold in pixels, z: 1 for the hierarchy
+} ubo;
+
+layout(binding = 1) readonly buffer Meshes
+{
+	SceneMesh meshes[];
+};
+
+layout(binding = 2) readonly buffer InstanceMeshes
+{
+	uint instanceMeshes[];
+};
+
+layout(binding = 3) readonly buffer InstanceBounds
+{
+	vec4 instanceBounds[];
+};
+
+layout(binding = 4) readonly buffer InstancePositionScale
+{
+	vec4 instancePositionScale[];
+};
+
+// the same buffer is bound to both, only the one TASK_COMMANDS selects is written
+layout(binding = 5) writeonly buffer TaskCommands
+{
+	MeshTaskCommand taskCommands[];
+};
+
+layout(binding = 6) writeonly buffer DrawCommands
+{
+	DrawIndexedCommand draws[];
+};
+
+// cleared to zero before the dispatch
+layout(binding = 7) buffer DrawCount
+{
+	uint drawCount;
+};
+
+// only counted for the indexed draws, the task stage counts meshlets instead
+layout(binding = 8) buffer CullStats
+{
+	uint submitted;
+	uint emitted;
+	uint triangles;
+} stats;
+
+// per instance, written by the late pass and read by the early pass of the next frame
+layout(binding = 9) buffer Visibility
+{
+	uint visibility[];
+};
+
+// farthest depth per texel, sampled with a MAX reduction sampler
+layout(binding = 10) uniform sampler2D depthPyramid;
+
+layout(binding = 11) readonly buffer DagLevels
+{
+	ClusterDagLevel dagLevels[];
+};
+
+layout(push_constant) uniform block
+{
+	vec2 pyramidSize;
+	uint late;      // a single pass without occlusion culling runs as a late pass
+	uint occlusion;
+	uint instanceCount;
+};
+
+void main()
+{
+	uint ii = gl_GlobalInvocationID.x;
+
+	if (ii >= instanceCount)
+		return;
+
+	// the late (or only) pass sees every instance once
+	if (TASK_COMMANDS == 0 && late != 0)
+	{
+		uint tested = subgroupAdd(1u);
+
+		if (subgroupElect())
+			atomicAdd(stats.submitted, tested);
+	}
+
+	float sceneScale = length(ubo.model[0].xyz);
+
+	vec4 bounds = instanceBounds[ii];
+	vec3 center = (ubo.model * vec4(bounds.xyz, 1.0)).xyz;
+	float radius = bounds.w * sceneScale;
+
+	bool visible = true;
+
+	for (int i = 0; i < 6; ++i)
+		visible = visible && dot(ubo.frustum[i].xyz, center) + ubo.frustum[i].w >= -radius;
+
+	if (late == 0)
+	{
+		if (visibility[ii] == 0 || !visible)
+			return;
+	}
+	else if (occlusion != 0)
+	{
+		if (visible)
+			visible = occlusionVisible(center, radius, ubo.proj * ubo.view, depthPyramid, pyramidSize);
+
+		// an instance flagged last frame that passes the frustum test has been drawn by the early pass
+		bool drawnEarly = visibility[ii] != 0;
+
+		visibility[ii] = visible ? 1 : 0;
+
+		if (!visible || drawnEarly)
+			return;
+	}
+	else if (!visible)
+	{
+		return;
+	}
+
+	uint mi = instanceMeshes[ii];
+
+	// the same rule as selectLod on the CPU: the coarsest level whose error stays within the threshold, seen from
+	// the nearest point of the bounds
+	float distance = max(length(center - ubo.cameraPosition.xyz) - radius, 0.1);
+	float errorScale = sceneScale * instancePositionScale[ii].w * ubo.lodSelection.x / distance;
+
+	uint lod = 0;
+	uint lodCount = meshes[mi].lodCount;
+
+	while (lod + 1 < lodCount && meshes[mi].lods[lod + 1].error * errorScale <= ubo.lodSelection.y)
+		lod++;
+
+	uint di = atomicAdd(drawCount, 1);
+
+	if (TASK_COMMANDS != 0)
+	{
+		// the task stage picks the cut per meshlet when the hierarchy is on
+		bool hierarchy = ubo.lodSelection.z != 0.0 && meshes[mi].dagMeshletCount > 0;
+
+		uint meshletOffset = hierarchy ? meshes[mi].dagMeshletOffset : meshes[mi].lods[lod].meshletOffset;
+		uint meshletCount = hierarchy ? meshes[mi].dagMeshletCount : meshes[mi].lods[lod].meshletCount;
+
+		// only the levels that can hold part of the cut, walked coarse to fine, so a distant instance hands its
+		// few coarse meshlets to the task stage instead of every meshlet of the hierarchy
+		if (hierarchy)
+		{
+			float modelScale = sceneScale * instancePositionScale[ii].w;
+			float dagRadius = meshes[mi].dagRadius * modelScale;
+			float centerDistance = length(center - ubo.cameraPosition.xyz);
+
+			float nearest = max(centerDistance - dagRadius, 0.1);
+			float farthest = max(centerDistance + dagRadius, 0.1);
+
+			uint first = meshes[mi].dagLevelCount;
+			uint last = 0;
+
+			for (uint level = meshes[mi].dagLevelCount; level > 0; --level)
+			{
+				ClusterDagLevel dagLevel = dagLevels[meshes[mi].dagLevelOffset + level - 1];
+
+				if (dagLevelSelected(dagLevel, modelScale * ubo.lodSelection.x, nearest, farthest, ubo.lodSelection.y))
+				{
+					first = level - 1;
+					last = max(last, level - 1);
+				}
+			}
+
+			if (first <= last)
+			{
+				ClusterDagLevel firstLevel = dagLevels[meshes[mi].dagLevelOffset + first];
+				ClusterDagLevel lastLevel = dagLevels[meshes[mi].dagLevelOffset + last];
+
+				meshletOffset = firstLevel.meshletOffset;
+				meshletCount = lastLevel.meshletOffset + lastLevel.meshletCount - firstLevel.meshletOffset;
+			}
+		}
+
+		taskCommands[di].groupCountX = (meshletCount + MESHLETS_PER_TASK - 1) / MESHLETS_PER_TASK;
+		taskCommands[di].groupCountY = TASK_COMMANDS == 1 ? 1 : 0;
+		taskCommands[di].groupCountZ = 1;
+		taskCommands[di].instance = ii;
+		taskCommands[di].meshletOffset = meshletOffset;
+		taskCommands[di].meshletCount = meshletCount;
+	}
+	else
+	{
+		uint drawn = subgroupAdd(1u);
+		uint triangles = subgroupAdd(meshes[mi].lods[lod].indexCount / 3);
+
+		if (subgroupElect())
+		{
+			atomicAdd(stats.emitted, drawn);
+			atomicAdd(stats.triangles, triangles);
+		}
+
+		draws[di].indexCount = meshes[mi].lods[lod].indexCount;
+		draws[di].instanceCount = 1;
+		draws[di].firstIndex = meshes[mi].lods[lod].firstIndex;
+		draws[di].vertexOffset = int(meshes[mi].vertexOffset);
+		draws[di].firstInstance = ii;
+	}
+}
@@ -10,13 +10,237 @@
 #extension GL_EXT_shader_explicit_arithmetic_types_int16: require
 #extension GL_EXT_shader_explicit_arithmetic_types_int32: require
 
-struct Vertex
+// inverse of octEncode in VertexFormat.h
+vec3 octDecode(vec2 e)
 {
-    vec3 position;
-    f16vec2 coord;
-    f16vec3 normal;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+// struct Vertex with vertexPosition/vertexNormal/vertexCoord, generated from GpuVertex by setShaderInclude
+#include "vertex.glsl"
+
+// mirrors Meshlet in Mesh.h, the vertex references and micro-indices live in a separate uint stream
+struct Meshlet
+{
+    vec3 center;
+    float radius;
+    int8_t coneAxis[3];
+    int8_t coneCutoff;
+
+    uint vertexOffset;
+    uint triangleOffset;
+
+    uint8_t vertexCount;
+    uint8_t triangleCount;
+    uint16_t reserved;
+};
+
+// mirrors Cluster in Mesh.h, a meshlet drawn as a range of the regular index buffer
+struct Cluster
+{
+    vec3 center;
+    float radius;
+    int8_t coneAxis[3];
+    int8_t coneCutoff;
+
+    uint firstIndex;
+    uint indexCount;
+    uint reserved;
+};
+
+// mirrors MeshletLod in Mesh.h, parallel to the meshlets (clusters)
+struct MeshletLod
+{
+    vec4 bounds;
+    vec4 parentBounds;
+    float error;
+    float parentError;
+    float reserved[2];
+};
+
+// VkDrawIndexedIndirectCommand
+struct DrawIndexedCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+// mirrors SceneMeshLod in Scene.h, a level of a registered mesh in the shared buffers
+struct SceneMeshLod
+{
+    uint firstIndex;
+    uint indexCount;
+    uint meshletOffset;
+    uint meshletCount;
+    float error;
+    uint reserved[3];
+};
+
+#define SCENE_MAX_LODS 8
+
+// mirrors SceneMesh in Scene.h
+struct SceneMesh
+{
+    vec4 bounds;
+    uint vertexOffset;
+    uint lodCount;
+    uint dagMeshletOffset;
+    uint dagMeshletCount;
+    SceneMeshLod lods[SCENE_MAX_LODS];
+    uint dagLevelOffset;
+    uint dagLevelCount;
+    float dagRadius;
+    uint reserved;
+};
+
+// mirrors ClusterDagLevel in Mesh.h
+struct ClusterDagLevel
+{
+    uint meshletOffset;
+    uint meshletCount;
+    float minError;
+    float maxParentError;
+};
+
+#define MESHLETS_PER_TASK 32
+
+// mirrors MeshTaskCommand in main.cpp, written by the instance culling for each visible instance and read back
+// by the task stage through gl_DrawIDARB. The first words are VkDrawMeshTasksIndirectCommandEXT, or the NV one.
+struct MeshTaskCommand
+{
+    uint groupCountX; // taskCount for NV
+    uint groupCountY; // firstTask for NV
+    uint groupCountZ;
+    uint instance;
+    uint meshletOffset;
+    uint meshletCount;
+    uint reserved[2];
+};
+
+// written by the task stage, read by the mesh stage through gl_WorkGroupID
+struct MeshTaskPayload
+{
+    uint instance;
+    uint meshletIndices[MESHLETS_PER_TASK];
 };
 
+vec3 rotateQuat(vec3 v, vec4 q)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+// Model matrix of an instance from its SceneInstances entries, the scene transform (ubo.model) goes on top.
+mat4 instanceTransform(vec4 positionScale, vec4 rotation)
+{
+    return mat4(
+        vec4(rotateQuat(vec3(1.0, 0.0, 0.0), rotation) * positionScale.w, 0.0),
+        vec4(rotateQuat(vec3(0.0, 1.0, 0.0), rotation) * positionScale.w, 0.0),
+        vec4(rotateQuat(vec3(0.0, 0.0, 1.0), rotation) * positionScale.w, 0.0),
+        vec4(positionScale.xyz, 1.0));
+}
+
+// Frustum and backface cone test in world space. model must be a rotation and uniform scale, so the sphere
+// stays a sphere and the cone keeps its angle. coneCutoff >= 1 disables the cone test.
+bool meshletVisible(vec3 center, float radius, vec3 coneAxis, float coneCutoff, mat4 model, vec4 frustum[6], vec3 cameraPosition)
+{
+    center = (model * vec4(center, 1.0)).xyz;
+    radius *= length(model[0].xyz);
+
+    bool visible = true;
+
+    for (int i = 0; i < 6; ++i)
+        visible = visible && dot(frustum[i].xyz, center) + frustum[i].w >= -radius;
+
+    // the quantized cone has no apex, so test against the bounding sphere as meshoptimizer suggests
+    if (visible && coneCutoff < 1.0)
+    {
+        vec3 axis = normalize(mat3(model) * coneAxis);
+        vec3 view = center - cameraPosition;
+
+        visible = dot(view, axis) < coneCutoff * length(view) + radius;
+    }
+
+    return visible;
+}
+
+// loads the bounds of a Meshlet or Cluster, a cutoff of 127 means the normals span too wide for a cone
+#define MESHLET_VISIBLE(m, model, ubo) meshletVisible(m.center, m.radius, \
+    vec3(int(m.coneAxis[0]), int(m.coneAxis[1]), int(m.coneAxis[2])) / 127.0, \
+    m.coneCutoff == int8_t(127) ? 1.0 : float(int(m.coneCutoff)) / 127.0, \
+    model, ubo.frustum, ubo.cameraPosition.xyz)
+
+// Simplification error in pixels, seen from the nearest point of the sphere and at least the near plane.
+// pixelsPerUnit is the screen height in pixels covered by one unit at distance 1.
+float projectedError(vec4 bounds, float error, mat4 model, vec3 cameraPosition, float pixelsPerUnit)
+{
+    float scale = length(model[0].xyz);
+    vec3 center = (model * vec4(bounds.xyz, 1.0)).xyz;
+
+    float distance = max(length(center - cameraPosition) - bounds.w * scale, 0.1);
+
+    return error * scale * pixelsPerUnit / distance;
+}
+
+// A cluster of the hierarchy is part of the cut when it is precise enough and the group it was simplified into
+// is not. The errors grow monotonically towards the roots, so exactly one cluster on every path gets picked.
+bool lodSelected(MeshletLod lod, mat4 model, vec3 cameraPosition, float pixelsPerUnit, float threshold)
+{
+    return projectedError(lod.bounds, lod.error, model, cameraPosition, pixelsPerUnit) <= threshold &&
+        projectedError(lod.parentBounds, lod.parentError, model, cameraPosition, pixelsPerUnit) > threshold;
+}
+
+// Projects world space bounds to the screen and compares their nearest depth with the farthest one the pyramid
+// holds over that rectangle. Anything reaching in front of the near plane is kept.
+bool occlusionVisible(vec3 center, float radius, mat4 viewProj, sampler2D depthPyramid, vec2 pyramidSize)
+{
+    vec2 minUV = vec2(1.0);
+    vec2 maxUV = vec2(0.0);
+    float minDepth = 1.0;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = viewProj * vec4(corner, 1.0);
+
+        if (clip.z < 0.0)
+            return true;
+
+        vec3 ndc = clip.xyz / clip.w;
+
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        minDepth = min(minDepth, ndc.z);
+    }
+
+    minUV = clamp(minUV, vec2(0.0), vec2(1.0));
+    maxUV = clamp(maxUV, vec2(0.0), vec2(1.0));
+
+    // the level where the rectangle spans at most one texel, so the 2x2 footprint of the sampler covers it
+    vec2 extent = (maxUV - minUV) * pyramidSize;
+    float level = ceil(log2(max(max(extent.x, extent.y), 1.0)));
+
+    float depth = textureLod(depthPyramid, (minUV + maxUV) * 0.5, level).x;
+
+    return minDepth <= depth;
+}
+
+// Whether a level of the hierarchy can hold part of the cut, for a mesh whose spheres all lie between nearest and
+// farthest from the camera. errorScale is the model scale times the pixels per unit at distance 1.
+bool dagLevelSelected(ClusterDagLevel level, float errorScale, float nearest, float farthest, float threshold)
+{
+    return level.minError * errorScale / nearest <= threshold && level.maxParentError * errorScale / farthest > threshold;
+}
+
+// every meshlet of a discrete level is selected, lodSelection.z is set while lodRange covers the hierarchy
+#define MESHLET_LOD_SELECTED(lod, model, ubo) (ubo.lodSelection.z == 0.0 || \
+    lodSelected(lod, model, ubo.cameraPosition.xyz, ubo.lodSelection.x, ubo.lodSelection.y))
+
 #else
 
 // C++
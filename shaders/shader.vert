@@ -12,6 +12,15 @@ layout(set=0, binding=0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
+// the instance table, gl_InstanceIndex is the firstInstance of the draw
+layout(set=0, binding=7) readonly buffer InstancePositionScale {
+    vec4 instancePositionScale[];
+};
+
+layout(set=0, binding=8) readonly buffer InstanceRotation {
+    vec4 instanceRotation[];
+};
+
 #if (VertexPulling)
 
 layout(set=0, binding=2) readonly buffer Vertices {
@@ -20,9 +29,10 @@ layout(set=0, binding=2) readonly buffer Vertices {
 
 #else
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec2 inCoord; // VK_FORMAT_R16G16_SFLOAT
-layout(location = 2) in vec3 inNormal;
+// GpuVertex::getAttributeDescriptions, the formats expand the packed fields to floats
+layout(location = 0) in vec3 inQuantizedPosition;
+layout(location = 1) in vec2 inOctNormal;
+layout(location = 2) in vec2 inCoord;
 
 #endif
 
@@ -35,13 +45,20 @@ void main() {
 
     Vertex v_pulling = vertices[gl_VertexIndex];
 
-    vec3 inPosition = v_pulling.position;
-    vec3 inNormal = v_pulling.normal;
-    vec2 inCoord = v_pulling.coord;
+    vec3 inPosition = vertexPosition(v_pulling);
+    vec3 inNormal = vertexNormal(v_pulling);
+    vec2 inCoord = vertexCoord(v_pulling);
+
+#else
+
+    vec3 inPosition = dequantizePosition(inQuantizedPosition);
+    vec3 inNormal = octDecode(inOctNormal);
 
 #endif
 
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    mat4 model = ubo.model * instanceTransform(instancePositionScale[gl_InstanceIndex], instanceRotation[gl_InstanceIndex]);
+
+    gl_Position = ubo.proj * ubo.view * model * vec4(inPosition, 1.0);
     fragNormal = inNormal;
     fragCoord = inCoord;
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#version 450
+#extension GL_EXT_mesh_shader: require
+#extension GL_GOOGLE_include_directive: require
+
+#include "mesh.glsl"
+
+#define DEBUG 1
+
+// vertex references in meshletData are two 16-bit indices per word
+layout(constant_id = 0) const int SHORT_VERTEX_INDICES = 0;
+
+layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+layout(triangles, max_vertices = 64, max_primitives = 124) out;
+
+layout(set=0, binding=0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(binding = 2) readonly buffer Vertices
+{
+	Vertex vertices[];
+};
+
+layout(binding = 3) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 4) readonly buffer MeshletData
+{
+	uint meshletData[];
+};
+
+layout(binding = 7) readonly buffer InstancePositionScale
+{
+	vec4 instancePositionScale[];
+};
+
+layout(binding = 8) readonly buffer InstanceRotation
+{
+	vec4 instanceRotation[];
+};
+
+taskPayloadSharedEXT MeshTaskPayload payload;
+
+layout(location = 0) out vec4 color[];
+
+uint hash(uint a) 
+{ 
+   a = (a+0x7ed55d16) + (a<<12); 
+   a = (a^0xc761c23c) ^ (a>>19); 
+   a = (a+0x165667b1) + (a<<5); 
+   a = (a+0xd3a2646c) ^ (a<<9); 
+   a = (a+0xfd7046c5) + (a<<3); 
+   a = (a^0xb55a4f09) ^ (a>>16); 
+   return a; 
+} 
+
+void main()
+{
+	uint mi = payload.meshletIndices[gl_WorkGroupID.x]; // meshlet that survived the task stage
+	uint ti = gl_LocalInvocationID.x; // ID inside threadgroup
+
+	uint instance = payload.instance;
+	mat4 model = ubo.model * instanceTransform(instancePositionScale[instance], instanceRotation[instance]);
+
+	uint vertexCount = uint(meshlets[mi].vertexCount); 
+	uint triangleCount = uint(meshlets[mi].triangleCount); 
+
+	uint vertexOffset = meshlets[mi].vertexOffset;
+	uint triangleOffset = meshlets[mi].triangleOffset;
+
+	SetMeshOutputsEXT(vertexCount, triangleCount);
+
+#if DEBUG
+
+	uint mhash = hash(mi); 
+	vec3 mcolor = vec3(float(mhash & 255), float((mhash >> 8) & 255), float((mhash >> 16) & 255)) / 255.0; 
+
+#endif
+
+	for (uint i = ti; i < vertexCount; i+=32)
+	{
+		uint vi = SHORT_VERTEX_INDICES != 0
+			? (meshletData[vertexOffset + i / 2] >> ((i & 1) * 16)) & 0xffff
+			: meshletData[vertexOffset + i];
+
+		vec3 position = vertexPosition(vertices[vi]);
+		vec3 normal = vertexNormal(vertices[vi]);
+
+		gl_MeshVerticesEXT[i].gl_Position = ubo.proj * ubo.view * model * vec4(position, 1.0); 
+		color[i] = vec4(normal, 1.0);
+	#if DEBUG
+		color[i].rgb = mcolor;
+	#endif
+	}
+
+	// micro-indices are 3 bytes per triangle packed 4 per word, so a triangle may straddle two words
+	for (uint i = ti; i < triangleCount; i+=32)
+	{
+		uint first = i * 3;
+		uvec3 word = uvec3(first, first + 1, first + 2) / 4;
+		uvec3 shift = (uvec3(first, first + 1, first + 2) % 4) * 8;
+
+		gl_PrimitiveTriangleIndicesEXT[i] = uvec3(
+			(meshletData[triangleOffset + word.x] >> shift.x) & 0xff,
+			(meshletData[triangleOffset + word.y] >> shift.y) & 0xff,
+			(meshletData[triangleOffset + word.z] >> shift.z) & 0xff);
+	}
+}
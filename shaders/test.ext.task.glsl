@@ -0,0 +1,106 @@
+#version 450
+#extension GL_EXT_mesh_shader: require
+#extension GL_GOOGLE_include_directive: require
+#extension GL_ARB_shader_draw_parameters: require
+
+#include "mesh.glsl"
+
+// one thread per meshlet, compacted through shared memory since the subgroup size varies across vendors
+layout(local_size_x = MESHLETS_PER_TASK, local_size_y = 1, local_size_z = 1) in;
+
+layout(set=0, binding=0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+
+    vec4 frustum[6]; // world space, xyz points inside
+    vec4 cameraPosition;
+
+    uvec4 lodRange; // unused, the instance culling picks the range per instance
+    vec4 lodSelection; // x: pixels per unit at distance 1, y: error threshold in pixels, z: 1 for the hierarchy
+} ubo;
+
+layout(binding = 3) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 5) buffer CullStats
+{
+	uint submitted;
+	uint emitted;
+	uint triangles;
+} stats;
+
+layout(binding = 6) readonly buffer MeshletLods
+{
+	MeshletLod meshletLods[];
+};
+
+layout(binding = 7) readonly buffer InstancePositionScale
+{
+	vec4 instancePositionScale[];
+};
+
+layout(binding = 8) readonly buffer InstanceRotation
+{
+	vec4 instanceRotation[];
+};
+
+// one per visible instance, the level or hierarchy range its meshlets are picked from
+layout(binding = 9) readonly buffer TaskCommands
+{
+	MeshTaskCommand taskCommands[];
+};
+
+taskPayloadSharedEXT MeshTaskPayload payload;
+
+shared uint visibleCount;
+shared uint visibleTriangles;
+
+void main()
+{
+	MeshTaskCommand command = taskCommands[gl_DrawIDARB];
+
+	uint ti = gl_LocalInvocationID.x;
+	uint mi = command.meshletOffset + gl_WorkGroupID.x * MESHLETS_PER_TASK + ti;
+
+	uint meshletEnd = command.meshletOffset + command.meshletCount;
+
+	mat4 model = ubo.model * instanceTransform(instancePositionScale[command.instance], instanceRotation[command.instance]);
+
+	if (ti == 0)
+	{
+		visibleCount = 0;
+		visibleTriangles = 0;
+	}
+
+	barrier();
+
+	bool visible = mi < meshletEnd;
+
+	if (visible)
+		visible = MESHLET_LOD_SELECTED(meshletLods[mi], model, ubo) && MESHLET_VISIBLE(meshlets[mi], model, ubo);
+
+	if (ti == 0)
+		payload.instance = command.instance;
+
+	if (visible)
+	{
+		payload.meshletIndices[atomicAdd(visibleCount, 1)] = mi;
+		atomicAdd(visibleTriangles, uint(meshlets[mi].triangleCount));
+	}
+
+	barrier();
+
+	uint count = visibleCount;
+
+	if (ti == 0)
+	{
+		atomicAdd(stats.submitted, min(MESHLETS_PER_TASK, command.meshletCount - gl_WorkGroupID.x * MESHLETS_PER_TASK));
+		atomicAdd(stats.emitted, count);
+		atomicAdd(stats.triangles, visibleTriangles);
+	}
+
+	EmitMeshTasksEXT(count, 1, 1);
+}
@@ -8,8 +8,11 @@
 
 #define threadgroup_size 32
 
+// vertex references in meshletData are two 16-bit indices per word
+layout(constant_id = 0) const int SHORT_VERTEX_INDICES = 0;
+
 layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
-layout(triangles, max_vertices = 64, max_primitives = 126) out;
+layout(triangles, max_vertices = 64, max_primitives = 124) out;
 
 layout(set=0, binding=0) uniform UniformBufferObject {
     mat4 model;
@@ -22,21 +25,31 @@ layout(binding = 2) readonly buffer Vertices
 	Vertex vertices[];
 };
 
-struct Meshlet
+layout(binding = 3) readonly buffer Meshlets
 {
-	uint32_t vertices[64];
-	uint8_t indices[126*3]; // up to 126 triangles
+	Meshlet meshlets[];
+};
 
-	uint8_t vertexCount;
-	//uint8_t indexCount;
-	uint8_t triangleCount;
+layout(binding = 4) readonly buffer MeshletData
+{
+	uint meshletData[];
 };
 
-layout(binding = 3) readonly buffer Meshlets
+layout(binding = 7) readonly buffer InstancePositionScale
 {
-	Meshlet meshlets[];
+	vec4 instancePositionScale[];
 };
 
+layout(binding = 8) readonly buffer InstanceRotation
+{
+	vec4 instanceRotation[];
+};
+
+taskNV in Task
+{
+	MeshTaskPayload payload;
+} IN;
+
 layout(location = 0) out vec4 color[];
 
 uint hash(uint a) 
@@ -52,13 +65,19 @@ uint hash(uint a)
 
 void main()
 {
-	uint mi = gl_WorkGroupID.x; // threadgroup ID
+	uint mi = IN.payload.meshletIndices[gl_WorkGroupID.x]; // meshlet that survived the task stage
 	uint ti = gl_LocalInvocationID.x; // ID inside threadgroup
 
+	uint instance = IN.payload.instance;
+	mat4 model = ubo.model * instanceTransform(instancePositionScale[instance], instanceRotation[instance]);
+
 	uint vertexCount = uint(meshlets[mi].vertexCount); 
 	uint triangleCount = uint(meshlets[mi].triangleCount); 
 	uint indexCount = triangleCount * 3; 
 
+	uint vertexOffset = meshlets[mi].vertexOffset;
+	uint triangleOffset = meshlets[mi].triangleOffset;
+
 #if DEBUG
 
 	uint mhash = hash(mi); 
@@ -68,13 +87,15 @@ void main()
 
 	for (uint i = ti; i < vertexCount; i+=32)
 	{
-		uint vi = meshlets[mi].vertices[i];
+		uint vi = SHORT_VERTEX_INDICES != 0
+			? (meshletData[vertexOffset + i / 2] >> ((i & 1) * 16)) & 0xffff
+			: meshletData[vertexOffset + i];
 
-		vec3 position = vertices[vi].position;
-		vec3 normal = vertices[vi].normal;
-		vec2 coord = vertices[vi].coord;  
+		vec3 position = vertexPosition(vertices[vi]);
+		vec3 normal = vertexNormal(vertices[vi]);
+		vec2 coord = vertexCoord(vertices[vi]);
 
-		gl_MeshVerticesNV[i].gl_Position = ubo.proj * ubo.view * ubo.model * vec4(position, 1.0); 
+		gl_MeshVerticesNV[i].gl_Position = ubo.proj * ubo.view * model * vec4(position, 1.0); 
 		//vec4(position * vec3(1, 1, 0.5) + vec3(0, 0, 0.5), 1.0);
 		color[i] = vec4(normal, 1.0); //vec4(normal * 0.5 + vec3(0.5), 1.0);
 	#if DEBUG
@@ -82,10 +103,10 @@ void main()
 	#endif
 	}
 
-	for (uint i = ti; i < indexCount; i+=32)
+	// micro-indices are packed 4 per word and padded, max_primitives*3 is a multiple of 4 so the last write stays in range
+	for (uint i = ti; i * 4 < indexCount; i+=32)
 	{
-		// TODO: possibly bad for perf, consider writePackedPrimitiveIndices4x8NV
-		gl_PrimitiveIndicesNV[i] = uint(meshlets[mi].indices[i]);
+		writePackedPrimitiveIndices4x8NV(i * 4, meshletData[triangleOffset + i]);
 	}
 
 	if (ti == 0) {
@@ -0,0 +1,45 @@
+#version 450
+#extension GL_GOOGLE_include_directive: require
+
+#include "mesh.glsl"
+
+// One thread per index of the full model, in cluster order: fetches and decodes the vertex it refers to the
+// way the geometry stages do. --bench-vertices times it once for every PackedVertex layout, each compiled
+// against its own vertex.glsl.
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0) readonly buffer Vertices
+{
+	Vertex vertices[];
+};
+
+layout(binding = 1) readonly buffer Indices
+{
+	uint indices[];
+};
+
+// only written when the decoded values hit a value they never do, which keeps the fetch alive
+layout(binding = 2) writeonly buffer Checksum
+{
+	vec4 checksum;
+};
+
+layout(push_constant) uniform block
+{
+	uint indexCount;
+};
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+
+	if (i >= indexCount)
+		return;
+
+	Vertex v = vertices[indices[i]];
+
+	vec3 sum = vertexPosition(v) + vertexNormal(v) + vec3(vertexCoord(v), 0.0);
+
+	if (sum.x == -12345.0)
+		checksum = vec4(sum, 1.0);
+}